@@ -5,42 +5,65 @@
 #include "machine_coder.h"
 #include "passes.h"
 #include "file_utils.h"
+#include "include_cache.h"
+#include "incbin.h"
+#include "string_utils.h"
+#include "checker.h"
+#include "watch.h"
+#include "lsp.h"
+#include "pipeline.h"
+#include "batch_io.h"
+#include "peephole.h"
+#include "data_opt.h"
 
 
 /*********************************** Global variables ***********************************/
 
+/* Command line options */
+THREAD_LOCAL Options options = {0, DIAG_TEXT, 0, EMIT_FILES, NULL, 0, 0, 0, 0, 0, DEFAULT_MAX_RETAINED_MB, 0, 0, 0, 0, 0};
+
 /* Keep track of errors */
-int n_errors = 0;
+THREAD_LOCAL int n_errors = 0;
 
-char line[LINE_LEN];
+THREAD_LOCAL char line[LINE_LEN];
 
 /* Keep track of source file line_num (including blank lines) to indicate the line number in case of errors  */
-int line_num = 0;
+THREAD_LOCAL int line_num = 0;
+
+/* The included file that line_num is a line of (NULL if it's a line of the input file itself) */
+THREAD_LOCAL char* line_source = NULL;
 
 /* Keep track of valid parsed lines (this is the length of the parsed_lines array below) */
-int n_lines = 0;
+THREAD_LOCAL int n_lines = 0;
 
 /* * Processed input lines will be stored in an array of structured data */
-ParsedLine** parsed_lines;
+THREAD_LOCAL ParsedLine** parsed_lines;
 
 /* Keep track of number of symbols during the pre-processing stage */
-int n_symbols = 0;
+THREAD_LOCAL int n_symbols = 0;
 
 /* During the pre-processing stage, keep track of number of words
  * (instruction/operand) that will be generated so we can efficiently
  * allocate the correct size array for the code/data images without
  * assuming anything about the size of the input */
-int n_code_words = 0;
+THREAD_LOCAL int n_code_words = 0;
 
 /* During the pre-processing stage, keep track of number of data words
  * that will be generated so we can efficiently allocate the correct size array
  * for the code/data images without assuming anything about the size of the input */
-int n_data_words = 0;
+THREAD_LOCAL int n_data_words = 0;
 
 /* SymbolInfos for instances of symbol references are stored in pass 1 for use in pass 2 */
-SymbolInfo* symbol_references;
-int i_symbol_ref = 0;
-int n_symbol_refs = 0;
+THREAD_LOCAL SymbolInfo* symbol_references;
+THREAD_LOCAL int i_symbol_ref = 0;
+THREAD_LOCAL int n_symbol_refs = 0;
+
+/* The operands and .data args that are constant expressions (with names in them), and the .equ's: if there are any,
+ * the first pass isn't split between threads, since the constants are defined and used in the order of the lines */
+THREAD_LOCAL int n_expressions = 0;
+
+/* The arrays kept between input files */
+THREAD_LOCAL Workspace workspace = {NULL, 0, NULL, 0};
 
 /* Initializing the 8 predefined registers */
 Register registers[] = {
@@ -54,13 +77,17 @@ Register registers[] = {
     {"r7", 7}
 };
 
-/* Construct specification info for the 4 assembler directives
-('.entry', '.extern', '.data', '.string') */
-Directive directives[4] = {
+/* Construct specification info for the 8 assembler directives
+('.entry', '.extern', '.data', '.string', '.include', '.equ', '.incbin', '.space') */
+Directive directives[N_DIRECTIVES] = {
     {".string", 1, STRING},  /* e.g. .string "abcd" which is converted to .string 'a', 'b', 'c', 'd', '\0' */
     {".data", 999999, INT}, /*  e.g. .data 6, -9, 87...*/
     {".entry", 1, LABEL}, /* e.g. .entry MAIN */
-    {".extern", 1, LABEL}  /* e.g. .extern MAX}*/
+    {".extern", 1, LABEL},  /* e.g. .extern MAX}*/
+    {".include", 1, STRING},  /* e.g. .include "common.as" (expanded during pre-processing) */
+    {".equ", 2, CONSTANT},  /* e.g. .equ SIZE, 4*8+1 (an assemble-time constant, used as #SIZE or in .data) */
+    {".incbin", 4, BINARY},  /* e.g. .incbin "table.bin", 0, 1024, 2 (words read from a binary file, see incbin.h) */
+    {".space", 1, SPACE}  /* e.g. .space 512 (zero words, reserved in the zero region after the data) */
 };
 
 /*
@@ -127,95 +154,351 @@ Op ops[] = {
 * We then proceed to the core part of the assembler i.e. the '2 passes' of encoding and
 * generating the machine code output, as described below:
 */
+#ifndef ASM_LIBRARY /* (the library has asm_assemble instead, see libassembler.h) */
 int main(int argc, char * argv[]) {
-    FILE* fp;
     int i_inputs;
-    char * input_path;
+    int n_inputs;
+    char** inputs;
     int rc = 0;
-    ParsedLine *parsed_line;
 
-    if (argc < 2) {
-        printf("No input files specified.\nUsage: assembler <file1> [<file2> <file3> ...]\n");
+    inputs = (char**)malloc(sizeof(char*) * argc);
+    if (inputs == NULL || !parse_options(argc, argv, inputs, &n_inputs) || (n_inputs == 0 && options.watch_dir == NULL && !options.lsp)) {
+        printf("No input files specified.\n");
+        print_usage();
+        free(inputs);
         return 1;
     }
 
-    /* Process each .as file given in the cmd line input */
-    for (i_inputs = 1; i_inputs < argc; i_inputs++) {
-        reset_counters();
-
-        input_path = create_file_name(argv[i_inputs], ".as");
-        fp = fopen(input_path, "r");
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Unable to open '%s'\n", input_path);
-            continue;
-        }
+    if (options.lsp) {
+        rc = serve_lsp();
+        reset_parse_memo();
+        free_include_cache();
+        free_incbin_cache();
+        free(inputs);
+        return rc;
+    }
 
-        printf("\n>>> \'%s\'\n\n", input_path);
+    if (options.watch_dir != NULL) {
+        rc = watch_directory(options.watch_dir);
+        reset_parse_memo();
+        free_include_cache();
+        free_incbin_cache();
+        free(inputs);
+        return rc;
+    }
 
-        /* Pre-processing stage: Parse, validate and restructure input file line by line: */
-        while (fgets(line, sizeof(line), fp) != NULL) {
-            line_num++;
-            parsed_line = parse_line(line_num, line);
-            if (parsed_line != NULL && add_parsed_line(parsed_line)) {
-                /* Keep track of how many entries we will have to allocate for the symbol table: */
-                n_symbols += get_num_symbols(parsed_line);
+    /* Process each .as file given in the cmd line input
+     * (when there are several, the next ones are read ahead, and the output files are written in batches) */
+    if (n_inputs > 1 && !options.blocking_io) {
+        start_batch_io(inputs, n_inputs);
+    }
+    for (i_inputs = 0; i_inputs < n_inputs; i_inputs++) {
+        rc |= options.check_only ? check_file(inputs[i_inputs]) : assemble_file(inputs[i_inputs]);
+        if (options.stats && !options.check_only) {
+            print_stats();
+        }
+    }
+    rc |= finish_batch_io();
+    free_memory();
+    reset_parse_memo();
+    free_include_cache();
+    free_incbin_cache();
+    free(inputs);
+    return rc > 0;
+}
+#endif
 
-                /* Keep track of how many words we will have to allocate for the code image: */
-                n_code_words += get_num_code_words(parsed_line);
+/* Assemble a single input file (given without the .as extension)
+ * Returns the number of errors found */
+int assemble_file(char* input_arg) {
+    FILE* fp;
+    char * input_path;
+    ParsedLine *parsed_line;
 
-                /* Keep track of how many words we will have to allocate for the data image: */
-                n_data_words += get_num_data_words(parsed_line);
+    reset_counters();
 
-                /* Keep track of how many symbol references we need to allocate for: */
-                n_symbol_refs += get_num_symbol_refs(parsed_line);
-            }
-        }
-        fclose(fp);
+    fp = open_input_file(input_arg, &input_path);
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Unable to open '%s'\n", input_path);
         free(input_path);
+        return 0;
+    }
 
-        if (n_errors) { /* no point in carrying on to next stage */
-            printf("*** Syntax checker found %i errors. Skipping file. ***\n", n_errors);
-            free_parsed_lines();
-            rc |= n_errors;
+    fprintf(status_stream(), "\n>>> \'%s\'\n\n", input_path);
+
+    /* Pre-processing stage: Parse, validate and restructure input file line by line
+     * (stopping early if the --max-errors limit was reached).
+     * In pipelined mode, the lines are encoded by another thread as soon as they are parsed */
+    set_incbin_source(input_path);
+    if (options.pipeline) {
+        encode_pipelined(fp, input_path);
+    }
+    while (!options.pipeline && !diag_limit_reached() && fgets(line, sizeof(line), fp) != NULL) {
+        line_num++;
+        parsed_line = parse_line(line_num, line);
+        if (parsed_line == NULL) {
             continue;
         }
+        if (is_include_directive(parsed_line)) {
+            /* Splice the (cached) parsed lines of the included file in place of the directive: */
+            expand_include(input_path, parsed_line, register_parsed_line);
+            free_parsed_line(parsed_line);
+        }
+        else {
+            register_parsed_line(parsed_line);
+        }
+    }
+    close_input_file(fp);
+    set_incbin_source(NULL);
+
+    if (n_errors) { /* no point in carrying on to next stage */
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** Syntax checker found %i errors. Skipping file. ***\n", n_errors);
+        if (options.pipeline) {
+            discard_pipelined_pass();
+        }
+        release_workspace();
+        free(input_path);
+        return n_errors;
+    }
 
-        /* Allocate memory for the assembler stages: */
-        if (!init_code_image(n_code_words) ||
-            !init_data_image(n_data_words) ||
-            !init_word_types(n_code_words + n_data_words) ||
-            !init_symbol_refs()) {
+    /* Allocate memory for the assembler stages: */
+    if (!options.pipeline && (!init_code_image(n_code_words) ||
+        !init_data_image(n_data_words) ||
+        !init_word_types(n_code_words + n_data_words) ||
+        !init_symbol_refs())) {
 
-            printf("*** Memory allocation error. Skipping file. ***.\n");
-            n_errors++;
-            rc |= n_errors;
-            continue;
-        }
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** Memory allocation error. Skipping file. ***.\n");
+        n_errors++;
+        release_workspace();
+        free(input_path);
+        return n_errors;
+    }
 
-        /* Do the 'first pass' on the validated and structured input to build symbol table and
-         * to start encoding machine code output */
+    /* Do the 'first pass' on the validated and structured input to build symbol table and
+     * to start encoding machine code output */
+    if (options.pipeline) {
+        finish_pipelined_pass();
+    }
+    else {
         first_pass();
-        if (n_errors) { /* no point in carrying on to next stage */
-            printf("*** %i errors found in first pass. Skipping file. ***\n", n_errors);
-            free_memory();
-            rc |= n_errors;
-            continue;
+    }
+    if (n_errors) { /* no point in carrying on to next stage */
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** %i errors found in first pass. Skipping file. ***\n", n_errors);
+        release_workspace();
+        free(input_path);
+        return n_errors;
+    }
+
+    /* The optional passes between the first and the second pass (before the operands are filled in).
+     * Not in --watch mode, where the other files are reassembled incrementally, without them */
+    if (options.optimize && options.watch_dir == NULL) { /* -O: redundant jumps and no-op instructions */
+        optimize_code();
+    }
+    if (options.gc_code && options.watch_dir == NULL) { /* --gc-code: the unreachable code */
+        eliminate_unreachable();
+    }
+    if (options.gc_data && options.watch_dir == NULL) { /* --gc-data: the unreferenced data */
+        gc_data();
+    }
+    if (options.pool_data && options.watch_dir == NULL) { /* --pool-data: share the identical data words */
+        pool_data();
+    }
+    if (options.relax_branches && options.watch_dir == NULL) { /* --relax-branches: branch by RELATIVE addressing */
+        relax_branches();
+    }
+
+    /* Do the 'second pass' to fill missing info from the completed symbol table */
+    second_pass();
+
+    /* If no errors, generate output files */
+    if (!n_errors) {
+        flush_diagnostics(input_path); /* warnings */
+        create_output_files(input_arg);
+        flush_diagnostics(input_path);
+        if (options.optimize && options.watch_dir == NULL) {
+            print_peephole_stats();
         }
+        if (options.gc_code && options.watch_dir == NULL) {
+            print_unreachable_stats();
+        }
+        if (options.gc_data && options.watch_dir == NULL) {
+            print_gc_stats();
+        }
+        if (options.pool_data && options.watch_dir == NULL) {
+            print_pool_stats();
+        }
+        if (options.relax_branches && options.watch_dir == NULL) {
+            print_relax_stats();
+        }
+    }
+    else {
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** %i errors found in second pass. Skipping file. ***\n", n_errors);
+    }
+    release_workspace();
+    free(input_path);
+    return n_errors;
+}
+
+/* Prints the stats of the file that was just assembled (--stats) */
+void print_stats() {
+    ParseStats stats = get_parse_stats();
+    fprintf(status_stream(), "  - Parse memo: %i of %i lines reused (%.1f%% hit rate)\n", stats.n_hits, stats.n_lookups,
+            stats.n_lookups > 0 ? 100.0 * stats.n_hits / stats.n_lookups : 0.0);
+}
 
-        /* Do the 'second pass' to fill missing info from the completed symbol table */
-        second_pass();
+/* Prints what the peephole optimizer (-O) did to the file that was just assembled */
+void print_peephole_stats() {
+    PeepholeStats stats = get_peephole_stats();
+    fprintf(status_stream(), "  - Peephole: %i words saved (%i instructions removed, %i branches retargeted)\n",
+            stats.n_removed_words, stats.n_removed_instructions, stats.n_retargeted_branches);
+}
+
+/* Prints what --pool-data did to the file that was just assembled */
+void print_pool_stats() {
+    DataOptStats stats = get_pool_stats();
+    fprintf(status_stream(), "  - Data pool: %i words saved (%i blocks pooled, data image %i -> %i words)\n",
+            stats.n_saved_words, stats.n_blocks, stats.dc_before, stats.dc_after);
+}
+
+/* Prints what --gc-code did to the file that was just assembled */
+void print_unreachable_stats() {
+    UnreachableStats stats = get_unreachable_stats();
+    fprintf(status_stream(), "  - Unreachable code: %i words removed (%i of %i basic blocks)\n",
+            stats.n_removed_words, stats.n_removed_blocks, stats.n_blocks);
+}
 
-        /* If no errors, generate output files */
-        if (!n_errors) {
-            create_output_files(argv[i_inputs]);
+/* Prints what --gc-data did to the file that was just assembled */
+void print_gc_stats() {
+    DataOptStats stats = get_gc_stats();
+    fprintf(status_stream(), "  - Dead data: %i words saved (%i blocks dropped, data image %i -> %i words)\n",
+            stats.n_saved_words, stats.n_blocks, stats.dc_before, stats.dc_after);
+}
+
+/* Prints how many relocatable words are left after --relax-branches */
+void print_relax_stats() {
+    RelaxStats stats = get_relax_stats();
+    fprintf(status_stream(), "  - Relocations: %i relocatable words (%i without --relax-branches)\n",
+            stats.n_relocations_after, stats.n_relocations_before);
+}
+
+/* Prints the command line usage */
+void print_usage() {
+    printf("Usage: assembler [options] <file1> [<file2> <file3> ...]\n");
+    printf("Options:\n");
+    printf("  --max-errors N        stop processing a file after N errors\n");
+    printf("  --diag-format FORMAT  'text' (default) or 'json' (one JSON object per line)\n");
+    printf("  --check-only          only check the syntax and the symbols, without generating output files\n");
+    printf("  --emit-stdout         write the object to stdout instead of the output files\n");
+    printf("  --emit-stdout=all     write the object, ext and entry sections to stdout,\n");
+    printf("                        each after a '%s.ob/%s.ext/%s.ent <file>' line\n", SECTION_MARK, SECTION_MARK, SECTION_MARK);
+    printf("  --watch DIR           assemble the .as files in DIR, and reassemble them whenever they change\n");
+    printf("  --jobs N              split large files between N threads (default: one per core)\n");
+    printf("  --pipeline            encode the lines on another thread while the file is still being read\n");
+    printf("  --blocking-io         read and write the files one at a time (instead of in batches with io_uring)\n");
+    printf("  --max-retained-mb N   free the per-file buffers after a file if they take more than N MB (default: %i)\n",
+           DEFAULT_MAX_RETAINED_MB);
+    printf("  -O                    remove jumps to the next instruction, no-op instructions ('add #0, X', 'mov r1, r1')\n");
+    printf("                        and retarget branches to jmp's (not in --watch or --lsp mode)\n");
+    printf("  --gc-code             remove the code that can't be reached from the start, an .entry or a lea'd label\n");
+    printf("                        (not in --watch or --lsp mode)\n");
+    printf("  --gc-data             drop the data whose labels are neither used by an instruction nor .entry's\n");
+    printf("                        (not in --watch or --lsp mode)\n");
+    printf("  --pool-data           share the words of identical data (or of a .string that ends another one)\n");
+    printf("                        between the labels that are only read (not in --watch or --lsp mode)\n");
+    printf("  --relax-branches      branch to the labels of the file by relative addressing ('jmp &LOOP'),\n");
+    printf("                        so that fewer words need relocation (not in --watch or --lsp mode)\n");
+    printf("  --stats               print how many lines of each file were reused from the parse memo\n");
+    printf("  --lsp                 run as a language server (over stdin/stdout) for editors\n");
+    printf("A file given as '%s' is read from stdin (implies --emit-stdout)\n", STDIN_ARG);
+}
+
+/* Parses the command line options into 'options', and collects the input files into 'inputs'
+ * Returns 1 if success, 0 if the command line is invalid */
+int parse_options(int argc, char* argv[], char** inputs, int* n_inputs) {
+    int i;
+    *n_inputs = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc && is_integer(argv[i + 1], 0)) {
+            options.max_errors = get_int_value(argv[++i], 0);
+            set_max_errors(options.max_errors);
+        }
+        else if (strcmp(argv[i], "--diag-format") == 0 && i + 1 < argc &&
+                (strcmp(argv[i + 1], "text") == 0 || strcmp(argv[i + 1], "json") == 0)) {
+            options.diag_format = strcmp(argv[++i], "json") == 0 ? DIAG_JSON : DIAG_TEXT;
+            set_diag_format(options.diag_format);
+        }
+        else if (strcmp(argv[i], "--emit-stdout") == 0) {
+            options.emit_stdout = EMIT_OBJECT;
+        }
+        else if (strcmp(argv[i], "--emit-stdout=all") == 0) {
+            options.emit_stdout = EMIT_ALL;
+        }
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            options.watch_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && is_integer(argv[i + 1], 0)) {
+            options.jobs = get_int_value(argv[++i], 0);
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0) {
+            options.pipeline = 1;
+        }
+        else if (strcmp(argv[i], "--max-retained-mb") == 0 && i + 1 < argc && is_integer(argv[i + 1], 0)) {
+            options.max_retained_mb = get_int_value(argv[++i], 0);
+            if (options.max_retained_mb < 0) {
+                fprintf(status_stream(), "Invalid value for '--max-retained-mb': %i (must not be negative)\n",
+                        options.max_retained_mb);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--blocking-io") == 0) {
+            options.blocking_io = 1;
+        }
+        else if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = 1;
+        }
+        else if (strcmp(argv[i], "--gc-code") == 0) {
+            options.gc_code = 1;
+        }
+        else if (strcmp(argv[i], "--gc-data") == 0) {
+            options.gc_data = 1;
+        }
+        else if (strcmp(argv[i], "--pool-data") == 0) {
+            options.pool_data = 1;
+        }
+        else if (strcmp(argv[i], "--relax-branches") == 0) {
+            options.relax_branches = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = 1;
+        }
+        else if (strcmp(argv[i], "--lsp") == 0) {
+            options.lsp = 1;
+        }
+        else if (strcmp(argv[i], "--check-only") == 0) {
+            options.check_only = 1;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(status_stream(), "Unrecognized option (or missing value): '%s'\n", argv[i]);
+            return 0;
         }
         else {
-            printf("*** %i errors found in second pass. Skipping file. ***\n", n_errors);
-            rc |= n_errors;
+            inputs[(*n_inputs)++] = argv[i];
+            if (strcmp(argv[i], STDIN_ARG) == 0 && options.emit_stdout == EMIT_FILES) {
+                options.emit_stdout = EMIT_OBJECT; /* there's no file name to create the output files from */
+            }
         }
-        free_memory();
     }
-    return rc > 0;
+    return 1;
+}
+
+/* Returns where status messages and diagnostics are printed
+ * (stderr when the output itself, or the language server protocol, goes to stdout) */
+FILE* status_stream() {
+    return options.emit_stdout == EMIT_FILES && !options.lsp ? stdout : stderr;
 }
 
 /*********************************** Struct functions and variables ***********************************/
@@ -259,60 +542,152 @@ Op* get_op(char* op) {
 
 /*********************************** Help functions ***********************************/
 
+/* The capacity to grow a buffer of 'capacity' items to, so that it has room for 'n' (at least doubling it) */
+size_t grow_capacity(size_t capacity, size_t n) {
+    if (n <= capacity) {
+        return capacity;
+    }
+    return n > 2 * capacity ? n : 2 * capacity;
+}
+
+/* Makes sure parsed_lines has room for 'n' lines. Returns 1 if success, 0 if failure (it's left as it was) */
+int reserve_parsed_lines(size_t n) {
+    ParsedLine** lines;
+    size_t capacity;
+
+    if (parsed_lines != workspace.parsed_lines) { /* (it was swapped, or handed over) */
+        workspace.parsed_lines = parsed_lines;
+        workspace.lines_capacity = parsed_lines != NULL ? n_lines : 0;
+    }
+    capacity = grow_capacity(workspace.lines_capacity, n);
+    if (capacity == workspace.lines_capacity) {
+        return 1;
+    }
+    lines = (ParsedLine**)realloc(parsed_lines, sizeof(ParsedLine*) * capacity);
+    if (lines == NULL) {
+        return 0;
+    }
+    parsed_lines = workspace.parsed_lines = lines;
+    workspace.lines_capacity = capacity;
+    return 1;
+}
+
+/* Makes sure symbol_references has room for 'n' references. Returns 1 if success, 0 if failure (it's left as it was) */
+int reserve_symbol_refs(size_t n) {
+    SymbolInfo* refs;
+    size_t capacity;
+
+    if (symbol_references != workspace.symbol_refs) { /* (it was swapped, or handed over) */
+        workspace.symbol_refs = symbol_references;
+        workspace.refs_capacity = symbol_references != NULL ? i_symbol_ref : 0;
+    }
+    capacity = grow_capacity(workspace.refs_capacity, n);
+    if (capacity == workspace.refs_capacity) {
+        return 1;
+    }
+    refs = (SymbolInfo*)realloc(symbol_references, sizeof(SymbolInfo) * capacity);
+    if (refs == NULL) {
+        return 0;
+    }
+    symbol_references = workspace.symbol_refs = refs;
+    workspace.refs_capacity = capacity;
+    return 1;
+}
+
 /* Add a new parsed line (allocating memory if needed) */
 int add_parsed_line(ParsedLine* parsed_line) {
-    if (n_lines == 0) { /* need to allocate initial memory */
-        parsed_lines = (ParsedLine**)malloc(sizeof(ParsedLine*) * INPUT_BATCH_SIZE);
-        if (parsed_lines == NULL) {
-            n_errors++;
-            printf("Failed to allocate memory for parsing input lines\n");
-            return 0;
-        }
-    }
-    else if (n_lines % INPUT_BATCH_SIZE == 0) { /* need to resize the array */
-        ParsedLine** tmp = (ParsedLine**)realloc(parsed_lines, sizeof(ParsedLine*) * (n_lines / INPUT_BATCH_SIZE) + 1);
-        if (tmp == NULL) {
-            n_errors++;
-            printf("Failed to reallocate memory for parsing input lines\n");
-            return 0;
-        }
-        parsed_lines = tmp;
+    if (!reserve_parsed_lines(n_lines + 1)) {
+        report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for parsing input lines");
+        return 0;
     }
     parsed_lines[n_lines++] = parsed_line;
     return 1;
 }
 
-/* Free parsed_lines memory after each input file is done */
-void free_parsed_lines() {
+/* Add a new parsed line and keep track of how much memory the assembler stages will need for it */
+int register_parsed_line(ParsedLine* parsed_line) {
+    if (!add_parsed_line(parsed_line)) {
+        return 0;
+    }
+    /* Keep track of how many entries we will have to allocate for the symbol table: */
+    n_symbols += get_num_symbols(parsed_line);
+
+    /* Keep track of how many words we will have to allocate for the code image: */
+    n_code_words += get_num_code_words(parsed_line);
+
+    /* Keep track of how many words we will have to allocate for the data image: */
+    n_data_words += get_num_data_words(parsed_line);
+
+    /* Keep track of how many symbol references we need to allocate for: */
+    n_symbol_refs += get_num_symbol_refs(parsed_line);
+
+    /* Keep track of the constants defined and used (see n_expressions): */
+    n_expressions += get_num_expressions(parsed_line);
+    return 1;
+}
+
+/* Frees the parsed lines (keeping the parsed_lines array for the next file) */
+void clear_parsed_lines() {
     int i_line;
-    if (n_lines > 0) {
-        for (i_line = 0; i_line < n_lines; i_line++) {
+    for (i_line = 0; i_line < n_lines; i_line++) {
+        if (!parsed_lines[i_line]->is_cached) { /* cached lines are freed with the include cache */
             free_parsed_line(parsed_lines[i_line]);
         }
-        n_lines = 0;
-        free(parsed_lines);
     }
+    n_lines = 0;
+}
+
+/* Free parsed_lines memory */
+void free_parsed_lines() {
+    clear_parsed_lines();
+    free(parsed_lines);
+    parsed_lines = workspace.parsed_lines = NULL;
+    workspace.lines_capacity = 0;
 }
 
 /* init symbol_references array */
-int init_symbol_refs() { /* free memory after each input file is done */
+int init_symbol_refs() {
     i_symbol_ref = 0;
-    symbol_references = (SymbolInfo*)malloc(sizeof(SymbolInfo) * n_symbol_refs);
-    return symbol_references != NULL;
+    return reserve_symbol_refs(n_symbol_refs);
 }
 
-/* init symbol_references array */
-void free_symbol_refs() { /* free memory after each input file is done */
+/* Frees the labels of the symbol references (keeping the symbol_references array for the next file) */
+void clear_symbol_refs() {
     int i;
-    for (i = 0; i < n_symbol_refs; i++) {
+    for (i = 0; i < i_symbol_ref; i++) {
         free(symbol_references[i].label);
     }
-    free(symbol_references);
     i_symbol_ref = 0;
     n_symbol_refs = 0;
 }
 
-/* Free all memory after each input file is done */
+/* Frees the symbol_references array */
+void free_symbol_refs() {
+    clear_symbol_refs();
+    free(symbol_references);
+    symbol_references = workspace.symbol_refs = NULL;
+    workspace.refs_capacity = 0;
+}
+
+/* Frees what was parsed and generated for the input file that is done, keeping the workspace for the next file
+ * (unless it takes more than --max-retained-mb. Nothing is kept in --watch mode, where the incremental state of
+ * each file takes over its own buffers) */
+void release_workspace() {
+    clear_parsed_lines();
+    clear_symbol_refs();
+    free_symbol_table();
+    if (options.watch_dir != NULL || get_workspace_size() > (size_t)options.max_retained_mb * 1024 * 1024) {
+        free_memory();
+    }
+}
+
+/* The number of bytes allocated for the workspace and the images */
+size_t get_workspace_size() {
+    return workspace.lines_capacity * sizeof(ParsedLine*) + workspace.refs_capacity * sizeof(SymbolInfo) +
+           get_images_size();
+}
+
+/* Free all memory (including the workspace) */
 void free_memory() {
     free_parsed_lines();
     free_mc_memory();
@@ -337,6 +712,9 @@ char* arg_type_str(DirectiveArgType arg_type) {
         case LABEL: return "LABEL";
         case INT:   return "INT";
         case STRING: return "STRING";
+        case CONSTANT: return "CONSTANT";
+        case BINARY: return "BINARY";
+        case SPACE: return "SPACE";
         default: return "Unknown DirectiveArgType";
     }
 }
@@ -352,13 +730,35 @@ char* addr_mode_str(AddrMode mode) {
     }
 }
 
-/* If no errors, the output files are generated */
+/* If no errors, the output files are generated (or written to stdout) */
 void create_output_files(char *output_path) {
     char* path;
+
+    if (options.emit_stdout != EMIT_FILES) {
+        if (options.emit_stdout == EMIT_ALL) {
+            printf("%s.ob %s\n", SECTION_MARK, output_path);
+        }
+        write_object(stdout);
+        if (options.emit_stdout == EMIT_ALL) {
+            printf("%s.ext %s\n", SECTION_MARK, output_path);
+            write_ext(stdout);
+            printf("%s.ent %s\n", SECTION_MARK, output_path);
+            write_entry_symbols(stdout);
+        }
+        fflush(stdout);
+        return;
+    }
+
     path = create_file_name(output_path, ".ob");
     write_object_file(path);
     printf("  - Successfully created %s\n", path);
     free(path);
+    create_symbol_files(output_path);
+}
+
+/* Generates the .ext and .ent files */
+void create_symbol_files(char *output_path) {
+    char* path;
 
     path = create_file_name(output_path, ".ext");
     write_ext_file(path);
@@ -375,9 +775,14 @@ void create_output_files(char *output_path) {
 void reset_counters() {
     n_errors = 0;
     line_num = 0;
+    line_source = NULL;
     n_lines = 0;
     n_symbols = 0;
     n_code_words = 0;
     n_data_words = 0;
     i_symbol_ref = 0;
+    n_symbol_refs = 0;
+    n_expressions = 0;
+    reset_diagnostics();
+    reset_parse_memo();
 }
\ No newline at end of file
@@ -5,9 +5,18 @@
 #include <string.h>
 
 #include "symbol_table.h"
+#include "diagnostics.h"
 
 /*********************************** Constants ***********************************/
 
+/* When built as a library (ASM_LIBRARY), the state of an assembly is kept per thread,
+ * so that several threads can assemble at once */
+#ifdef ASM_LIBRARY
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 /* The instruction image will be generated to start at this address */
 #define MEM_START_ADDRESS 100
 
@@ -15,6 +24,9 @@
  * is exceeded, another 'batch' is dynamically reallocated */
 #define INPUT_BATCH_SIZE 1024
 
+/* Default of --max-retained-mb: how much of the per-file buffers is kept for the next file */
+#define DEFAULT_MAX_RETAINED_MB 64
+
 /* Amount to allocate for a line (even though the legal max is only 80) */
 #define LINE_LEN 2056
 
@@ -25,11 +37,14 @@
 #define N_REGISTERS 8
 
 /* num of directives */
-#define N_DIRECTIVES 4
+#define N_DIRECTIVES 8
 
 /* num of ops */
 #define N_OPS 16
 
+/* Marks the start of each section when the output files are written to stdout (no output line starts with it) */
+#define SECTION_MARK "#"
+
 
 
 /*********************************** Structures ***********************************/
@@ -57,7 +72,10 @@ char* linker_info_str(LinkerInfo linker_info); /* enum to str */
 typedef enum DirectiveArgType {
     LABEL = 0,  /* .entry or .extern */
     INT = 1,    /* .data */
-    STRING = 2  /* .string */
+    STRING = 2, /* .string */
+    CONSTANT = 3, /* .equ (a name and an expression) */
+    BINARY = 4, /* .incbin (a file name, then an optional offset, length and word width) */
+    SPACE = 5 /* .space (a number of words, which can't be negative) */
 } DirectiveArgType;
 
 char* arg_type_str(DirectiveArgType arg_type); /* enum to str */
@@ -87,11 +105,14 @@ char* addr_mode_str(AddrMode arg_type); /* enum to str */
 
 typedef struct ParsedLine {
     int line_num;
+    char* source; /* the included file it's a line of (NULL if of the input file itself) */
     char* label; /* optional */
     char* op; /* relevant iff the input line is one of the 16 assembler 'operations' */
     char* directive;  /* relevant iff the input line is one of the 4 assembler 'directives' */
     int n_args; /* the number of (comma-separated) args specified */
     char** args;  /* the (comma-separated) argument(s) which followed the op/directive on the input line */
+    int is_cached; /* set for lines owned by the include cache (shared between input files, so not freed with parsed_lines) */
+    unsigned char* binary; /* .incbin: the bytes of its words, in the mapped file (see incbin.h) */
 } ParsedLine;
 
 /*!
@@ -101,6 +122,7 @@ typedef struct ParsedLine {
  * Also used to write the .ext file */
 typedef struct SymbolInfo {
     int line_num;
+    char* source; /* the included file of the line (see ParsedLine) */
     unsigned int IC;
     char* label;
     AddrMode addrMode;
@@ -163,10 +185,11 @@ int get_register(char* reg_name);
 
 /*
  * Directive:
- * Specification info for the 4 assembler directives ('.entry', '.extern', '.data', '.string')
+ * Specification info for the 8 assembler directives
+ * ('.entry', '.extern', '.data', '.string', '.include', '.equ', '.incbin', '.space')
  */
 typedef struct Directive {
-    char* name;  /* Can be: '.entry', '.extern', '.data', '.string' */
+    char* name;  /* Can be: '.entry', '.extern', '.data', '.string', '.include', '.equ', '.incbin', '.space' */
     int n_args;
     DirectiveArgType arg_type;
 } Directive;
@@ -195,21 +218,122 @@ typedef struct Op {
  * Returns NULL if invalid */
 Op* get_op(char* op);
 
+/*
+ * EmitMode:
+ *  Where the output goes
+ */
+typedef enum EmitMode {
+    EMIT_FILES = 0,  /* .ob/.ext/.ent files next to the input file */
+    EMIT_OBJECT = 1, /* --emit-stdout: the object to stdout */
+    EMIT_ALL = 2     /* --emit-stdout=all: the object, ext and entry sections to stdout */
+} EmitMode;
+
+/*
+ * Workspace:
+ * The arrays allocated for each input file (parsed_lines and symbol_references) are kept for the next file,
+ * and only grown (geometrically), so that a run over many files doesn't allocate them again for each one.
+ * (The arrays here are the ones that were allocated for parsed_lines/symbol_references; if these were
+ * swapped for others, the capacities of those are assumed to be their current lengths)
+ */
+typedef struct Workspace {
+    ParsedLine** parsed_lines;
+    size_t lines_capacity;
+    SymbolInfo* symbol_refs;
+    size_t refs_capacity;
+} Workspace;
+
+/*
+ * Options:
+ * Command line options (which can be given before or between the input files)
+ */
+typedef struct Options {
+    int max_errors; /* --max-errors N (0 means no limit) */
+    DiagFormat diag_format; /* --diag-format text|json */
+    int check_only; /* --check-only: only validate the syntax and the symbols (no output files) */
+    EmitMode emit_stdout; /* --emit-stdout[=all] */
+    char* watch_dir; /* --watch DIR (NULL if not watching) */
+    int lsp; /* --lsp: serve the Language Server Protocol over stdin/stdout */
+    int jobs; /* --jobs N: the number of threads to split large files between (0 means one per core) */
+    int pipeline; /* --pipeline: encode the lines on another thread as they are parsed */
+    int stats; /* --stats: print the hit rate of the parse memo of each file */
+    int blocking_io; /* --blocking-io: don't read ahead the input files or batch the writes of the output files */
+    int max_retained_mb; /* --max-retained-mb N: the per-file buffers are freed after a file if they take more */
+    int optimize; /* -O: remove redundant jumps and no-op instructions between the passes */
+    int relax_branches; /* --relax-branches: branch to the symbols of the file by RELATIVE addressing */
+    int pool_data; /* --pool-data: share the words of the same (or tail) read-only data blocks */
+    int gc_code; /* --gc-code: remove the basic blocks that can't be reached */
+    int gc_data; /* --gc-data: drop the data blocks whose labels are neither referenced nor entries */
+} Options;
+
 /*********************************** Function Prototypes ***********************************/
 
+/* Prints what the peephole optimizer (-O) did to the file that was just assembled */
+void print_peephole_stats();
+
+/* Prints what --pool-data did to the file that was just assembled */
+void print_pool_stats();
+
+/* Prints what --gc-code did to the file that was just assembled */
+void print_unreachable_stats();
+
+/* Prints what --gc-data did to the file that was just assembled */
+void print_gc_stats();
+
+/* Prints how many relocatable words are left after --relax-branches */
+void print_relax_stats();
+
+/* Prints the command line usage */
+void print_usage();
+
+/* Prints the stats of the file that was just assembled (--stats) */
+void print_stats();
+
+/* Parses the command line options into 'options', and collects the input files into 'inputs'
+ * Returns 1 if success, 0 if the command line is invalid */
+int parse_options(int argc, char* argv[], char** inputs, int* n_inputs);
+
+/* Assemble a single input file (given without the .as extension)
+ * Returns the number of errors found */
+int assemble_file(char* input_arg);
+
+/* The capacity to grow a buffer of 'capacity' items to, so that it has room for 'n' (at least doubling it) */
+size_t grow_capacity(size_t capacity, size_t n);
+
+/* Makes sure parsed_lines has room for 'n' lines. Returns 1 if success, 0 if failure (it's left as it was) */
+int reserve_parsed_lines(size_t n);
+
+/* Makes sure symbol_references has room for 'n' references. Returns 1 if success, 0 if failure (it's left as it was) */
+int reserve_symbol_refs(size_t n);
+
 /* Add a new parsed line (allocating memory if needed) */
 int add_parsed_line(ParsedLine* parsed_line);
 
-/* Free parsed_lines memory after each input file is done */
+/* Add a new parsed line and keep track of how much memory the assembler stages will need for it */
+int register_parsed_line(ParsedLine* parsed_line);
+
+/* Frees the parsed lines (keeping the parsed_lines array for the next file) */
+void clear_parsed_lines();
+
+/* Free parsed_lines memory */
 void free_parsed_lines();
 
 /* init symbol_references array */
 int init_symbol_refs();
 
-/* init symbol_references array */
+/* Frees the labels of the symbol references (keeping the symbol_references array for the next file) */
+void clear_symbol_refs();
+
+/* Frees the symbol_references array */
 void free_symbol_refs();
 
-/* Free all memory after each input file is done */
+/* Frees what was parsed and generated for the input file that is done, keeping the workspace for the next file
+ * (unless it takes more than --max-retained-mb) */
+void release_workspace();
+
+/* The number of bytes allocated for the workspace and the images */
+size_t get_workspace_size();
+
+/* Free all memory (including the workspace) */
 void free_memory();
 
 /* to_string function for LinkerInfo enum */
@@ -221,9 +345,16 @@ char* arg_type_str(DirectiveArgType arg_type);
 /* to_string function for AddrMode enum */
 char* addr_mode_str(AddrMode mode);
 
-/* If no errors, the output files are generated */
+/* If no errors, the output files are generated (or written to stdout) */
 void create_output_files(char *output_path);
 
+/* Generates the .ext and .ent files */
+void create_symbol_files(char *output_path);
+
+/* Returns where status messages and diagnostics are printed
+ * (stderr when the output itself, or the language server protocol, goes to stdout) */
+FILE* status_stream();
+
 /* reset the various counters before processing each file */
 void reset_counters();
 
@@ -231,20 +362,32 @@ void reset_counters();
 /*********************************** External variables ***********************************/
 /* Initialized in main file assembler.c, and are also used in other files */
 
+/* Command line options */
+extern THREAD_LOCAL Options options;
+
 /* Keep track of errors */
-extern int n_errors;
+extern THREAD_LOCAL int n_errors;
 
 /* Keep track of source file line_num (including blank lines) to indicate the line number in case of errors  */
-extern int line_num;
+extern THREAD_LOCAL int line_num;
+
+/* The included file that line_num is a line of (NULL if it's a line of the input file itself) */
+extern THREAD_LOCAL char* line_source;
 
 /* Keep track of valid parsed lines (this is the length of the parsed_lines array below) */
-extern int n_lines;
+extern THREAD_LOCAL int n_lines;
 
 /* * Processed input lines will be stored in an array of structured data */
-extern ParsedLine** parsed_lines;
+extern THREAD_LOCAL ParsedLine** parsed_lines;
+
+/* Number of words/symbol references counted in the pre-processing stage (to allocate for) */
+extern THREAD_LOCAL int n_code_words;
+extern THREAD_LOCAL int n_data_words;
+extern THREAD_LOCAL int n_symbol_refs;
+extern THREAD_LOCAL int n_expressions;
 
 /* SymbolInfos for instances of symbol references are stored in pass 1 for use in pass 2:*/
-extern SymbolInfo* symbol_references;
-extern int i_symbol_ref;
+extern THREAD_LOCAL SymbolInfo* symbol_references;
+extern THREAD_LOCAL int i_symbol_ref;
 
 #endif
@@ -0,0 +1,621 @@
+#define _DEFAULT_SOURCE /* for syscall(), fmemopen() and open_memstream() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "batch_io.h"
+#include "string_utils.h"
+#include "file_utils.h"
+
+#ifdef HAVE_IO_URING
+
+static IoRing ring;
+static unsigned sq_tail = 0;  /* the tail of the submission queue (published to the kernel when entering) */
+static int is_active = 0;
+
+/* The input files, in the order they're assembled */
+static PrefetchedInput* inputs_ahead = NULL;
+static int n_inputs_ahead = 0;
+static int i_next_input = 0;  /* the next one to be taken */
+static int i_next_open = 0;   /* the next one to be opened */
+static PrefetchedInput* taken_input = NULL;
+
+/* The output files being written */
+static PendingOutput outputs[BATCH_IO_MAX_OUTPUTS];
+static int n_outputs_in_use = 0;
+static int n_failed_outputs = 0;
+
+/* The output file being formatted (by open_memstream) */
+static FILE* output_stream = NULL;
+static char* output_data = NULL;
+static size_t output_len = 0;
+static char* output_path = NULL;
+
+void _complete(unsigned long user_data, int res);
+
+
+/*********************************** Ring ***********************************/
+
+/* Unmaps and closes the ring */
+void _teardown_ring() {
+    if (ring.sqes != NULL) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if (ring.cq_ring != NULL && ring.cq_ring != ring.sq_ring) {
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+    if (ring.sq_ring != NULL) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    }
+    if (ring.fd >= 0) {
+        close(ring.fd);
+    }
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+/* Checks that the kernel supports all the operations used here (older ones only have reads and writes of open files).
+ * Returns 1 if it does, 0 if not */
+int _probe_ops() {
+    struct io_uring_probe* probe;
+    int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE};
+    int i;
+    int is_supported;
+
+    probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        return 0;
+    }
+    is_supported = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for (i = 0; is_supported && i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+        is_supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return is_supported;
+}
+
+/* Sets up the ring. Returns 1 if success, 0 if io_uring is unavailable */
+int _setup_ring(unsigned n_entries) {
+    struct io_uring_params params;
+    char* sq_ring;
+    char* cq_ring;
+
+    memset(&ring, 0, sizeof(ring));
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, n_entries, &params);
+    if (ring.fd < 0 || !_probe_ops()) {
+        _teardown_ring();
+        return 0;
+    }
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { /* (both queues are in one mapping) */
+        if (ring.cq_ring_size > ring.sq_ring_size) {
+            ring.sq_ring_size = ring.cq_ring_size;
+        }
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        ring.sq_ring = NULL;
+        _teardown_ring();
+        return 0;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    }
+    else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            ring.cq_ring = NULL;
+            _teardown_ring();
+            return 0;
+        }
+    }
+    ring.sqes = (struct io_uring_sqe*)mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd,
+                                           IORING_OFF_SQES);
+    if ((void*)ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        _teardown_ring();
+        return 0;
+    }
+
+    sq_ring = (char*)ring.sq_ring;
+    cq_ring = (char*)ring.cq_ring;
+    ring.sq_head = (unsigned*)(sq_ring + params.sq_off.head);
+    ring.sq_tail = (unsigned*)(sq_ring + params.sq_off.tail);
+    ring.sq_mask = (unsigned*)(sq_ring + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned*)(sq_ring + params.sq_off.array);
+    ring.sq_entries = params.sq_entries;
+    ring.cq_head = (unsigned*)(cq_ring + params.cq_off.head);
+    ring.cq_tail = (unsigned*)(cq_ring + params.cq_off.tail);
+    ring.cq_mask = (unsigned*)(cq_ring + params.cq_off.ring_mask);
+    ring.cq_entries = params.cq_entries;
+    ring.cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+    sq_tail = *ring.sq_tail;
+    return 1;
+}
+
+/* Hands the queued submissions to the kernel, waits for at least 'min_complete' completions, and handles all the
+ * completions that arrived. Returns 1 if success, 0 if the ring failed */
+int _enter(unsigned min_complete) {
+    struct io_uring_cqe* cqe;
+    unsigned head;
+    unsigned long user_data;
+    int res;
+    int n_submitted;
+
+    if (min_complete > ring.n_in_flight + ring.n_queued) {
+        min_complete = ring.n_in_flight + ring.n_queued; /* (don't wait for what will never come) */
+    }
+    if (ring.n_queued > 0 || min_complete > 0) {
+        __atomic_store_n(ring.sq_tail, sq_tail, __ATOMIC_RELEASE);
+        do {
+            n_submitted = syscall(__NR_io_uring_enter, ring.fd, ring.n_queued, min_complete,
+                                  min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        } while (n_submitted < 0 && (errno == EINTR || errno == EAGAIN));
+        if (n_submitted < 0) {
+            return 0;
+        }
+        ring.n_queued -= n_submitted;
+        ring.n_in_flight += n_submitted;
+    }
+
+    /* Each completion is consumed before it's handled, since handling it may queue more submissions */
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring.cqes[head & *ring.cq_mask];
+        user_data = (unsigned long)cqe->user_data;
+        res = cqe->res;
+        head++;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        ring.n_in_flight--;
+        _complete(user_data, res);
+    }
+    return 1;
+}
+
+/* Queues a submission (handed to the kernel on the next _enter). Returns NULL if the ring failed */
+struct io_uring_sqe* _queue_sqe(int op, int index) {
+    struct io_uring_sqe* sqe;
+    unsigned i_sqe;
+
+    if (ring.n_queued == ring.sq_entries && !_enter(0)) {
+        return NULL;
+    }
+    i_sqe = sq_tail & *ring.sq_mask;
+    sqe = &ring.sqes[i_sqe];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((unsigned long)index << BATCH_IO_OP_BITS) | op;
+    ring.sq_array[i_sqe] = i_sqe;
+    sq_tail++;
+    ring.n_queued++;
+    return sqe;
+}
+
+/* Queues the closing of a file (whose completion needs no handling) */
+void _queue_close(int fd) {
+    struct io_uring_sqe* sqe = _queue_sqe(OP_CLOSE, 0);
+    if (sqe == NULL) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+}
+
+
+/*********************************** Inputs ***********************************/
+
+/* Queues the opening of the input files up to BATCH_IO_READ_AHEAD ahead of the next one to be taken */
+void _read_ahead() {
+    PrefetchedInput* input;
+    struct io_uring_sqe* sqe;
+
+    while (i_next_open < n_inputs_ahead && i_next_open < i_next_input + BATCH_IO_READ_AHEAD) {
+        input = &inputs_ahead[i_next_open];
+        input->data = (char*)malloc(BATCH_IO_READ_SIZE);
+        sqe = input->data != NULL ? _queue_sqe(OP_OPEN_INPUT, i_next_open) : NULL;
+        i_next_open++;
+        if (sqe == NULL) { /* (it's opened the plain way when it's its turn) */
+            continue;
+        }
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)input->path;
+        sqe->open_flags = O_RDONLY;
+        input->state = INPUT_OPENING;
+    }
+}
+
+/* Queues the read of the rest of what's read ahead of an input file (after the 'len' bytes read so far).
+ * Returns 1 if success, 0 if the ring failed */
+int _queue_read(PrefetchedInput* input, int index) {
+    struct io_uring_sqe* sqe = _queue_sqe(OP_READ_INPUT, index);
+    if (sqe == NULL) {
+        return 0;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = input->fd;
+    sqe->addr = (unsigned long)(input->data + input->len);
+    sqe->len = BATCH_IO_READ_SIZE - input->len;
+    sqe->off = input->len;
+    input->state = INPUT_READING;
+    return 1;
+}
+
+/* Handles the completion of an operation on an input file
+ * (a read may return less than asked for before the end of the file, so it's only read once a read returns 0) */
+void _complete_input(PrefetchedInput* input, int index, int op, int res) {
+    if (res < 0) {
+        if (op == OP_READ_INPUT) {
+            _queue_close(input->fd);
+            input->fd = -1;
+        }
+        input->state = INPUT_FAILED;
+        input->error = -res;
+        free(input->data);
+        input->data = NULL;
+        return;
+    }
+    if (op == OP_OPEN_INPUT) {
+        input->fd = res;
+        input->len = 0;
+    }
+    else if (res == 0) { /* the end of the file */
+        input->state = INPUT_READY;
+        _queue_close(input->fd);
+        input->fd = -1;
+        return;
+    }
+    else {
+        input->len += res;
+    }
+
+    if (input->len == BATCH_IO_READ_SIZE || !_queue_read(input, index)) {
+        /* there might be more of it (or the ring failed): it's read the plain way when it's its turn */
+        input->state = INPUT_LARGE;
+        free(input->data);
+        input->data = NULL;
+    }
+}
+
+/*
+ * Starts reading the input files ahead of time, and batching the writes of the output files (with io_uring).
+ * Returns 1 if io_uring is used, 0 if it's unavailable (the files are then read and written the plain blocking way)
+ */
+int start_batch_io(char** inputs, int n_inputs) {
+    int i;
+
+    if (!_setup_ring(BATCH_IO_RING_SIZE)) {
+        return 0;
+    }
+    inputs_ahead = (PrefetchedInput*)calloc(n_inputs, sizeof(PrefetchedInput));
+    if (inputs_ahead == NULL) {
+        _teardown_ring();
+        return 0;
+    }
+    n_inputs_ahead = 0;
+    for (i = 0; i < n_inputs; i++) {
+        if (strcmp(inputs[i], STDIN_ARG) == 0) { /* (stdin can't be read ahead) */
+            continue;
+        }
+        inputs_ahead[n_inputs_ahead].input_arg = inputs[i];
+        inputs_ahead[n_inputs_ahead].path = create_file_name(inputs[i], ".as");
+        if (inputs_ahead[n_inputs_ahead].path == NULL) {
+            break;
+        }
+        inputs_ahead[n_inputs_ahead].fd = -1;
+        n_inputs_ahead++;
+    }
+    i_next_input = 0;
+    i_next_open = 0;
+    n_outputs_in_use = 0;
+    n_failed_outputs = 0;
+    is_active = 1;
+
+    _read_ahead();
+    _enter(0);
+    return 1;
+}
+
+/*
+ * Opens an input file (given without the .as extension) from what was read ahead, if it's the next one.
+ * Returns 1 if it was read ahead (with *fp set, NULL if the file couldn't be opened), 0 if it should be opened
+ * the plain way
+ */
+int take_prefetched_input(char* input_arg, FILE** fp) {
+    PrefetchedInput* input;
+
+    if (!is_active || i_next_input >= n_inputs_ahead || strcmp(inputs_ahead[i_next_input].input_arg, input_arg) != 0) {
+        return 0;
+    }
+    input = &inputs_ahead[i_next_input++];
+    while ((input->state == INPUT_OPENING || input->state == INPUT_READING) && _enter(1)) {
+        /* (wait for it) */
+    }
+
+    /* Open the next ones in batches of half the read ahead (and submit whatever was queued meanwhile) */
+    if (i_next_open - i_next_input <= BATCH_IO_READ_AHEAD / 2) {
+        _read_ahead();
+    }
+    if (ring.n_queued > 0) {
+        _enter(0);
+    }
+
+    *fp = NULL;
+    switch (input->state) {
+        case INPUT_READY:
+            *fp = fmemopen(input->data, input->len, "r");
+            break;
+        case INPUT_LARGE:
+            if (lseek(input->fd, 0, SEEK_SET) == 0) {
+                *fp = fdopen(input->fd, "r");
+            }
+            if (*fp == NULL) {
+                close(input->fd);
+            }
+            input->fd = -1;
+            break;
+        case INPUT_FAILED:
+            input->state = INPUT_TAKEN;
+            errno = input->error;
+            return 1;
+        default: /* (it couldn't be read ahead) */
+            return 0;
+    }
+    input->state = INPUT_TAKEN;
+    taken_input = input;
+    return *fp != NULL;
+}
+
+/* Frees what was read ahead of the input file taken last (once it's closed) */
+void release_prefetched_input() {
+    if (taken_input != NULL) {
+        free(taken_input->data);
+        taken_input->data = NULL;
+        taken_input = NULL;
+    }
+}
+
+
+/*********************************** Outputs ***********************************/
+
+/* Frees an output file once it's done with */
+void _release_output(PendingOutput* output) {
+    free(output->path);
+    free(output->data);
+    output->path = NULL;
+    output->data = NULL;
+    output->is_used = 0;
+    n_outputs_in_use--;
+}
+
+/* Reports an output file that couldn't be written */
+void _fail_output(PendingOutput* output) {
+    fprintf(stderr, "Error: Unable to create '%s'\n", output->path);
+    n_failed_outputs++;
+    _release_output(output);
+}
+
+/* Writes an output file the plain blocking way (if the ring failed) */
+void _write_plainly(PendingOutput* output) {
+    ssize_t n_written;
+
+    if (output->fd >= 0) {
+        close(output->fd);
+    }
+    output->fd = open(output->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output->fd < 0) {
+        _fail_output(output);
+        return;
+    }
+    output->n_written = 0;
+    while (output->n_written < output->len) {
+        n_written = write(output->fd, output->data + output->n_written, output->len - output->n_written);
+        if (n_written <= 0) {
+            close(output->fd);
+            _fail_output(output);
+            return;
+        }
+        output->n_written += n_written;
+    }
+    close(output->fd);
+    _release_output(output);
+}
+
+/* Queues the write of the rest of an output file (or its closing if it's all written) */
+void _queue_write(PendingOutput* output) {
+    struct io_uring_sqe* sqe;
+
+    if (output->n_written == output->len) {
+        _queue_close(output->fd);
+        _release_output(output);
+        return;
+    }
+    sqe = _queue_sqe(OP_WRITE_OUTPUT, output - outputs);
+    if (sqe == NULL) {
+        _write_plainly(output);
+        return;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = output->fd;
+    sqe->addr = (unsigned long)(output->data + output->n_written);
+    sqe->len = output->len - output->n_written;
+    sqe->off = output->n_written;
+}
+
+/* Handles the completion of an operation on an output file */
+void _complete_output(PendingOutput* output, int op, int res) {
+    if (res < 0 || (op == OP_WRITE_OUTPUT && res == 0)) {
+        if (op == OP_WRITE_OUTPUT) {
+            _queue_close(output->fd);
+        }
+        _fail_output(output);
+        return;
+    }
+    if (op == OP_OPEN_OUTPUT) {
+        output->fd = res;
+    }
+    else {
+        output->n_written += res;
+    }
+    _queue_write(output);
+}
+
+/* Opens a stream that an output file is formatted into, to be written in a batch
+ * (NULL if batching isn't active, or if it failed) */
+FILE* open_batched_output(char* file_path) {
+    if (!is_active) {
+        return NULL;
+    }
+    output_path = str_cpy(file_path);
+    output_stream = output_path != NULL ? open_memstream(&output_data, &output_len) : NULL;
+    if (output_stream == NULL) {
+        free(output_path);
+        output_path = NULL;
+    }
+    return output_stream;
+}
+
+/* Closes the stream of open_batched_output, and queues the write of the output file.
+ * Returns 1 if it was such a stream, 0 if not (it's then left for the caller to close) */
+int close_batched_output(FILE* fp) {
+    PendingOutput* output;
+    struct io_uring_sqe* sqe;
+    int i;
+
+    if (fp == NULL || fp != output_stream) {
+        return 0;
+    }
+    output_stream = NULL;
+    while (n_outputs_in_use == BATCH_IO_MAX_OUTPUTS && _enter(1)) {
+        /* (wait for a write to complete) */
+    }
+    for (i = 0, output = NULL; i < BATCH_IO_MAX_OUTPUTS && output == NULL; i++) {
+        if (!outputs[i].is_used) {
+            output = &outputs[i];
+        }
+    }
+    if (fclose(fp) != 0 || output_data == NULL || output == NULL) { /* (the ring failed if there's still no room) */
+        fprintf(stderr, "Error: Unable to create '%s'\n", output_path);
+        n_failed_outputs++;
+        free(output_path);
+        free(output_data);
+        output_path = NULL;
+        output_data = NULL;
+        return 1;
+    }
+    output->path = output_path;
+    output->data = output_data;
+    output->len = output_len;
+    output->n_written = 0;
+    output->fd = -1;
+    output->is_used = 1;
+    output_path = NULL;
+    output_data = NULL;
+    n_outputs_in_use++;
+
+    sqe = _queue_sqe(OP_OPEN_OUTPUT, output - outputs);
+    if (sqe == NULL) {
+        _write_plainly(output);
+        return 1;
+    }
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long)output->path;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->len = 0666;
+    return 1;
+}
+
+
+/*********************************** Completion ***********************************/
+
+/* Handles the completion of an operation (dispatched by its kind) */
+void _complete(unsigned long user_data, int res) {
+    int op = (int)(user_data & ((1 << BATCH_IO_OP_BITS) - 1));
+    int index = (int)(user_data >> BATCH_IO_OP_BITS);
+
+    switch (op) {
+        case OP_OPEN_INPUT:
+        case OP_READ_INPUT:
+            _complete_input(&inputs_ahead[index], index, op, res);
+            break;
+        case OP_OPEN_OUTPUT:
+        case OP_WRITE_OUTPUT:
+            _complete_output(&outputs[index], op, res);
+            break;
+        default: /* (closing needs no handling) */
+            break;
+    }
+}
+
+/* Waits for all the queued writes to complete, and tears down the ring.
+ * Returns the number of output files that couldn't be written */
+int finish_batch_io() {
+    int i;
+
+    if (!is_active) {
+        return 0;
+    }
+    while (ring.n_queued + ring.n_in_flight > 0) {
+        if (!_enter(1)) {
+            break;
+        }
+    }
+    for (i = 0; i < BATCH_IO_MAX_OUTPUTS; i++) { /* (only if the ring failed) */
+        if (outputs[i].is_used) {
+            _write_plainly(&outputs[i]);
+        }
+    }
+    for (i = 0; i < n_inputs_ahead; i++) {
+        if (inputs_ahead[i].fd >= 0) {
+            close(inputs_ahead[i].fd);
+        }
+        free(inputs_ahead[i].data);
+        free(inputs_ahead[i].path);
+    }
+    free(inputs_ahead);
+    inputs_ahead = NULL;
+    n_inputs_ahead = 0;
+    taken_input = NULL;
+    _teardown_ring();
+    is_active = 0;
+    return n_failed_outputs;
+}
+
+#else /* (built without io_uring: the files are always read and written the plain blocking way) */
+
+int start_batch_io(char** inputs, int n_inputs) {
+    return 0;
+}
+
+int take_prefetched_input(char* input_arg, FILE** fp) {
+    return 0;
+}
+
+void release_prefetched_input() {
+}
+
+FILE* open_batched_output(char* file_path) {
+    return NULL;
+}
+
+int close_batched_output(FILE* fp) {
+    return 0;
+}
+
+int finish_batch_io() {
+    return 0;
+}
+
+#endif
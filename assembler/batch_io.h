@@ -0,0 +1,127 @@
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <stdio.h>
+#ifdef HAVE_IO_URING /* (set by the Makefile if the kernel headers have io_uring) */
+#include <linux/io_uring.h>
+#endif
+
+/* Number of input files read ahead of the one being assembled */
+#define BATCH_IO_READ_AHEAD 32
+
+/* Bytes read ahead of each input file (a larger file is read the plain way once it's its turn) */
+#define BATCH_IO_READ_SIZE 65536
+
+/* Most output files being written at once (more have to wait for these to complete) */
+#define BATCH_IO_MAX_OUTPUTS 96
+
+/* Number of submission queue entries of the ring */
+#define BATCH_IO_RING_SIZE 256
+
+/* Kinds of operations, kept in the low bits of the user_data of a submission (the rest is the index of the file) */
+#define BATCH_IO_OP_BITS 3
+#define OP_OPEN_INPUT 0
+#define OP_READ_INPUT 1
+#define OP_OPEN_OUTPUT 2
+#define OP_WRITE_OUTPUT 3
+#define OP_CLOSE 4
+
+#ifdef HAVE_IO_URING
+/*!
+ * IoRing:
+ * An io_uring instance, with its submission and completion queues mapped into memory
+ */
+typedef struct IoRing {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned n_queued;     /* submissions not handed to the kernel yet */
+    unsigned n_in_flight;  /* submissions handed to the kernel, not completed yet */
+} IoRing;
+#endif
+
+/*!
+ * InputState:
+ * Where an input file is in being read ahead
+ */
+typedef enum InputState {
+    INPUT_WAITING = 0,  /* not opened yet */
+    INPUT_OPENING = 1,
+    INPUT_READING = 2,
+    INPUT_READY = 3,    /* the whole file is in 'data' (and it was closed) */
+    INPUT_LARGE = 4,    /* the file is larger than BATCH_IO_READ_SIZE (it's left open, for reading the plain way) */
+    INPUT_FAILED = 5,   /* 'error' is the errno */
+    INPUT_TAKEN = 6
+} InputState;
+
+/*!
+ * PrefetchedInput:
+ * An input file that is read ahead
+ */
+typedef struct PrefetchedInput {
+    char* input_arg;  /* as given in the command line */
+    char* path;       /* with the .as extension */
+    InputState state;
+    int fd;
+    char* data;
+    size_t len;
+    int error;
+} PrefetchedInput;
+
+/*!
+ * PendingOutput:
+ * An output file whose contents were formatted in memory, and that is being written
+ */
+typedef struct PendingOutput {
+    char* path;
+    char* data;
+    size_t len;
+    size_t n_written;
+    int fd;
+    int is_used;
+} PendingOutput;
+
+/*
+ * Starts reading the input files ahead of time, and batching the writes of the output files (with io_uring).
+ * Returns 1 if io_uring is used, 0 if it's unavailable, or not built in (the files are then read and written
+ * the plain blocking way, as with --blocking-io)
+ */
+int start_batch_io(char** inputs, int n_inputs);
+
+/*
+ * Opens an input file (given without the .as extension) from what was read ahead, if it's the next one.
+ * Returns 1 if it was read ahead (with *fp set, NULL if the file couldn't be opened), 0 if it should be opened
+ * the plain way
+ */
+int take_prefetched_input(char* input_arg, FILE** fp);
+
+/* Frees what was read ahead of the input file taken last (once it's closed) */
+void release_prefetched_input();
+
+/* Opens a stream that an output file is formatted into, to be written in a batch
+ * (NULL if batching isn't active, or if it failed) */
+FILE* open_batched_output(char* file_path);
+
+/* Closes the stream of open_batched_output, and queues the write of the output file.
+ * Returns 1 if it was such a stream, 0 if not (it's then left for the caller to close) */
+int close_batched_output(FILE* fp);
+
+/* Waits for all the queued writes to complete, and tears down the ring.
+ * Returns the number of output files that couldn't be written */
+int finish_batch_io();
+
+#endif
@@ -0,0 +1,119 @@
+#!/bin/sh
+# Benchmark of the batched I/O of many-file runs (make bench-io):
+# assembles a generated corpus of small files in one run, with --blocking-io and with the batched (io_uring) I/O,
+# and prints the wall time and the number of syscalls of each.
+# Usage: bench_io.sh [number of files (default: 10000)]
+
+ASSEMBLER=$(cd "$(dirname "${ASSEMBLER:-./assembler}")" && pwd)/$(basename "${ASSEMBLER:-./assembler}")
+N_FILES=${1:-10000}
+RUNS=3
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Small files of 10 to 50 lines, each with an external and an entry symbol
+mkdir "$DIR/blocking" "$DIR/batched"
+awk -v n="$N_FILES" -v dir="$DIR/blocking" 'BEGIN {
+    for (f = 0; f < n; f++) {
+        path = dir "/f" f ".as"
+        print ".extern EXT" > path
+        print ".entry MAIN" > path
+        print "MAIN: mov r1, r2" > path
+        for (i = 0; i < 10 + f % 40; i++) {
+            if (i % 4 == 0) {
+                printf "L%d: add #%d, r%d\n", i, f % 100, i % 8 > path
+            }
+            else if (i % 4 == 1) {
+                print " cmp EXT, K" > path
+            }
+            else if (i % 4 == 2) {
+                printf " jmp &L%d\n", i - 2 > path
+            }
+            else {
+                printf "D%d: .data %d, -%d\n", i, i, f % 50 > path
+            }
+        }
+        print "K: .data 5" > path
+        print "stop" > path
+        close(path)
+    }
+}'
+cp "$DIR/blocking/"*.as "$DIR/batched/"
+FILES=$(awk -v n="$N_FILES" 'BEGIN { for (f = 0; f < n; f++) printf "f%d ", f }')
+
+# Counts the syscalls of a command (with ptrace, since strace might not be installed)
+cat > "$DIR/syscount.c" <<'EOF'
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+int main(int argc, char** argv) {
+    pid_t pid;
+    int status;
+    long n_stops = 0;
+    pid = fork();
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)PTRACE_O_TRACESYSGOOD);
+    while (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == 0 && waitpid(pid, &status, 0) == pid && !WIFEXITED(status)) {
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            n_stops++; /* (one stop when entering a syscall, and one when leaving it) */
+        }
+    }
+    printf("%ld\n", n_stops / 2);
+    return 0;
+}
+EOF
+SYSCOUNT=
+if ${CC:-cc} -o "$DIR/syscount" "$DIR/syscount.c" 2> /dev/null; then
+    SYSCOUNT="$DIR/syscount"
+fi
+
+# Prints the wall time (in seconds) of the fastest of $RUNS runs in the directory $1, with the options $2
+best_time() {
+    best=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        start=$(date +%s.%N)
+        (cd "$DIR/$1" && "$ASSEMBLER" $2 $FILES > "$DIR/$1.log" 2>&1) || return 1
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) printf "%.4f", t; else print $3 }')
+        run=$((run + 1))
+    done
+    echo "$best"
+}
+
+# Prints the number of syscalls of a run in the directory $1, with the options $2
+syscalls() {
+    if [ -z "$SYSCOUNT" ]; then
+        echo "-"
+        return
+    fi
+    (cd "$DIR/$1" && "$SYSCOUNT" "$ASSEMBLER" $2 $FILES 2> /dev/null | tail -n 1)
+}
+
+echo "$N_FILES files, best of $RUNS runs"
+printf "%10s %10s %10s\n" io seconds syscalls
+for mode in blocking batched; do
+    [ $mode = blocking ] && opts=--blocking-io || opts=
+    if ! t=$(best_time $mode "$opts"); then
+        echo "Failed to assemble with the $mode I/O:" >&2
+        tail "$DIR/$mode.log" >&2
+        exit 1
+    fi
+    printf "%10s %10s %10s\n" $mode "$t" "$(syscalls $mode "$opts")"
+done
+
+for f in $FILES; do
+    for ext in ob ext ent; do
+        if ! cmp -s "$DIR/blocking/$f.$ext" "$DIR/batched/$f.$ext"; then
+            echo "The output '$f.$ext' of the batched I/O differs from that of the blocking I/O" >&2
+            exit 1
+        fi
+    done
+done
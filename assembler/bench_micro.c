@@ -0,0 +1,489 @@
+#define _POSIX_C_SOURCE 199309L /* for clock_gettime() */
+
+/*
+ * Microbenchmarks of the hot routines of the assembler (make bench-micro):
+ * each kernel is run on its own, calibrated so that a trial takes about BENCH_TRIAL_NS, warmed up, and then timed
+ * over a number of trials. The median and 99th percentile of the time per operation are printed, and written as JSON
+ * (which a later run can be compared against with -b).
+ * Usage: bench_micro [-o results.json] [-b baseline.json] [-t trials]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "assembler.h"
+#include "parser.h"
+#include "passes.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+#include "string_utils.h"
+#include "diagnostics.h"
+#include "json.h"
+
+/* Default number of timed trials of each kernel */
+#define BENCH_DEFAULT_TRIALS 101
+
+/* The iterations of a trial are calibrated (doubled) until a trial takes at least this long */
+#define BENCH_TRIAL_NS 200000.0
+
+/* Trials are run untimed for at least this long before the timed ones */
+#define BENCH_WARMUP_NS 20000000.0
+
+/* Most symbols in a symbol table kernel, and words in the object file kernel */
+#define BENCH_MAX_SYMBOLS 100000
+#define BENCH_OBJECT_WORDS 10000
+
+/*
+ * BenchKernel:
+ * A kernel runs its operation 'n_iters' times (on a problem of 'size', for the kernels that have one).
+ * The optional setup and teardown are run once around the trials, outside of the timing
+ */
+typedef struct BenchKernel {
+    char* name;
+    int size;
+    int ops_per_iter;  /* the time is reported per operation: 1, or 'size' for a kernel that does 'size' operations */
+    void (*setup)(int size);
+    void (*run)(int n_iters, int size);
+    void (*teardown)();
+} BenchKernel;
+
+/* The result of a kernel, in nanoseconds per operation */
+typedef struct BenchResult {
+    int n_iters;
+    double median_ns;
+    double p99_ns;
+    double min_ns;
+} BenchResult;
+
+/* (prototypes of internal routines of the other modules, which are benchmarked too) */
+int _validate_label(char* label);
+int encode_instruction(Instruction instruction);
+int encode_operand(Operand operand);
+
+double _now_ns();
+int _compare_doubles(const void* a, const void* b);
+BenchResult _time_kernel(BenchKernel* kernel, int n_trials);
+void _append_double(JsonWriter* writer, double value);
+char* _read_text(char* path);
+double _baseline_median(JsonValue* baseline, char* name, int size);
+
+/* Results are folded into this so the compiler can't drop the work of a kernel */
+volatile int sink = 0;
+
+static char* int_strs[] = {"12345", "-42", "+7", "0", "1048575", "-8388608", "12a", "99999999"};
+static char* addr_args[] = {"#-5", "&LOOP", "r3", "LABEL", "r7", "#100", "STR", "r9"};
+static char* labels[] = {"MAIN", "LOOP", "x", "Counter7", "ENDOFTHEPROGRAM", "a1b2c3", "LONGLABELNAMEOFTHIRTYONECHARSAB", "K"};
+static char* lines[] = {
+    "MAIN: mov r3, LENGTH\n",
+    "  add #-15, r1\n",
+    "LOOP: jmp &END\n",
+    "STR: .string \"abcdef\"\n",
+    "LIST: .data 6, -9, 15, 22\n",
+    " .extern EXTERNAL\n",
+    "  prn #48\n",
+    "END: stop\n"
+};
+
+/* The labels of the symbol table kernels ("S0", "S1", ...) */
+static char (*symbol_labels)[MAX_LABEL_LEN + 1] = NULL;
+
+/* Trims a line with leading and trailing whitespace (copied first, since trim cuts the line) */
+void _run_trim(int n_iters, int size) {
+    char buf[LINE_LEN];
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        strcpy(buf, "    mov r3, LENGTH    \n");
+        sink += *trim(buf);
+    }
+}
+
+void _run_is_integer(int n_iters, int size) {
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        sink += is_integer(int_strs[i & 7], 0);
+    }
+}
+
+void _run_get_int_value(int n_iters, int size) {
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        sink += get_int_value(int_strs[i & 3], 0); /* (the valid ones) */
+    }
+}
+
+void _run_get_addr_mode(int n_iters, int size) {
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        sink += get_addr_mode(addr_args[i & 7]);
+    }
+}
+
+void _run_validate_label(int n_iters, int size) {
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        sink += _validate_label(labels[i & 7]);
+    }
+}
+
+/* Lexes (syntax checks) a line into a view, without allocating (copied first, since lex_line cuts the line) */
+void _run_lex_line(int n_iters, int size) {
+    char buf[LINE_LEN];
+    char* args[MAX_ARGS];
+    ParsedLine view;
+    int i;
+    view.args = args;
+    for (i = 0; i < n_iters; i++) {
+        strcpy(buf, lines[i & 7]);
+        sink += lex_line(i, buf, &view);
+    }
+}
+
+/* Parses a line into a ParsedLine and frees it (after the first time, each line is taken from the parse memo) */
+void _run_parse_line(int n_iters, int size) {
+    char buf[LINE_LEN];
+    ParsedLine* parsed_line;
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        strcpy(buf, lines[i & 7]);
+        parsed_line = parse_line(i, buf);
+        sink += parsed_line->n_args;
+        free_parsed_line(parsed_line);
+    }
+}
+
+void _setup_symbol_labels(int size) {
+    int i;
+    if (symbol_labels != NULL) {
+        return;
+    }
+    symbol_labels = malloc(sizeof(*symbol_labels) * BENCH_MAX_SYMBOLS);
+    if (symbol_labels == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the symbol labels\n");
+        exit(1);
+    }
+    for (i = 0; i < BENCH_MAX_SYMBOLS; i++) {
+        sprintf(symbol_labels[i], "S%i", i);
+    }
+}
+
+/* Fills a symbol table with 'size' symbols, and frees it */
+void _run_add_symbol(int n_iters, int size) {
+    int i;
+    int j;
+    for (i = 0; i < n_iters; i++) {
+        for (j = 0; j < size; j++) {
+            sink += add_symbol(symbol_labels[j], TYPE_CODE, LOC_UNK);
+        }
+        free_symbol_table();
+    }
+}
+
+/* A symbol table of 'size' symbols to look up in */
+void _setup_lookup_symbol(int size) {
+    int i;
+    _setup_symbol_labels(size);
+    for (i = 0; i < size; i++) {
+        add_symbol(symbol_labels[i], TYPE_CODE, LOC_UNK);
+    }
+}
+
+/* Looks up symbols of the table, spread over it (7919 is a prime, so every symbol is visited) */
+void _run_lookup_symbol(int n_iters, int size) {
+    int i;
+    int j = 0;
+    for (i = 0; i < n_iters; i++) {
+        j = (j + 7919) % size;
+        sink += lookup_symbol(symbol_labels[j])->address;
+    }
+}
+
+void _run_encode_instruction(int n_iters, int size) {
+    Instruction instruction;
+    int i;
+    instruction.linker_info = Linker_A;
+    for (i = 0; i < n_iters; i++) {
+        instruction.opcode = i & 15;
+        instruction.arg_1_mode = (AddrMode)(i & 3);
+        instruction.reg_1 = i & 7;
+        instruction.arg_2_mode = (AddrMode)((i >> 2) & 3);
+        instruction.reg_2 = (i >> 3) & 7;
+        instruction.funct = (i >> 4) & 3;
+        sink += encode_instruction(instruction);
+    }
+}
+
+void _run_encode_operand(int n_iters, int size) {
+    Operand operand;
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        operand.value = (i & 1) ? i & 0xffff : -(i & 0xffff);
+        operand.linker_info = (i & 2) ? Linker_R : Linker_A;
+        sink += encode_operand(operand);
+    }
+}
+
+/* Code and data images of 'size' words (three quarters of 3-word instructions, and a quarter of data) */
+void _setup_object(int size) {
+    int i;
+    init_code_image(size);
+    init_data_image(size);
+    init_word_types(2 * size);
+    for (i = 0; i < size * 3 / 4; i += 3) {
+        add_instruction(i & 15, IMMEDIATE, 0, DIRECT, 0, i & 3);
+        add_operand(i - 500, Linker_A);
+        add_operand(MEM_START_ADDRESS + i, Linker_R);
+    }
+    while (get_IC() - MEM_START_ADDRESS + get_DC() < size) {
+        add_data(get_DC() - 100);
+    }
+}
+
+/* Writes the .ob output of the images (to /dev/null) */
+void _run_write_object_file(int n_iters, int size) {
+    int i;
+    for (i = 0; i < n_iters; i++) {
+        write_object_file("/dev/null");
+    }
+}
+
+void _teardown_symbols() {
+    free_symbol_table();
+}
+
+void _teardown_object() {
+    free_mc_memory();
+}
+
+static BenchKernel kernels[] = {
+    {"trim", 0, 1, NULL, _run_trim, NULL},
+    {"is_integer", 0, 1, NULL, _run_is_integer, NULL},
+    {"get_int_value", 0, 1, NULL, _run_get_int_value, NULL},
+    {"get_addr_mode", 0, 1, NULL, _run_get_addr_mode, NULL},
+    {"_validate_label", 0, 1, NULL, _run_validate_label, NULL},
+    {"lex_line", 0, 1, NULL, _run_lex_line, NULL},
+    {"parse_line", 0, 1, NULL, _run_parse_line, reset_parse_memo},
+    {"add_symbol", 1000, 1000, _setup_symbol_labels, _run_add_symbol, NULL},
+    {"add_symbol", 10000, 10000, _setup_symbol_labels, _run_add_symbol, NULL},
+    {"add_symbol", 100000, 100000, _setup_symbol_labels, _run_add_symbol, NULL},
+    {"lookup_symbol", 1000, 1, _setup_lookup_symbol, _run_lookup_symbol, _teardown_symbols},
+    {"lookup_symbol", 10000, 1, _setup_lookup_symbol, _run_lookup_symbol, _teardown_symbols},
+    {"lookup_symbol", 100000, 1, _setup_lookup_symbol, _run_lookup_symbol, _teardown_symbols},
+    {"encode_instruction", 0, 1, NULL, _run_encode_instruction, NULL},
+    {"encode_operand", 0, 1, NULL, _run_encode_operand, NULL},
+    {"write_object_file", BENCH_OBJECT_WORDS, BENCH_OBJECT_WORDS, _setup_object, _run_write_object_file, _teardown_object}
+};
+
+/* Monotonic time in nanoseconds */
+double _now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int _compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Times a kernel: the iterations of a trial are calibrated, the trials are warmed up, and then 'n_trials' trials are
+ * timed. Returns the median, 99th percentile and fastest time per operation
+ */
+BenchResult _time_kernel(BenchKernel* kernel, int n_trials) {
+    BenchResult result;
+    double* times;
+    double start;
+    double elapsed;
+    double warmup_start;
+    int i;
+
+    if (kernel->setup != NULL) {
+        kernel->setup(kernel->size);
+    }
+
+    /* Calibration */
+    result.n_iters = 1;
+    for (;;) {
+        start = _now_ns();
+        kernel->run(result.n_iters, kernel->size);
+        elapsed = _now_ns() - start;
+        if (elapsed >= BENCH_TRIAL_NS || result.n_iters >= (1 << 28)) {
+            break;
+        }
+        result.n_iters *= 2;
+    }
+
+    /* Warm-up */
+    warmup_start = _now_ns();
+    while (_now_ns() - warmup_start < BENCH_WARMUP_NS) {
+        kernel->run(result.n_iters, kernel->size);
+    }
+
+    /* Trials */
+    times = (double*)malloc(sizeof(double) * n_trials);
+    if (times == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the trial times\n");
+        exit(1);
+    }
+    for (i = 0; i < n_trials; i++) {
+        start = _now_ns();
+        kernel->run(result.n_iters, kernel->size);
+        times[i] = (_now_ns() - start) / ((double)result.n_iters * kernel->ops_per_iter);
+    }
+    qsort(times, n_trials, sizeof(double), _compare_doubles);
+    result.median_ns = times[n_trials / 2];
+    result.p99_ns = times[(n_trials * 99) / 100 < n_trials ? (n_trials * 99) / 100 : n_trials - 1];
+    result.min_ns = times[0];
+    free(times);
+
+    if (kernel->teardown != NULL) {
+        kernel->teardown();
+    }
+    return result;
+}
+
+/* Appends a time (in ns, to 2 decimal places) to a writer */
+void _append_double(JsonWriter* writer, double value) {
+    char buf[64];
+    sprintf(buf, "%.2f", value);
+    json_append(writer, buf);
+}
+
+/* Reads a whole file into a '\0' terminated buffer. Returns NULL if error (remember to free it) */
+char* _read_text(char* path) {
+    FILE* fp;
+    char* text;
+    long len;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = (char*)malloc(len + 1);
+    if (text != NULL) {
+        len = fread(text, 1, len, fp);
+        text[len] = '\0';
+    }
+    fclose(fp);
+    return text;
+}
+
+/* The median time of a kernel in the results of a baseline run (0 if it isn't there) */
+double _baseline_median(JsonValue* baseline, char* name, int size) {
+    JsonValue* kernel;
+    JsonValue* median;
+    char* kernel_name;
+
+    kernel = json_get(baseline, "kernels");
+    for (kernel = kernel != NULL ? kernel->children : NULL; kernel != NULL; kernel = kernel->next) {
+        kernel_name = json_get_str(kernel, "name");
+        if (kernel_name != NULL && strcmp(kernel_name, name) == 0 && json_get_int(kernel, "size", 0) == size) {
+            median = json_get(kernel, "median_ns");
+            return median != NULL && median->type == JSON_NUMBER ? median->number : 0;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    char* output_path = NULL;
+    char* baseline_path = NULL;
+    char* baseline_text;
+    JsonValue* baseline = NULL;
+    JsonWriter writer = {NULL, 0, 0, 0};
+    BenchResult result;
+    FILE* fp;
+    double baseline_ns;
+    int n_trials = BENCH_DEFAULT_TRIALS;
+    int n_kernels;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            n_trials = atoi(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-o results.json] [-b baseline.json] [-t trials]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (baseline_path != NULL) {
+        baseline_text = _read_text(baseline_path);
+        baseline = baseline_text != NULL ? parse_json(baseline_text) : NULL;
+        free(baseline_text);
+        if (baseline == NULL) {
+            fprintf(stderr, "Error: Unable to read the results in '%s'\n", baseline_path);
+            return 1;
+        }
+    }
+
+    /* (the kernels run serially) */
+    options.jobs = 1;
+    reset_counters();
+
+    json_append(&writer, "{\"trials\": ");
+    json_append_int(&writer, n_trials);
+    json_append(&writer, ", \"kernels\": [");
+    printf("%-26s %10s %12s %12s %12s%s\n", "kernel", "iters", "median ns", "p99 ns", "min ns",
+           baseline != NULL ? "   vs baseline" : "");
+    n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    for (i = 0; i < n_kernels; i++) {
+        result = _time_kernel(&kernels[i], n_trials);
+        if (kernels[i].size > 0) {
+            printf("%-18s %7i", kernels[i].name, kernels[i].size);
+        }
+        else {
+            printf("%-26s", kernels[i].name);
+        }
+        printf(" %10i %12.2f %12.2f %12.2f", result.n_iters, result.median_ns, result.p99_ns, result.min_ns);
+        baseline_ns = baseline != NULL ? _baseline_median(baseline, kernels[i].name, kernels[i].size) : 0;
+        if (baseline_ns > 0) {
+            printf("   %+11.1f%%", (result.median_ns / baseline_ns - 1) * 100);
+        }
+        printf("\n");
+        fflush(stdout);
+
+        json_append(&writer, i > 0 ? ", {\"name\": " : "{\"name\": ");
+        json_append_str(&writer, kernels[i].name);
+        json_append(&writer, ", \"size\": ");
+        json_append_int(&writer, kernels[i].size);
+        json_append(&writer, ", \"iterations\": ");
+        json_append_int(&writer, result.n_iters);
+        json_append(&writer, ", \"median_ns\": ");
+        _append_double(&writer, result.median_ns);
+        json_append(&writer, ", \"p99_ns\": ");
+        _append_double(&writer, result.p99_ns);
+        json_append(&writer, ", \"min_ns\": ");
+        _append_double(&writer, result.min_ns);
+        json_append(&writer, "}");
+    }
+    json_append(&writer, "]}\n");
+
+    if (output_path != NULL && !writer.failed) {
+        fp = fopen(output_path, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Unable to create '%s'\n", output_path);
+        }
+        else {
+            fputs(writer.data, fp);
+            fclose(fp);
+        }
+    }
+    json_free_writer(&writer);
+    free_json(baseline);
+    free(symbol_labels);
+    free_diagnostics();
+    return 0;
+}
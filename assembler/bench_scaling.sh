@@ -0,0 +1,72 @@
+#!/bin/sh
+# Scaling benchmark of the parallel passes (make bench-scaling):
+# assembles a generated file with many label references with --jobs 1..N, and prints the time and speedup of each.
+# Usage: bench_scaling.sh [max jobs (default: the number of cores)] [number of referencing lines (default: 1000000)]
+
+ASSEMBLER=${ASSEMBLER:-./assembler}
+MAX_JOBS=${1:-$(getconf _NPROCESSORS_ONLN)}
+N_LINES=${2:-1000000}
+RUNS=3
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Every instruction references 2 labels (one of them relatively), spread over the whole file
+awk -v n="$N_LINES" 'BEGIN {
+    print ".extern EXT"
+    print ".entry MAIN"
+    print "MAIN: stop"
+    for (i = 0; i < n; i++) {
+        if (i % 8 == 0) {
+            printf "L%d: mov D%d, L%d\n", i, (i * 7) % n, (i * 13) % n
+        }
+        else if (i % 8 == 4) {
+            printf "D%d: .data %d, -%d\n", i - 4, i % 1000, i % 100
+            printf "D%d: .data %d\n", i, i % 500
+        }
+        else if (i % 8 == 6) {
+            printf " jmp &L%d\n", (i * 5) % n - (i * 5) % 8
+        }
+        else if (i % 8 == 2) {
+            printf " cmp EXT, L%d\n", (i * 11) % n - (i * 11) % 8
+        }
+        else {
+            printf " add L%d, r%d\n", (i * 3) % n - (i * 3) % 8, i % 8
+        }
+    }
+}' > "$DIR/bench.as"
+
+# Prints the wall time (in seconds) of the fastest of $RUNS runs with --jobs $1
+best_time() {
+    best=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        start=$(date +%s.%N)
+        "$ASSEMBLER" --jobs "$1" "$DIR/bench" > "$DIR/log" || return 1
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) printf "%.4f", t; else print $3 }')
+        run=$((run + 1))
+    done
+    echo "$best"
+}
+
+echo "$(wc -l < "$DIR/bench.as") lines, best of $RUNS runs"
+printf "%6s %10s %8s\n" jobs seconds speedup
+jobs=1
+while [ $jobs -le "$MAX_JOBS" ]; do
+    if ! t=$(best_time $jobs) || [ ! -f "$DIR/bench.ob" ]; then
+        echo "Failed to assemble with --jobs $jobs:" >&2
+        cat "$DIR/log" >&2
+        exit 1
+    fi
+    if [ $jobs -eq 1 ]; then
+        base=$t
+        mv "$DIR/bench.ob" "$DIR/reference.ob"
+    elif cmp -s "$DIR/bench.ob" "$DIR/reference.ob"; then
+        rm "$DIR/bench.ob"
+    else
+        echo "The output of --jobs $jobs differs from that of --jobs 1" >&2
+        exit 1
+    fi
+    printf "%6d %10s %8s\n" $jobs "$t" "$(echo "$base $t" | awk '{ printf "%.2fx", $1 / $2 }')"
+    jobs=$((jobs + 1))
+done
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "checker.h"
+#include "parser.h"
+#include "passes.h"
+#include "string_utils.h"
+#include "file_utils.h"
+#include "include_cache.h"
+#include "incbin.h"
+
+/* Initial number of buckets in the set of defined symbols (doubled whenever it gets too full) */
+#define CHECK_INITIAL_BUCKETS 1024
+
+/* Number of references to allocate for. Each time the amount allocated
+ * is exceeded, another 'batch' is dynamically reallocated */
+#define CHECK_REFS_BATCH_SIZE 1024
+
+/* A defined symbol (symbols are stored in a hash set, chained in each bucket) */
+typedef struct CheckSymbol {
+    char* label;
+    int is_constant; /* defined by an '.equ' */
+    struct CheckSymbol* next;
+} CheckSymbol;
+
+/* A symbol reference, to be checked once all the definitions have been seen */
+typedef struct CheckRef {
+    int line_num;
+    char* source; /* the included file of the line (see ParsedLine) */
+    char* label;
+} CheckRef;
+
+/* A growable array of references */
+typedef struct CheckRefs {
+    CheckRef* refs;
+    int n;
+    int capacity;
+} CheckRefs;
+
+static CheckSymbol** buckets = NULL;
+static unsigned int n_buckets = 0;
+static unsigned int n_defined = 0;
+
+/* Labels of '.entry' directives, and labels referenced by operands (checked in this order,
+ * as in the second pass) */
+static CheckRefs entry_refs = {NULL, 0, 0};
+static CheckRefs operand_refs = {NULL, 0, 0};
+
+/* Returns the definition of the label (NULL if it wasn't defined) */
+CheckSymbol* _find_defined(char* label) {
+    CheckSymbol* symbol;
+    if (n_buckets == 0) {
+        return NULL;
+    }
+    for (symbol = buckets[hash_str(label) % n_buckets]; symbol != NULL; symbol = symbol->next) {
+        if (strcmp(symbol->label, label) == 0) {
+            return symbol;
+        }
+    }
+    return NULL;
+}
+
+/* Doubles the number of buckets once there are on average more than 2 symbols per bucket
+ * Returns 1 if success, 0 if error */
+int _grow_buckets() {
+    CheckSymbol** new_buckets;
+    CheckSymbol* symbol;
+    CheckSymbol* next;
+    unsigned int new_n_buckets;
+    unsigned int i;
+
+    new_n_buckets = n_buckets == 0 ? CHECK_INITIAL_BUCKETS : n_buckets * 2;
+    new_buckets = (CheckSymbol**)calloc(new_n_buckets, sizeof(CheckSymbol*));
+    if (new_buckets == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n_buckets; i++) {
+        for (symbol = buckets[i]; symbol != NULL; symbol = next) {
+            next = symbol->next;
+            symbol->next = new_buckets[hash_str(symbol->label) % new_n_buckets];
+            new_buckets[hash_str(symbol->label) % new_n_buckets] = symbol;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    n_buckets = new_n_buckets;
+    return 1;
+}
+
+/* Enters a symbol definition into the set (reporting duplicates)
+ * Returns 1 if success, 0 if error */
+int _define_symbol(char* label, int is_constant) {
+    CheckSymbol* symbol;
+    unsigned int i_bucket;
+
+    if (_find_defined(label) != NULL) {
+        report_error(DIAG_DUPLICATE_SYMBOL, line_num, "Symbol \'%s\' already exists", label);
+        return 0;
+    }
+    if (n_defined >= 2 * n_buckets && !_grow_buckets()) {
+        report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for the symbol table");
+        return 0;
+    }
+    symbol = (CheckSymbol*)malloc(sizeof(CheckSymbol));
+    if (symbol == NULL || (symbol->label = str_cpy(label)) == NULL) {
+        free(symbol);
+        report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for the symbol table");
+        return 0;
+    }
+    symbol->is_constant = is_constant;
+    i_bucket = hash_str(label) % n_buckets;
+    symbol->next = buckets[i_bucket];
+    buckets[i_bucket] = symbol;
+    n_defined++;
+    return 1;
+}
+
+/* Records a reference to be checked at the end of the file
+ * Returns 1 if success, 0 if error */
+int _add_ref(CheckRefs* refs, char* label) {
+    if (refs->n == refs->capacity) {
+        CheckRef* tmp = (CheckRef*)realloc(refs->refs, sizeof(CheckRef) * (refs->capacity + CHECK_REFS_BATCH_SIZE));
+        if (tmp == NULL) {
+            report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for symbol references");
+            return 0;
+        }
+        refs->refs = tmp;
+        refs->capacity += CHECK_REFS_BATCH_SIZE;
+    }
+    refs->refs[refs->n].line_num = line_num;
+    refs->refs[refs->n].source = line_source;
+    refs->refs[refs->n].label = str_cpy(label);
+    refs->n++;
+    return 1;
+}
+
+/* Checks that the names in a constant expression (a valid one) are constants defined before it, as the first pass
+ * does when folding it (reporting the first one that isn't). Returns 1 if valid, 0 if error */
+int _check_expression(char* expression) {
+    char name[MAX_LABEL_LEN + 1];
+    CheckSymbol* symbol;
+    int len;
+
+    while (*expression != '\0') {
+        if (!isalpha(*expression)) {
+            expression++;
+            continue;
+        }
+        for (len = 0; isalnum(expression[len]) && len < MAX_LABEL_LEN; len++) {
+            name[len] = expression[len];
+        }
+        name[len] = '\0';
+        expression += len;
+        symbol = _find_defined(name);
+        if (symbol == NULL) {
+            report_error(DIAG_UNDEFINED_SYMBOL, line_num,
+                         "Unrecognized constant \'%s\' (a constant is defined by an .equ before it's used)", name);
+            return 0;
+        }
+        if (!symbol->is_constant) {
+            report_error(DIAG_CONSTANT, line_num, "Symbol \'%s\' is not a constant (only .equ's can be used in expressions)",
+                         name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Reports the references to undefined symbols and to constants (which have no address), as the second pass does,
+ * and frees them */
+void _check_refs(CheckRefs* refs, int is_entry) {
+    CheckSymbol* symbol;
+    int i;
+    for (i = 0; i < refs->n; i++) {
+        symbol = _find_defined(refs->refs[i].label);
+        line_source = refs->refs[i].source;
+        if (symbol == NULL) {
+            report_error(DIAG_UNDEFINED_SYMBOL, refs->refs[i].line_num, "Unrecognized symbol \'%s\'", refs->refs[i].label);
+        }
+        else if (symbol->is_constant && is_entry) {
+            report_error(DIAG_CONSTANT, refs->refs[i].line_num, "Constant \'%s\' can't be exported by .entry (it has no address)",
+                         refs->refs[i].label);
+        }
+        else if (symbol->is_constant) {
+            report_error(DIAG_CONSTANT, refs->refs[i].line_num,
+                         "Constant \'%s\' can't be used as an address (use \'#%s\' for its value)",
+                         refs->refs[i].label, refs->refs[i].label);
+        }
+        free(refs->refs[i].label);
+    }
+    free(refs->refs);
+    refs->refs = NULL;
+    refs->n = 0;
+    refs->capacity = 0;
+}
+
+/* Free the set of defined symbols */
+void _free_defined() {
+    CheckSymbol* symbol;
+    CheckSymbol* next;
+    unsigned int i;
+    for (i = 0; i < n_buckets; i++) {
+        for (symbol = buckets[i]; symbol != NULL; symbol = next) {
+            next = symbol->next;
+            free(symbol->label);
+            free(symbol);
+        }
+    }
+    free(buckets);
+    buckets = NULL;
+    n_buckets = 0;
+    n_defined = 0;
+}
+
+/* Record the symbol definitions and references of a validated line (a LineHandler for included lines) */
+int check_parsed_line(ParsedLine* parsed_line) {
+    int i;
+    int rc = 1;
+    int is_definition;
+    int is_constant;
+    AddrMode mode;
+
+    line_num = parsed_line->line_num;
+    line_source = parsed_line->source;
+    is_definition = get_num_symbols(parsed_line); /* (this also warns about redundant labels) */
+    is_constant = parsed_line->directive != NULL && strcmp(parsed_line->directive, ".equ") == 0;
+    if (is_constant) { /* (its expression is folded before the constant is defined) */
+        rc &= _check_expression(parsed_line->args[1]);
+    }
+    if (is_definition) {
+        rc &= _define_symbol(parsed_line->op != NULL || (strcmp(parsed_line->directive, ".extern") != 0 &&
+                             !is_constant) ? parsed_line->label : parsed_line->args[0], is_constant);
+    }
+    if (parsed_line->op != NULL) {
+        for (i = 0; i < parsed_line->n_args; i++) {
+            mode = get_addr_mode(parsed_line->args[i]);
+            if (mode == IMMEDIATE) { /* (the names in a constant expression) */
+                rc &= _check_expression(parsed_line->args[i] + 1);
+            }
+            else if (mode == DIRECT) {
+                rc &= _add_ref(&operand_refs, parsed_line->args[i]);
+            }
+            else if (mode == RELATIVE) { /* skip the '&' prefix */
+                rc &= _add_ref(&operand_refs, parsed_line->args[i] + 1);
+            }
+        }
+    }
+    else if (strcmp(parsed_line->directive, ".entry") == 0) {
+        rc &= _add_ref(&entry_refs, parsed_line->args[0]);
+    }
+    else if (strcmp(parsed_line->directive, ".data") == 0 || strcmp(parsed_line->directive, ".space") == 0) {
+        for (i = 0; i < parsed_line->n_args; i++) {
+            rc &= _check_expression(parsed_line->args[i]);
+        }
+    }
+    return rc;
+}
+
+/* Checks the file of an .incbin view against its offset, length and width (it's mapped, as it is when
+ * assembling). Returns 1 if valid, 0 if error */
+int _check_incbin(ParsedLine* view) {
+    ParsedLine* parsed_line;
+    int rc;
+    parsed_line = construct_parsed_line(NULL, view->op, view->directive, view->n_args, view->args);
+    rc = load_incbin(parsed_line);
+    free_parsed_line(parsed_line);
+    return rc;
+}
+
+/*
+ * Fast syntax validation (--check-only):
+ * Each line is lexed and validated into a view of the line buffer (nothing is stored apart from the symbols),
+ * and label definitions and references are checked for duplicate, undefined and '.entry' of undefined labels,
+ * and for constants used where the passes don't allow them.
+ * Returns the number of errors found
+ */
+int check_file(char* input_arg) {
+    FILE* fp;
+    char* input_path;
+    char line[LINE_LEN];
+    char* args[MAX_ARGS];
+    ParsedLine view;
+
+    reset_counters();
+
+    fp = open_input_file(input_arg, &input_path);
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Unable to open '%s'\n", input_path);
+        free(input_path);
+        return 0;
+    }
+
+    fprintf(status_stream(), "\n>>> \'%s\'\n\n", input_path);
+
+    view.args = args;
+    set_incbin_source(input_path);
+    while (!diag_limit_reached() && fgets(line, sizeof(line), fp) != NULL) {
+        line_num++;
+        if (!lex_line(line_num, line, &view)) {
+            continue;
+        }
+        if (is_include_directive(&view)) {
+            expand_include(input_path, &view, check_parsed_line);
+        }
+        else {
+            if (is_incbin_directive(&view)) {
+                _check_incbin(&view);
+            }
+            check_parsed_line(&view);
+        }
+    }
+    close_input_file(fp);
+    set_incbin_source(NULL);
+
+    /* Now that all the definitions have been seen, check the references (as in the second pass) */
+    _check_refs(&entry_refs, 1);
+    _check_refs(&operand_refs, 0);
+    _free_defined();
+
+    flush_diagnostics(input_path);
+    if (n_errors) {
+        fprintf(status_stream(), "*** Check found %i errors. ***\n", n_errors);
+    }
+    free(input_path);
+    return n_errors;
+}
@@ -0,0 +1,18 @@
+#ifndef CHECKER_H
+#define CHECKER_H
+
+#include "assembler.h"
+
+/*
+ * Fast syntax validation (--check-only):
+ * Each line is lexed and validated into a view of the line buffer (nothing is stored apart from the symbols),
+ * and label definitions and references are checked for duplicate, undefined and '.entry' of undefined labels.
+ * The code/data images are never built, the passes don't run and no output files are written.
+ * Returns the number of errors found
+ */
+int check_file(char* input_arg);
+
+/* Record the symbol definitions and references of a validated line (a LineHandler for included lines) */
+int check_parsed_line(ParsedLine* parsed_line);
+
+#endif
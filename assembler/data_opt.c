@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_opt.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+
+/* What pool_data did to the current file */
+static THREAD_LOCAL DataOptStats pool_stats;
+
+/* What gc_data did to the current file */
+static THREAD_LOCAL DataOptStats gc_stats;
+
+/* The blocks being sorted by _compare_tails (qsort has no context argument) */
+static THREAD_LOCAL DataBlock* sorted_blocks;
+
+int _build_layout(DataLayout* layout);
+void _free_layout(DataLayout* layout);
+int _find_block(DataLayout* layout, Symbol* symbol);
+void _pin_blocks(DataLayout* layout, int is_any_use);
+int _is_read_use(unsigned int ic);
+int _instruction_is(Instruction* instruction, char* name);
+int _compare_addresses(const void* a, const void* b);
+int _compare_tails(const void* a, const void* b);
+int _is_tail_of(DataBlock* block, DataBlock* other);
+int _remove_blocks(DataLayout* layout, char* is_removed);
+
+/*
+ * Data pooling (--pool-data). The blocks are sorted by their words read backwards, so that a block whose words
+ * are the tail of another one's (or the same) comes right before it, or before a block with the same tail.
+ * Going from the last one back, each block is pooled into the one its successor was pooled into, if it's the tail
+ * of its successor. (The same blocks are sorted by their start, latest first, so the first of them is kept)
+ */
+void pool_data() {
+    DataLayout layout;
+    DataBlock* block;
+    DataBlock* next;
+    char* is_removed;
+    int* order;
+    int n_order;
+    int i;
+
+    memset(&pool_stats, 0, sizeof(DataOptStats));
+    pool_stats.dc_before = pool_stats.dc_after = get_DC();
+    if (!_build_layout(&layout)) { /* (it's optional) */
+        return;
+    }
+    order = (int*)malloc(sizeof(int) * (layout.n_blocks + 1));
+    is_removed = (char*)calloc(get_DC() + 1, 1);
+    if (order == NULL || is_removed == NULL) {
+        free(order);
+        free(is_removed);
+        _free_layout(&layout);
+        return;
+    }
+    _pin_blocks(&layout, 0);
+
+    n_order = 0;
+    for (i = 0; i < layout.n_blocks; i++) {
+        if (!layout.blocks[i].is_pinned) {
+            order[n_order++] = i;
+        }
+    }
+    sorted_blocks = layout.blocks;
+    qsort(order, n_order, sizeof(int), _compare_tails);
+
+    for (i = n_order - 2; i >= 0; i--) {
+        block = &layout.blocks[order[i]];
+        next = &layout.blocks[order[i + 1]];
+        if (_is_tail_of(block, next)) {
+            block->alias = next->alias;
+            block->offset = layout.blocks[next->alias].len - block->len;
+            memset(is_removed + block->start, 1, block->len);
+            pool_stats.n_blocks++;
+        }
+    }
+    if (pool_stats.n_blocks > 0) {
+        pool_stats.n_saved_words = _remove_blocks(&layout, is_removed);
+        pool_stats.n_blocks = pool_stats.n_saved_words > 0 ? pool_stats.n_blocks : 0;
+        pool_stats.dc_after = get_DC();
+    }
+
+    free(order);
+    free(is_removed);
+    _free_layout(&layout);
+}
+
+/* What pool_data did to the current file */
+DataOptStats get_pool_stats() {
+    return pool_stats;
+}
+
+/*
+ * Dead data elimination (--gc-data). A block is kept if any of its labels is referenced (in any addressing mode,
+ * so the lea's and the branches to it count), or exported by .entry
+ */
+void gc_data() {
+    DataLayout layout;
+    DataBlock* block;
+    char* is_removed;
+    int i;
+
+    memset(&gc_stats, 0, sizeof(DataOptStats));
+    gc_stats.dc_before = gc_stats.dc_after = get_DC();
+    if (!_build_layout(&layout)) { /* (it's optional) */
+        return;
+    }
+    is_removed = (char*)calloc(get_DC() + 1, 1);
+    if (is_removed == NULL) {
+        _free_layout(&layout);
+        return;
+    }
+    _pin_blocks(&layout, 1);
+
+    for (i = 0; i < layout.n_blocks; i++) {
+        block = &layout.blocks[i];
+        if (!block->is_pinned) {
+            memset(is_removed + block->start, 1, block->len);
+            gc_stats.n_blocks++;
+        }
+    }
+    if (gc_stats.n_blocks > 0) {
+        gc_stats.n_saved_words = _remove_blocks(&layout, is_removed);
+        gc_stats.n_blocks = gc_stats.n_saved_words > 0 ? gc_stats.n_blocks : 0;
+        gc_stats.dc_after = get_DC();
+    }
+
+    free(is_removed);
+    _free_layout(&layout);
+}
+
+/* What gc_data did to the current file */
+DataOptStats get_gc_stats() {
+    return gc_stats;
+}
+
+/* Collects the data labels and the blocks they start. Returns 1 if success, 0 if out of memory */
+int _build_layout(DataLayout* layout) {
+    Symbol* symbol;
+    DataBlock* block;
+    unsigned int ic;
+    int i;
+
+    memset(layout, 0, sizeof(DataLayout));
+    for (symbol = get_first_symbol(); symbol != NULL; symbol = symbol->next) {
+        layout->n_symbols += symbol->type == TYPE_DATA;
+    }
+    layout->symbols = (Symbol**)malloc(sizeof(Symbol*) * (layout->n_symbols + 1));
+    layout->blocks = (DataBlock*)malloc(sizeof(DataBlock) * (layout->n_symbols + 1));
+    if (layout->symbols == NULL || layout->blocks == NULL) {
+        _free_layout(layout);
+        return 0;
+    }
+    layout->n_symbols = 0;
+    for (symbol = get_first_symbol(); symbol != NULL; symbol = symbol->next) {
+        if (symbol->type == TYPE_DATA) {
+            layout->symbols[layout->n_symbols++] = symbol;
+        }
+    }
+    qsort(layout->symbols, layout->n_symbols, sizeof(Symbol*), _compare_addresses);
+
+    /* (the data addresses were shifted by the IC, at the end of the first pass) */
+    ic = get_IC();
+    for (i = 0; i < layout->n_symbols; i++) {
+        if (layout->n_blocks > 0 && layout->symbols[i]->address - ic == layout->blocks[layout->n_blocks - 1].start) {
+            layout->blocks[layout->n_blocks - 1].n_symbols++;
+            continue;
+        }
+        block = &layout->blocks[layout->n_blocks];
+        block->start = layout->symbols[i]->address - ic;
+        block->symbols = &layout->symbols[i];
+        block->n_symbols = 1;
+        block->is_pinned = 0;
+        block->alias = layout->n_blocks;
+        block->offset = 0;
+        if (layout->n_blocks > 0) {
+            layout->blocks[layout->n_blocks - 1].len = block->start - layout->blocks[layout->n_blocks - 1].start;
+        }
+        layout->n_blocks++;
+    }
+    if (layout->n_blocks > 0) {
+        layout->blocks[layout->n_blocks - 1].len = get_DC() - layout->blocks[layout->n_blocks - 1].start;
+    }
+    return 1;
+}
+
+/* Frees what _build_layout allocated */
+void _free_layout(DataLayout* layout) {
+    free(layout->symbols);
+    free(layout->blocks);
+    memset(layout, 0, sizeof(DataLayout));
+}
+
+/* The index of the block that a data symbol starts (-1 if none) */
+int _find_block(DataLayout* layout, Symbol* symbol) {
+    int dc;
+    int low;
+    int high;
+    int middle;
+
+    dc = symbol->address - get_IC();
+    low = 0;
+    high = layout->n_blocks - 1;
+    while (low <= high) {
+        middle = (low + high) / 2;
+        if (layout->blocks[middle].start == dc) {
+            return middle;
+        }
+        if (layout->blocks[middle].start < dc) {
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+/* Pins the blocks that are used other than by being read (or, if 'is_any_use', used at all), and those exported
+ * by .entry */
+void _pin_blocks(DataLayout* layout, int is_any_use) {
+    SymbolInfo* reference;
+    Symbol* symbol;
+    int i_block;
+    int i;
+
+    for (i = 0; i < i_symbol_ref; i++) {
+        reference = &symbol_references[i];
+        symbol = find_symbol(reference->label);
+        if (symbol == NULL || symbol->type != TYPE_DATA) {
+            continue;
+        }
+        i_block = _find_block(layout, symbol);
+        if (i_block >= 0 && (is_any_use || reference->addrMode != DIRECT || !_is_read_use(reference->IC))) {
+            layout->blocks[i_block].is_pinned = 1;
+        }
+    }
+    for (i = 0; i < n_lines; i++) {
+        if (parsed_lines[i]->directive != NULL && strcmp(parsed_lines[i]->directive, ".entry") == 0) {
+            symbol = find_symbol(parsed_lines[i]->args[0]);
+            i_block = symbol != NULL && symbol->type == TYPE_DATA ? _find_block(layout, symbol) : -1;
+            if (i_block >= 0) {
+                layout->blocks[i_block].is_pinned = 1;
+            }
+        }
+    }
+}
+
+/* Whether the instruction of the operand word at 'ic' only reads it (the source of mov/add/sub, cmp, or prn) */
+int _is_read_use(unsigned int ic) {
+    Instruction* instruction;
+    unsigned int i;
+    WordType type;
+    int is_source;
+
+    /* The instruction word is the last one before the operand word */
+    i = ic - 1;
+    instruction = &get_code_word(i, &type)->instruction;
+    while (type != INSTRUCTION && i > MEM_START_ADDRESS) {
+        instruction = &get_code_word(--i, &type)->instruction;
+    }
+    is_source = ic == i + 1 && instruction->arg_1_mode != REGISTER &&
+                (_instruction_is(instruction, "mov") || _instruction_is(instruction, "add") ||
+                 _instruction_is(instruction, "sub"));
+    return is_source || _instruction_is(instruction, "cmp") || _instruction_is(instruction, "prn");
+}
+
+/* Whether an instruction word is of the op 'name' */
+int _instruction_is(Instruction* instruction, char* name) {
+    Op* op = get_op(name);
+    return instruction->opcode == op->opcode && instruction->funct == op->funct;
+}
+
+/* Orders symbols by their addresses (for qsort) */
+int _compare_addresses(const void* a, const void* b) {
+    int address_a = (*(Symbol**)a)->address;
+    int address_b = (*(Symbol**)b)->address;
+    return address_a < address_b ? -1 : address_a > address_b;
+}
+
+/* Orders blocks (indexes into sorted_blocks) by their words read backwards (for qsort) */
+int _compare_tails(const void* a, const void* b) {
+    DataBlock* block_a = &sorted_blocks[*(int*)a];
+    DataBlock* block_b = &sorted_blocks[*(int*)b];
+    int word_a;
+    int word_b;
+    int i;
+
+    for (i = 0; i < block_a->len && i < block_b->len; i++) {
+        word_a = get_data_word(block_a->start + block_a->len - 1 - i);
+        word_b = get_data_word(block_b->start + block_b->len - 1 - i);
+        if (word_a != word_b) {
+            return word_a < word_b ? -1 : 1;
+        }
+    }
+    if (block_a->len != block_b->len) {
+        return block_a->len < block_b->len ? -1 : 1;
+    }
+    return block_a->start > block_b->start ? -1 : block_a->start < block_b->start;
+}
+
+/* Whether the words of 'block' are the same as the tail of the words of 'other' */
+int _is_tail_of(DataBlock* block, DataBlock* other) {
+    int i;
+    if (block->len > other->len) {
+        return 0;
+    }
+    for (i = 1; i <= block->len; i++) {
+        if (get_data_word(block->start + block->len - i) != get_data_word(other->start + other->len - i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Removes the flagged data words, and moves the labels of each block to where its words (or those of the block
+ * it's aliased to) are now. Returns the number of words removed
+ */
+int _remove_blocks(DataLayout* layout, char* is_removed) {
+    DataBlock* block;
+    int* removed_before;
+    int dc;
+    int n_data;
+    int i;
+    int j;
+
+    n_data = get_DC();
+    removed_before = (int*)malloc(sizeof(int) * (n_data + 1));
+    if (removed_before == NULL) {
+        return 0;
+    }
+    removed_before[0] = 0;
+    for (i = 0; i < n_data; i++) {
+        removed_before[i + 1] = removed_before[i] + is_removed[i];
+    }
+    for (i = 0; i < layout->n_blocks; i++) {
+        block = &layout->blocks[i];
+        dc = layout->blocks[block->alias].start + block->offset;
+        for (j = 0; j < block->n_symbols; j++) {
+            block->symbols[j]->address = get_IC() + dc - removed_before[dc];
+        }
+    }
+    remove_data_words(is_removed);
+    remove_data_addresses(removed_before[n_data]);
+    i = removed_before[n_data];
+    free(removed_before);
+    return i;
+}
@@ -0,0 +1,66 @@
+#ifndef DATA_OPT_H
+#define DATA_OPT_H
+
+#include "assembler.h"
+#include "symbol_table.h"
+
+/*!
+ * DataBlock:
+ * The words of the data image from a data label up to the next one (so a label's block includes the unlabeled
+ * .data/.string lines after it). Since operands can only address a label, the words of a block are only
+ * reached through its labels
+ */
+typedef struct DataBlock {
+    int start;          /* DC of its first word */
+    int len;
+    Symbol** symbols;   /* its labels (several when they were aliased to the same words) */
+    int n_symbols;
+    int is_pinned;      /* it's written, its address is taken (lea), it's branched to or it's an .entry */
+    int alias;          /* the index of the block whose words it shares (its own if none) */
+    int offset;         /* where its words start in that block's words */
+} DataBlock;
+
+/*!
+ * DataLayout:
+ * The data labels of the file (sorted by address), and the blocks they start
+ */
+typedef struct DataLayout {
+    Symbol** symbols;
+    int n_symbols;
+    DataBlock* blocks;
+    int n_blocks;       /* (the words before the first label aren't in a block, and stay as they are) */
+} DataLayout;
+
+/*!
+ * DataOptStats:
+ * What a data pass did to the file that was just assembled
+ */
+typedef struct DataOptStats {
+    int n_blocks;       /* the blocks pooled into others (or dropped, by gc_data) */
+    int n_saved_words;
+    int dc_before;
+    int dc_after;
+} DataOptStats;
+
+/*
+ * Data pooling (--pool-data), run between the first and the second pass:
+ * a block whose words are the same as those of another block, or the same as their tail (e.g. a .string that is
+ * the suffix of another one, sharing its terminating zero), is dropped and its labels are aliased into the other
+ * block. Only blocks that are never written, address-taken, branched to or exported take part
+ */
+void pool_data();
+
+/* What pool_data did to the current file */
+DataOptStats get_pool_stats();
+
+/*
+ * Dead data elimination (--gc-data), run between the first and the second pass (before pool_data):
+ * a block none of whose labels is referenced by an operand or exported by .entry is dropped (with the unlabeled
+ * words after its label). The words before the first label are kept
+ */
+void gc_data();
+
+/* What gc_data did to the current file */
+DataOptStats get_gc_stats();
+
+#endif
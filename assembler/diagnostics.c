@@ -0,0 +1,225 @@
+#define _XOPEN_SOURCE 500 /* for vsnprintf() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "assembler.h"
+#include "diagnostics.h"
+#include "json.h"
+
+/* Number of diagnostics to allocate for. Each time the amount allocated
+ * is exceeded, another 'batch' is dynamically reallocated */
+#define DIAG_BATCH_SIZE 64
+
+/* Amount to allocate for a formatted message (longer messages are truncated) */
+#define DIAG_MSG_LEN (LINE_LEN + 256)
+
+/* Diagnostics of the current file are recorded here until the file is done */
+static THREAD_LOCAL Diagnostic* diagnostics = NULL;
+static THREAD_LOCAL int n_diagnostics = 0;
+static THREAD_LOCAL int diagnostics_capacity = 0;
+
+/* Number of errors reported for the current file (n_errors is reset between the passes) */
+static THREAD_LOCAL int n_file_errors = 0;
+
+static THREAD_LOCAL DiagFormat diag_format = DIAG_TEXT;
+static THREAD_LOCAL int max_errors = 0;
+
+/* enum to_string converter */
+char* severity_str(Severity severity) {
+    switch (severity) {
+        case SEV_WARNING: return "warning";
+        case SEV_ERROR: return "error";
+        default: return "unknown";
+    }
+}
+
+/* enum to_string converter */
+char* diag_code_str(DiagCode code) {
+    switch (code) {
+        case DIAG_LINE_TOO_LONG: return "line-too-long";
+        case DIAG_INVALID_LABEL: return "invalid-label";
+        case DIAG_MISSING_OP: return "missing-op";
+        case DIAG_INVALID_INT: return "invalid-int";
+        case DIAG_INVALID_STRING: return "invalid-string";
+        case DIAG_UNKNOWN_DIRECTIVE: return "unknown-directive";
+        case DIAG_DIRECTIVE_ARGS: return "directive-args";
+        case DIAG_UNKNOWN_OP: return "unknown-op";
+        case DIAG_OP_ARGS: return "op-args";
+        case DIAG_ADDR_MODE: return "addr-mode";
+        case DIAG_COMMAS: return "commas";
+        case DIAG_DUPLICATE_SYMBOL: return "duplicate-symbol";
+        case DIAG_UNDEFINED_SYMBOL: return "undefined-symbol";
+        case DIAG_REDUNDANT_LABEL: return "redundant-label";
+        case DIAG_INCLUDE: return "include";
+        case DIAG_MEMORY: return "memory";
+        case DIAG_IO: return "io";
+        case DIAG_INVALID_EXPR: return "invalid-expr";
+        case DIAG_CONSTANT: return "constant";
+        default: return "unknown";
+    }
+}
+
+/* Set the output format of the diagnostics */
+void set_diag_format(DiagFormat format) {
+    diag_format = format;
+}
+
+/* Stop recording errors after this many errors in a file (0 means no limit) */
+void set_max_errors(int n) {
+    max_errors = n;
+}
+
+/* Returns whether the --max-errors limit was reached for the current file */
+int diag_limit_reached() {
+    return max_errors > 0 && n_file_errors >= max_errors;
+}
+
+/* Internal function used by report_error and report_warning */
+void _record(Severity severity, DiagCode code, int line_num, char* format, va_list args) {
+    char message[DIAG_MSG_LEN];
+    char* copy;
+    Diagnostic* diagnostic;
+
+    if (n_diagnostics == diagnostics_capacity) {
+        Diagnostic* tmp = (Diagnostic*)realloc(diagnostics, sizeof(Diagnostic) * (diagnostics_capacity + DIAG_BATCH_SIZE));
+        if (tmp == NULL) { /* nowhere to record it, so at least don't lose it */
+            fprintf(stderr, "Failed to allocate memory for diagnostics\n");
+            return;
+        }
+        diagnostics = tmp;
+        diagnostics_capacity += DIAG_BATCH_SIZE;
+    }
+    vsnprintf(message, sizeof(message), format, args);
+    copy = (char*)malloc(strlen(message) + 1);
+    if (copy == NULL) { /* (a record always has its message) */
+        fprintf(stderr, "Failed to allocate memory for diagnostics: %s\n", message);
+        return;
+    }
+    strcpy(copy, message);
+
+    diagnostic = &diagnostics[n_diagnostics++];
+    diagnostic->severity = severity;
+    diagnostic->line_num = line_num;
+    diagnostic->code = code;
+    diagnostic->message = copy;
+    diagnostic->source = NULL;
+    if (line_num > 0 && line_source != NULL) { /* (a line of an included file) */
+        diagnostic->source = (char*)malloc(strlen(line_source) + 1);
+        if (diagnostic->source != NULL) {
+            strcpy(diagnostic->source, line_source);
+        }
+    }
+}
+
+/* Record an error (also counted in n_errors) */
+void report_error(DiagCode code, int line_num, char* format, ...) {
+    va_list args;
+    n_errors++;
+    if (diag_limit_reached()) { /* still counted, but not recorded */
+        return;
+    }
+    n_file_errors++;
+    va_start(args, format);
+    _record(SEV_ERROR, code, line_num, format, args);
+    va_end(args);
+}
+
+/* Record a warning */
+void report_warning(DiagCode code, int line_num, char* format, ...) {
+    va_list args;
+    if (diag_limit_reached()) {
+        return;
+    }
+    va_start(args, format);
+    _record(SEV_WARNING, code, line_num, format, args);
+    va_end(args);
+}
+
+/* The diagnostics recorded so far for the current file */
+int get_n_diagnostics() {
+    return n_diagnostics;
+}
+
+Diagnostic* get_diagnostics() {
+    return diagnostics;
+}
+
+/* Free the recorded messages */
+void _clear_records() {
+    int i;
+    for (i = 0; i < n_diagnostics; i++) {
+        free(diagnostics[i].message);
+        free(diagnostics[i].source);
+    }
+    n_diagnostics = 0;
+}
+
+/* Write out the diagnostics recorded for the file (in one write) and clear them */
+void flush_diagnostics(char* file_name) {
+    char* buf;
+    char* out;
+    int i;
+    size_t size;
+    Diagnostic* diagnostic;
+
+    if (n_diagnostics == 0) {
+        return;
+    }
+
+    /* Worst case size: every char of the strings escaped as \u00XX, plus the fixed part of each line */
+    size = 0;
+    for (i = 0; i < n_diagnostics; i++) {
+        size += 6 * (strlen(diagnostics[i].source ? diagnostics[i].source : file_name) +
+                     strlen(diagnostics[i].message)) + 128;
+    }
+    buf = (char*)malloc(size + 1);
+    if (buf == NULL) {
+        fprintf(stderr, "Failed to allocate memory for diagnostics\n");
+        _clear_records();
+        return;
+    }
+
+    out = buf;
+    for (i = 0; i < n_diagnostics; i++) {
+        diagnostic = &diagnostics[i];
+        if (diag_format == DIAG_JSON) {
+            out += sprintf(out, "{\"file\":");
+            out += write_json_str(out, diagnostic->source ? diagnostic->source : file_name);
+            out += sprintf(out, ",\"severity\":\"%s\",\"line\":%i,\"code\":\"%s\",\"message\":",
+                    severity_str(diagnostic->severity), diagnostic->line_num, diag_code_str(diagnostic->code));
+            out += write_json_str(out, diagnostic->message);
+            out += sprintf(out, "}\n");
+        }
+        else if (diagnostic->source != NULL) {
+            out += sprintf(out, "%s in line %i of %s: %s\n", diagnostic->severity == SEV_ERROR ? "Error" : "Warning",
+                    diagnostic->line_num, diagnostic->source, diagnostic->message);
+        }
+        else if (diagnostic->line_num > 0) {
+            out += sprintf(out, "%s in line %i: %s\n",
+                    diagnostic->severity == SEV_ERROR ? "Error" : "Warning", diagnostic->line_num, diagnostic->message);
+        }
+        else {
+            out += sprintf(out, "%s: %s\n", diagnostic->severity == SEV_ERROR ? "Error" : "Warning", diagnostic->message);
+        }
+    }
+    fwrite(buf, 1, out - buf, status_stream());
+    free(buf);
+    _clear_records();
+}
+
+/* Clear the diagnostics before processing each file */
+void reset_diagnostics() {
+    _clear_records();
+    n_file_errors = 0;
+}
+
+/* Clear the diagnostics and free the memory kept for recording them */
+void free_diagnostics() {
+    reset_diagnostics();
+    free(diagnostics);
+    diagnostics = NULL;
+    diagnostics_capacity = 0;
+}
@@ -0,0 +1,90 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+/*!
+ * Severity:
+ *  Errors prevent the output files from being generated, warnings don't
+ */
+typedef enum Severity {
+    SEV_WARNING = 0,
+    SEV_ERROR = 1
+} Severity;
+char* severity_str(Severity severity); /* convert to str */
+
+/*!
+ * DiagCode:
+ *  The kind of problem a diagnostic reports (stable, so that tools can filter on it)
+ */
+typedef enum DiagCode {
+    DIAG_LINE_TOO_LONG = 0,
+    DIAG_INVALID_LABEL = 1,
+    DIAG_MISSING_OP = 2,
+    DIAG_INVALID_INT = 3,
+    DIAG_INVALID_STRING = 4,
+    DIAG_UNKNOWN_DIRECTIVE = 5,
+    DIAG_DIRECTIVE_ARGS = 6,
+    DIAG_UNKNOWN_OP = 7,
+    DIAG_OP_ARGS = 8,
+    DIAG_ADDR_MODE = 9,
+    DIAG_COMMAS = 10,
+    DIAG_DUPLICATE_SYMBOL = 11,
+    DIAG_UNDEFINED_SYMBOL = 12,
+    DIAG_REDUNDANT_LABEL = 13,
+    DIAG_INCLUDE = 14,
+    DIAG_MEMORY = 15,
+    DIAG_IO = 16,
+    DIAG_INVALID_EXPR = 17,
+    DIAG_CONSTANT = 18
+} DiagCode;
+char* diag_code_str(DiagCode code); /* convert to str */
+
+/*!
+ * DiagFormat:
+ *  How the diagnostics of each file are written out
+ */
+typedef enum DiagFormat {
+    DIAG_TEXT = 0,  /* e.g. Error in line 5: Symbol 'X' already exists */
+    DIAG_JSON = 1   /* one JSON object per line */
+} DiagFormat;
+
+/*!
+ * Diagnostic:
+ *  A single error/warning, recorded by the sink until the current file is done
+ */
+typedef struct Diagnostic {
+    Severity severity;
+    int line_num; /* 0 if not related to a specific line */
+    DiagCode code;
+    char* message;
+    char* source; /* the included file the line is in (NULL if in the file being assembled) */
+} Diagnostic;
+
+/* Set the output format of the diagnostics */
+void set_diag_format(DiagFormat format);
+
+/* Stop recording errors after this many errors in a file (0 means no limit) */
+void set_max_errors(int max_errors);
+
+/* Record an error (also counted in n_errors) */
+void report_error(DiagCode code, int line_num, char* format, ...);
+
+/* Record a warning */
+void report_warning(DiagCode code, int line_num, char* format, ...);
+
+/* Returns whether the --max-errors limit was reached for the current file (so there is no point in carrying on) */
+int diag_limit_reached();
+
+/* The diagnostics recorded so far for the current file */
+int get_n_diagnostics();
+Diagnostic* get_diagnostics();
+
+/* Write out the diagnostics recorded for the file (in one write) and clear them */
+void flush_diagnostics(char* file_name);
+
+/* Clear the diagnostics before processing each file */
+void reset_diagnostics();
+
+/* Clear the diagnostics and free the memory kept for recording them */
+void free_diagnostics();
+
+#endif
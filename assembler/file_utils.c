@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "file_utils.h"
+#include "batch_io.h"
 
 /* return filename with extension */
 char* create_file_name(char* base, char* extension) {
@@ -13,6 +14,43 @@ char* create_file_name(char* base, char* extension) {
     return filename;
 }
 
+/* opens an input file (given without the .as extension), where "-" stands for the standard input.
+ * input_path is set to the name to show for it (remember to free when done) */
+FILE* open_input_file(char* input_arg, char** input_path) {
+    FILE* fp;
+    if (strcmp(input_arg, STDIN_ARG) == 0) {
+        *input_path = create_file_name(STDIN_NAME, "");
+        return stdin;
+    }
+    *input_path = create_file_name(input_arg, ".as");
+    if (*input_path != NULL && take_prefetched_input(input_arg, &fp)) { /* (it was read ahead) */
+        return fp;
+    }
+    fp = *input_path ? fopen(*input_path, "r") : NULL;
+    return fp;
+}
+
+/* closes an input file opened by open_input_file */
+void close_input_file(FILE* fp) {
+    if (fp != stdin) {
+        fclose(fp);
+        release_prefetched_input();
+    }
+}
+
+/* opens an output file for writing (it's written in a batch with the other output files, if batching is active) */
+FILE* open_output_file(char* file_path) {
+    FILE* fp = open_batched_output(file_path);
+    return fp != NULL ? fp : fopen(file_path, "w");
+}
+
+/* closes an output file opened by open_output_file */
+void close_output_file(FILE* fp) {
+    if (!close_batched_output(fp)) {
+        fclose(fp);
+    }
+}
+
 /* writes a number to file (in padded hex format) */
 void write_val(FILE *fp, int val) {
     fprintf(fp, "%06x\n", val);
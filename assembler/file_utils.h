@@ -3,9 +3,26 @@
 
 #include <stdio.h>
 
+/* An input file given as "-" is read from the standard input */
+#define STDIN_ARG "-"
+#define STDIN_NAME "<stdin>"
+
 /* return filename */
 char* create_file_name(char* base, char* extension);
 
+/* opens an input file (given without the .as extension), where "-" stands for the standard input.
+ * input_path is set to the name to show for it (remember to free when done) */
+FILE* open_input_file(char* input_arg, char** input_path);
+
+/* closes an input file opened by open_input_file */
+void close_input_file(FILE* fp);
+
+/* opens an output file for writing (it's written in a batch with the other output files, if batching is active) */
+FILE* open_output_file(char* file_path);
+
+/* closes an output file opened by open_output_file */
+void close_output_file(FILE* fp);
+
 /* writes a number to file (in padded hex format) */
 void write_val(FILE *fp, int val);
 
@@ -0,0 +1,228 @@
+#define _XOPEN_SOURCE 500 /* for stat() and mmap() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "incbin.h"
+#include "include_cache.h"
+#include "string_utils.h"
+#include "diagnostics.h"
+
+/* Enough for the digits of an int */
+#define INT_STR_LEN 16
+
+/* Files mapped so far in this run */
+static THREAD_LOCAL BinaryFile* incbin_cache = NULL;
+
+/* The file whose lines are being parsed (NULL for the working directory) */
+static THREAD_LOCAL char* source_path = NULL;
+
+BinaryFile* _map_file(char* path, struct stat* st);
+void _unmap_file(BinaryFile* file);
+int _set_incbin_args(ParsedLine* parsed_line, int offset, int length, int width);
+
+/* Returns whether the parsed line is an '.incbin' directive */
+int is_incbin_directive(ParsedLine* parsed_line) {
+    return parsed_line->directive != NULL && strcmp(parsed_line->directive, ".incbin") == 0;
+}
+
+/* Sets the file whose lines are being parsed. Returns the previous one */
+char* set_incbin_source(char* path) {
+    char* previous = source_path;
+    source_path = path;
+    return previous;
+}
+
+/*
+ * Maps the file of an '.incbin' line, checks its offset, length and width against the file, and fills them in.
+ * Returns 1 if success, 0 if error
+ */
+int load_incbin(ParsedLine* parsed_line) {
+    char* path;
+    struct stat st;
+    BinaryFile* file;
+    int offset;
+    int length;
+    int width;
+
+    path = resolve_include_path(source_path != NULL ? source_path : "", parsed_line->args[0]);
+    if (path == NULL || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        report_error(DIAG_INCLUDE, line_num, "Unable to open binary file %s", parsed_line->args[0]);
+        free(path);
+        return 0;
+    }
+    if (st.st_size > INT_MAX) {
+        report_error(DIAG_INCLUDE, line_num, "Binary file %s is too large (%li bytes)", parsed_line->args[0], (long)st.st_size);
+        free(path);
+        return 0;
+    }
+    file = _map_file(path, &st);
+    if (file == NULL) {
+        report_error(DIAG_INCLUDE, line_num, "Unable to map binary file %s", parsed_line->args[0]);
+        return 0;
+    }
+
+    offset = parsed_line->n_args > 1 ? get_int_value(parsed_line->args[1], 0) : 0;
+    length = parsed_line->n_args > 2 ? get_int_value(parsed_line->args[2], 0) : (int)file->size - offset;
+    width = parsed_line->n_args > 3 ? get_int_value(parsed_line->args[3], 0) : 1;
+    if (offset < 0 || offset > (int)file->size) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Offset %i is outside of binary file %s (%i bytes)",
+                     offset, parsed_line->args[0], (int)file->size);
+        return 0;
+    }
+    if (length < 0 || length > (int)file->size - offset) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Length %i from offset %i is past the end of binary file %s (%i bytes)",
+                     length, offset, parsed_line->args[0], (int)file->size);
+        return 0;
+    }
+    if (width < 1 || width > MAX_INCBIN_WIDTH) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Invalid word width %i for \'.incbin\' (must be 1 to %i bytes)",
+                     width, MAX_INCBIN_WIDTH);
+        return 0;
+    }
+    if (length % width != 0) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Length %i of binary file %s isn't a multiple of the word width (%i)",
+                     length, parsed_line->args[0], width);
+        return 0;
+    }
+    if (!_set_incbin_args(parsed_line, offset, length, width)) {
+        report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for parsing input lines");
+        return 0;
+    }
+    parsed_line->binary = file->bytes != NULL ? file->bytes + offset : NULL;
+    return 1;
+}
+
+/* The number of data words of a loaded '.incbin' line */
+int get_incbin_words(ParsedLine* parsed_line) {
+    return get_int_value(parsed_line->args[2], 0) / get_int_value(parsed_line->args[3], 0);
+}
+
+/* The number of bytes in each word of a loaded '.incbin' line */
+int get_incbin_width(ParsedLine* parsed_line) {
+    return get_int_value(parsed_line->args[3], 0);
+}
+
+/* A data word of an '.incbin' from its bytes (a little endian number) */
+int get_incbin_word(unsigned char* bytes, int width) {
+    int value = 0;
+    while (width-- > 0) {
+        value = (value << 8) | bytes[width];
+    }
+    return value;
+}
+
+/* Returns the mapping of a file (mapping it if it isn't already). Takes ownership of path. Returns NULL if error */
+BinaryFile* _map_file(char* path, struct stat* st) {
+    BinaryFile* file;
+    int fd;
+
+    for (file = incbin_cache; file != NULL; file = file->next) {
+        if (file->mtime == st->st_mtime && file->size == (size_t)st->st_size && strcmp(file->path, path) == 0) {
+            free(path);
+            return file;
+        }
+    }
+    file = (BinaryFile*)malloc(sizeof(BinaryFile));
+    if (file == NULL) {
+        free(path);
+        return NULL;
+    }
+    file->path = path;
+    file->mtime = st->st_mtime;
+    file->size = (size_t)st->st_size;
+    file->bytes = NULL;
+    if (file->size > 0) {
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            file->bytes = (unsigned char*)mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+        }
+        if (fd < 0 || file->bytes == (unsigned char*)MAP_FAILED) {
+            free(path);
+            free(file);
+            return NULL;
+        }
+    }
+    file->next = incbin_cache;
+    incbin_cache = file;
+    return file;
+}
+
+/* Unmaps a file */
+void _unmap_file(BinaryFile* file) {
+    if (file->bytes != NULL) {
+        munmap(file->bytes, file->size);
+    }
+    free(file->path);
+    free(file);
+}
+
+/* Replaces the args of an '.incbin' line with all 4 of them. Returns 1 if success, 0 if out of memory */
+int _set_incbin_args(ParsedLine* parsed_line, int offset, int length, int width) {
+    char** args;
+    int values[3];
+    char buf[INT_STR_LEN];
+    int i;
+
+    args = (char**)malloc(sizeof(char*) * 4);
+    if (args == NULL) {
+        return 0;
+    }
+    values[0] = offset;
+    values[1] = length;
+    values[2] = width;
+    args[0] = parsed_line->args[0];
+    for (i = 0; i < 3; i++) {
+        sprintf(buf, "%i", values[i]);
+        args[i + 1] = str_cpy(buf);
+        if (args[i + 1] == NULL) { /* (the line keeps its args as they were) */
+            while (i-- > 0) {
+                free(args[i + 1]);
+            }
+            free(args);
+            return 0;
+        }
+    }
+    for (i = 1; i < parsed_line->n_args; i++) {
+        free(parsed_line->args[i]);
+    }
+    free(parsed_line->args);
+    parsed_line->args = args;
+    parsed_line->n_args = 4;
+    return 1;
+}
+
+/* Unmaps the files which changed on disk since they were mapped */
+void prune_incbin_cache() {
+    BinaryFile** link;
+    BinaryFile* file;
+    struct stat st;
+    link = &incbin_cache;
+    while (*link != NULL) {
+        file = *link;
+        if (stat(file->path, &st) != 0 || st.st_mtime != file->mtime || (size_t)st.st_size != file->size) {
+            *link = file->next;
+            _unmap_file(file);
+        }
+        else {
+            link = &file->next;
+        }
+    }
+}
+
+/* Unmaps all the files (once all the input files are done) */
+void free_incbin_cache() {
+    BinaryFile* tmp;
+    while (incbin_cache != NULL) {
+        tmp = incbin_cache;
+        incbin_cache = incbin_cache->next;
+        _unmap_file(tmp);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef INCBIN_H
+#define INCBIN_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "assembler.h"
+
+/* Most bytes in a word of an '.incbin' (the words are 24 bits) */
+#define MAX_INCBIN_WIDTH 3
+
+/*!
+ * BinaryFile:
+ * A file pulled in by an '.incbin' directive is mapped into memory only once per run, and the parsed lines
+ * of its '.incbin's point into the mapping. Mapped files are stored as a linked list, keyed by path, size and
+ * modification time (stale versions stay mapped until they're pruned, since lines may still point into them)
+ */
+typedef struct BinaryFile {
+    char* path;
+    time_t mtime;
+    size_t size;
+    unsigned char* bytes; /* (NULL for an empty file, which isn't mapped) */
+    struct BinaryFile* next;
+} BinaryFile;
+
+/* Returns whether the parsed line is an '.incbin' directive */
+int is_incbin_directive(ParsedLine* parsed_line);
+
+/*
+ * Sets the file whose lines are being parsed (the paths of its '.incbin's are relative to its directory,
+ * or to the working directory if it's NULL). Returns the previous one
+ */
+char* set_incbin_source(char* source_path);
+
+/*
+ * Maps the file of an '.incbin' line (or finds it already mapped), checks its offset, length and width against
+ * the file, and fills them in (so the line always has the 4 args: "file", offset, length, width).
+ * The line's 'binary' is pointed at the bytes of its first word.
+ * Returns 1 if success, 0 if error (which is reported)
+ */
+int load_incbin(ParsedLine* parsed_line);
+
+/* The number of data words of a loaded '.incbin' line */
+int get_incbin_words(ParsedLine* parsed_line);
+
+/* The number of bytes in each word of a loaded '.incbin' line */
+int get_incbin_width(ParsedLine* parsed_line);
+
+/* A data word of an '.incbin' from its 'width' bytes (read as a little endian number) */
+int get_incbin_word(unsigned char* bytes, int width);
+
+/* Unmaps the files which changed on disk since they were mapped
+ * (only safe when no parsed lines point into them, i.e. between input files) */
+void prune_incbin_cache();
+
+/* Unmaps all the files (once all the input files are done) */
+void free_incbin_cache();
+
+#endif
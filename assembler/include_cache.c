@@ -0,0 +1,381 @@
+#define _XOPEN_SOURCE 500 /* for realpath() and stat() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "include_cache.h"
+#include "parser.h"
+#include "string_utils.h"
+#include "diagnostics.h"
+#include "incbin.h"
+
+/* Amount to allocate for the description of an include cycle */
+#define DIAG_CHAIN_LEN 4096
+
+/* Files parsed so far in this run (stale versions of a file are kept until the end of the run,
+ * since lines of theirs may still be in use by the current input file) */
+static THREAD_LOCAL IncludeFile* include_cache = NULL;
+
+/* The input file that is currently being pre-processed (i.e. the root of the include chain) */
+static THREAD_LOCAL char* root_path = NULL;
+static THREAD_LOCAL int root_include_line = 0;
+
+/* The included file that is currently being expanded (the innermost one) */
+static THREAD_LOCAL IncludeFile* expanding_top = NULL;
+
+/* Returns whether the parsed line is an '.include' directive */
+int is_include_directive(ParsedLine* parsed_line) {
+    return parsed_line->directive != NULL && strcmp(parsed_line->directive, ".include") == 0;
+}
+
+/*
+ * Resolves a quoted path (of an '.include' or an '.incbin') relative to the directory of the including file.
+ * Returns the canonical path (remember to free when done), or NULL if it doesn't exist
+ */
+char* resolve_include_path(char* including_path, char* quoted_path) {
+    char* name;
+    char* joined;
+    char* resolved;
+    char* slash;
+
+    name = get_substr(quoted_path, 1, strlen(quoted_path) - 1); /* remove the quotes */
+    slash = strrchr(including_path, '/');
+    if (name[0] == '/' || slash == NULL) {
+        joined = name;
+    }
+    else {
+        joined = (char*)malloc(slash - including_path + 1 + strlen(name) + 1);
+        strncpy(joined, including_path, slash - including_path + 1);
+        strcpy(joined + (slash - including_path + 1), name);
+        free(name);
+    }
+    resolved = realpath(joined, NULL);
+    free(joined);
+    return resolved;
+}
+
+/* Add a parsed line to a cached file (allocating memory if needed) */
+int _add_cached_line(IncludeFile* file, ParsedLine* parsed_line) {
+    if (file->n_lines == file->capacity) {
+        ParsedLine** tmp = (ParsedLine**)realloc(file->lines, sizeof(ParsedLine*) * (file->capacity + INPUT_BATCH_SIZE));
+        if (tmp == NULL) {
+            return 0;
+        }
+        file->lines = tmp;
+        file->capacity += INPUT_BATCH_SIZE;
+    }
+    parsed_line->is_cached = 1;
+    file->lines[file->n_lines++] = parsed_line;
+    return 1;
+}
+
+/* Keeps copies of the diagnostics recorded since the first 'from' ones (those of parsing the file)
+ * Returns 1 if success, 0 if out of memory */
+int _keep_diagnostics(IncludeFile* file, int from) {
+    Diagnostic* recorded;
+    int i;
+
+    file->n_diagnostics = get_n_diagnostics() - from;
+    if (file->n_diagnostics <= 0) {
+        file->n_diagnostics = 0;
+        return 1;
+    }
+    file->diagnostics = (Diagnostic*)malloc(sizeof(Diagnostic) * file->n_diagnostics);
+    if (file->diagnostics == NULL) {
+        file->n_diagnostics = 0;
+        return 0;
+    }
+    recorded = get_diagnostics() + from;
+    for (i = 0; i < file->n_diagnostics; i++) {
+        file->diagnostics[i] = recorded[i];
+        file->diagnostics[i].message = str_cpy(recorded[i].message);
+        if (file->diagnostics[i].message == NULL) {
+            while (i-- > 0) {
+                free(file->diagnostics[i].message);
+            }
+            free(file->diagnostics);
+            file->diagnostics = NULL;
+            file->n_diagnostics = 0;
+            return 0;
+        }
+        file->diagnostics[i].source = NULL;
+    }
+    return 1;
+}
+
+/* Reports the diagnostics of parsing a cached file again (for the input file which includes it now) */
+void _report_again(IncludeFile* file) {
+    Diagnostic* diagnostic;
+    char* saved_line_source;
+    int i;
+
+    saved_line_source = line_source;
+    line_source = file->path;
+    for (i = 0; i < file->n_diagnostics; i++) {
+        diagnostic = &file->diagnostics[i];
+        if (diagnostic->severity == SEV_ERROR) {
+            report_error(diagnostic->code, diagnostic->line_num, "%s", diagnostic->message);
+        }
+        else {
+            report_warning(diagnostic->code, diagnostic->line_num, "%s", diagnostic->message);
+        }
+    }
+    line_source = saved_line_source;
+}
+
+/*
+ * Lex and validate an included file, and enter it into the cache
+ * Returns NULL if it can't be read
+ */
+IncludeFile* _parse_file(char* path, time_t mtime) {
+    FILE* fp;
+    char buf[LINE_LEN];
+    int file_line_num;
+    int saved_line_num;
+    int saved_n_diagnostics;
+    char* saved_source;
+    char* saved_line_source;
+    IncludeFile* file;
+    ParsedLine* parsed_line;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    file = (IncludeFile*)malloc(sizeof(IncludeFile));
+    if (file == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    file->path = path;
+    file->mtime = mtime;
+    file->n_lines = 0;
+    file->capacity = 0;
+    file->lines = NULL;
+    file->include_line = 0;
+    file->expand_depth = 0;
+    file->has_incbin = 0;
+    file->n_diagnostics = 0;
+    file->diagnostics = NULL;
+
+    /* Syntax errors are reported with the line numbers and the path of the included file, and kept for reporting
+     * them again whenever it's included from the cache (and its '.incbin's are relative to its own directory) */
+    saved_line_num = line_num;
+    saved_line_source = line_source;
+    line_source = path;
+    saved_n_diagnostics = get_n_diagnostics();
+    saved_source = set_incbin_source(path);
+    file_line_num = 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        file_line_num++;
+        line_num = file_line_num;
+        parsed_line = parse_line(file_line_num, buf);
+        if (parsed_line != NULL && !_add_cached_line(file, parsed_line)) {
+            free_parsed_line(parsed_line);
+            report_error(DIAG_MEMORY, file_line_num, "Failed to allocate memory for parsing '%s'", path);
+        }
+        else if (parsed_line != NULL && is_incbin_directive(parsed_line)) {
+            file->has_incbin = 1;
+        }
+    }
+    fclose(fp);
+    set_incbin_source(saved_source);
+    if (!_keep_diagnostics(file, saved_n_diagnostics)) {
+        report_error(DIAG_MEMORY, 0, "Failed to allocate memory for parsing '%s'", path);
+    }
+    line_num = saved_line_num;
+    line_source = saved_line_source;
+
+    file->next = include_cache;
+    include_cache = file;
+    return file;
+}
+
+/* Returns the cached version of the file with the given path and modification time (NULL if not cached) */
+IncludeFile* _lookup_file(char* path, time_t mtime) {
+    IncludeFile* file;
+    for (file = include_cache; file != NULL; file = file->next) {
+        if (file->mtime == mtime && strcmp(file->path, path) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+/* Returns whether including 'path' at this point would close an include cycle */
+int _is_cycle(char* path) {
+    IncludeFile* file;
+    if (root_path != NULL && strcmp(root_path, path) == 0) {
+        return 1;
+    }
+    for (file = include_cache; file != NULL; file = file->next) {
+        if (file->expand_depth && strcmp(file->path, path) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Prints the chain of includes (with line numbers) which leads back to 'path' */
+void _report_cycle(char* path) {
+    IncludeFile* file;
+    int depth;
+    int found;
+
+    char chain[DIAG_CHAIN_LEN];
+    int len;
+
+    len = sprintf(chain, "'%.*s' (line %i)", LINE_LEN, root_path, root_include_line);
+    for (depth = 1, found = 1; found; depth++) { /* list the files being expanded, in the order they were included */
+        found = 0;
+        for (file = include_cache; file != NULL; file = file->next) {
+            if (file->expand_depth == depth) {
+                if (len < DIAG_CHAIN_LEN - LINE_LEN - 32) {
+                    len += sprintf(chain + len, " -> '%.*s' (line %i)", LINE_LEN, file->path, file->include_line);
+                }
+                found = 1;
+                break;
+            }
+        }
+    }
+    report_error(DIAG_INCLUDE, line_num, "Include cycle detected: %s -> '%s'", chain, path);
+}
+
+/* Pass the lines of an included file to handle_line, expanding nested '.include' directives */
+int _expand_file(IncludeFile* file, LineHandler handle_line) {
+    int i_line;
+    int saved_line_num;
+    char* saved_line_source;
+    int rc = 1;
+
+    saved_line_num = line_num;
+    saved_line_source = line_source;
+    for (i_line = 0; i_line < file->n_lines; i_line++) {
+        ParsedLine* parsed_line = file->lines[i_line];
+        line_num = parsed_line->line_num;
+        line_source = parsed_line->source;
+        if (is_include_directive(parsed_line)) {
+            file->include_line = parsed_line->line_num;
+            rc &= expand_include(file->path, parsed_line, handle_line);
+            file->include_line = 0;
+        }
+        else {
+            rc &= handle_line(parsed_line);
+        }
+    }
+    line_num = saved_line_num;
+    line_source = saved_line_source;
+    return rc;
+}
+
+/*
+ * Expands an '.include' directive found in the file 'including_path':
+ * the included file is parsed (or fetched from the cache) and each of its lines is passed to handle_line.
+ * Returns 1 if success, 0 if error
+ */
+int expand_include(char* including_path, ParsedLine* include_line, LineHandler handle_line) {
+    char* path;
+    struct stat st;
+    IncludeFile* file;
+    IncludeFile* saved_top;
+    int is_root;
+    int rc;
+
+    path = resolve_include_path(including_path, include_line->args[0]);
+    if (path == NULL || stat(path, &st) != 0) {
+        report_error(DIAG_INCLUDE, line_num, "Unable to open included file %s", include_line->args[0]);
+        free(path);
+        return 0;
+    }
+
+    is_root = (root_path == NULL);
+    if (is_root) { /* including directly from the input file */
+        root_path = realpath(including_path, NULL);
+        if (root_path == NULL) { /* e.g. the standard input */
+            root_path = str_cpy(including_path);
+        }
+        root_include_line = line_num;
+    }
+
+    rc = 0;
+    if (_is_cycle(path)) {
+        _report_cycle(path);
+        free(path);
+    }
+    else {
+        file = _lookup_file(path, st.st_mtime);
+        if (file != NULL) { /* already parsed (in this or a previous input file) */
+            free(path);
+            _report_again(file);
+        }
+        else {
+            file = _parse_file(path, st.st_mtime);
+            if (file == NULL) {
+                report_error(DIAG_INCLUDE, line_num, "Unable to open included file %s", include_line->args[0]);
+                free(path);
+            }
+        }
+        if (file != NULL) {
+            saved_top = expanding_top;
+            file->expand_depth = expanding_top == NULL ? 1 : expanding_top->expand_depth + 1;
+            expanding_top = file;
+            rc = _expand_file(file, handle_line);
+            expanding_top = saved_top;
+            file->expand_depth = 0;
+        }
+    }
+
+    if (is_root) {
+        free(root_path);
+        root_path = NULL;
+    }
+    return rc;
+}
+
+/* Frees a cached file */
+void _free_file(IncludeFile* file) {
+    int i_line;
+    int i;
+    for (i_line = 0; i_line < file->n_lines; i_line++) {
+        free_parsed_line(file->lines[i_line]);
+    }
+    for (i = 0; i < file->n_diagnostics; i++) {
+        free(file->diagnostics[i].message);
+    }
+    free(file->diagnostics);
+    free(file->lines);
+    free(file->path);
+    free(file);
+}
+
+/* Drops the cached files which changed on disk since they were parsed, and those with '.incbin's (whose binary
+ * files may have changed, and be unmapped by prune_incbin_cache)
+ * (only safe when no parsed lines of theirs are in use, i.e. between input files) */
+void prune_include_cache() {
+    IncludeFile** link;
+    IncludeFile* file;
+    struct stat st;
+    link = &include_cache;
+    while (*link != NULL) {
+        file = *link;
+        if (file->has_incbin || stat(file->path, &st) != 0 || st.st_mtime != file->mtime) {
+            *link = file->next;
+            _free_file(file);
+        }
+        else {
+            link = &file->next;
+        }
+    }
+}
+
+/* Free the include cache (once all the input files are done) */
+void free_include_cache() {
+    IncludeFile* tmp;
+    while (include_cache != NULL) {
+        tmp = include_cache;
+        include_cache = include_cache->next;
+        _free_file(tmp);
+    }
+}
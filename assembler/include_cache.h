@@ -0,0 +1,56 @@
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+#include <time.h>
+
+#include "assembler.h"
+#include "diagnostics.h"
+
+/*!
+ * IncludeFile:
+ * A file pulled in by an '.include' directive is lexed and validated only once per run, and its
+ * parsed lines are then shared by every input file that includes it.
+ * Cached files are stored as a linked list, keyed by path and modification time.
+ */
+typedef struct IncludeFile {
+    char* path;
+    time_t mtime;
+    int n_lines;
+    int capacity;
+    ParsedLine** lines; /* nested '.include' directives are kept as is, and expanded on use */
+    int n_diagnostics;
+    Diagnostic* diagnostics; /* those of parsing the file (reported again each time it's included from the cache) */
+    int include_line; /* while the file is being expanded: line of the '.include' being expanded inside it (0 if none) */
+    int expand_depth; /* while the file is being expanded: its depth in the include chain (0 if not), to detect include cycles */
+    int has_incbin; /* it has '.incbin' lines (which point into the mapped binary files) */
+    struct IncludeFile* next;
+} IncludeFile;
+
+/* What to do with each line of an included file (e.g. register_parsed_line)
+ * Returns 1 if success, 0 if error */
+typedef int (*LineHandler)(ParsedLine* parsed_line);
+
+/* Returns whether the parsed line is an '.include' directive */
+int is_include_directive(ParsedLine* parsed_line);
+
+/*
+ * Resolves a quoted path (of an '.include' or an '.incbin') relative to the directory of the including file.
+ * Returns the canonical path (remember to free when done), or NULL if it doesn't exist
+ */
+char* resolve_include_path(char* including_path, char* quoted_path);
+
+/*
+ * Expands an '.include' directive found in the file 'including_path':
+ * the included file is parsed (or fetched from the cache) and each of its lines is passed to handle_line.
+ * Returns 1 if success, 0 if error
+ */
+int expand_include(char* including_path, ParsedLine* include_line, LineHandler handle_line);
+
+/* Drops the cached files which changed on disk since they were parsed, and those with '.incbin's
+ * (only safe when no parsed lines of theirs are in use, i.e. between input files) */
+void prune_include_cache();
+
+/* Free the include cache (once all the input files are done) */
+void free_include_cache();
+
+#endif
@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 200112L /* for fileno() and ftruncate() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "incremental.h"
+#include "parser.h"
+#include "passes.h"
+#include "string_utils.h"
+#include "file_utils.h"
+#include "include_cache.h"
+#include "incbin.h"
+
+/* Returns whether a line is the same as the line of a record */
+int _is_same_line(LineRecord* record, char* text) {
+    return record->hash == hash_str(text) && strcmp(record->text, text) == 0;
+}
+
+/* Returns whether a parsed line is an .equ (a change to it would change the words of the lines using the constant too)
+ * or a .space (its label is placed after the whole data section, so any change to the data would move it) */
+int _is_equ_or_space(ParsedLine* parsed_line) {
+    return parsed_line->directive != NULL &&
+           (strcmp(parsed_line->directive, ".equ") == 0 || strcmp(parsed_line->directive, ".space") == 0);
+}
+
+/* Frees the records of some lines */
+void _free_records(LineRecord* records, int n_records) {
+    int i;
+    for (i = 0; i < n_records; i++) {
+        free(records[i].text);
+        if (records[i].parsed_line != NULL) {
+            free_parsed_line(records[i].parsed_line);
+        }
+    }
+}
+
+/* Frees the source lines which were not taken over by records */
+void _free_texts(char** texts, int n_texts) {
+    int i;
+    for (i = 0; i < n_texts; i++) {
+        free(texts[i]);
+    }
+    free(texts);
+}
+
+/* Frees the state of a file (its next run will be a full one) */
+void free_incremental(IncrementalFile* file) {
+    int i;
+    _free_records(file->records, file->n_records);
+    free(file->records);
+    file->records = NULL;
+    file->n_records = 0;
+    free_images(&file->image);
+    file->image.IC = MEM_START_ADDRESS;
+    file->image.DC = 0;
+    free_symbol_list(&file->symbols);
+    for (i = 0; i < file->n_symbol_refs; i++) {
+        free(file->symbol_refs[i].label);
+    }
+    free(file->symbol_refs);
+    file->symbol_refs = NULL;
+    file->n_symbol_refs = 0;
+    free(file->words);
+    file->words = NULL;
+    file->n_words = 0;
+    file->is_valid = 0;
+}
+
+/*
+ * Returns whether the operand word of a symbol reference has to be resolved again,
+ * given the source lines that changed (first_line..last_line) and by how much the words after them moved
+ */
+int _is_fixup_stale(SymbolInfo* symbol_ref, int is_ref_moved, int first_line, int last_line, int code_delta, int data_delta) {
+    Symbol* symbol;
+    int is_after;
+    int target_shift;
+    int ref_shift;
+
+    symbol = find_symbol(symbol_ref->label);
+    if (symbol == NULL || (symbol->line_num >= first_line && symbol->line_num <= last_line)) {
+        return 1; /* (a missing symbol is reported when it's resolved) */
+    }
+    is_after = symbol->line_num > last_line;
+    if (symbol->loc == LOC_EXTERNAL) { /* (always at 0, but a relative reference to it moves with the reference) */
+        target_shift = 0;
+    }
+    else if (symbol->type == TYPE_DATA) { /* the data section comes after the code section */
+        target_shift = code_delta + (is_after ? data_delta : 0);
+    }
+    else {
+        target_shift = is_after ? code_delta : 0;
+    }
+    if (symbol_ref->addrMode == RELATIVE) { /* the distance from the reference to the symbol */
+        ref_shift = is_ref_moved ? code_delta : 0;
+        return target_shift != ref_shift;
+    }
+    return target_shift != 0;
+}
+
+/*
+ * Rewrites only the lines of the .ob file whose word changed, among the given ranges of words
+ * (pairs of first word and end word). The header is rewritten if the number of words changed.
+ * Returns 1 if success, 0 if the file has to be written in full instead (e.g. it's missing)
+ */
+int _update_object_file(IncrementalFile* file, char* file_path, int* ranges, int n_ranges) {
+    FILE* fp;
+    char header[OB_LINE_LEN + 1 + 2 * 12];
+    int* words;
+    int n_code;
+    int n_data;
+    int n_words;
+    int i_range;
+    int i;
+    int i_next; /* the word whose line is at the current position of the file */
+    int word;
+    int is_ok;
+
+    n_code = get_IC() - MEM_START_ADDRESS;
+    n_data = get_DC();
+    n_words = n_code + n_data;
+    sprintf(header, "%7i %-6i\n", n_code, n_data);
+    if (file->words == NULL || strlen(header) != OB_LINE_LEN || MEM_START_ADDRESS + n_words - 1 > OB_MAX_ADDRESS) {
+        return 0;
+    }
+    fp = fopen(file_path, "r+");
+    if (fp == NULL) {
+        return 0;
+    }
+    words = (int*)realloc(file->words, sizeof(int) * (n_words + 1));
+    if (words == NULL) {
+        fclose(fp);
+        return 0;
+    }
+    file->words = words;
+
+    if (n_code != file->image.IC - MEM_START_ADDRESS || n_data != file->image.DC) {
+        fputs(header, fp);
+        file->stats.n_ob_lines++;
+    }
+    i_next = -1;
+    for (i_range = 0; i_range < n_ranges; i_range++) {
+        for (i = ranges[2 * i_range]; i < ranges[2 * i_range + 1] && i < n_words; i++) {
+            word = encode_word(i);
+            if (i < file->n_words && words[i] == word) {
+                continue;
+            }
+            words[i] = word;
+            if (i != i_next) {
+                fseek(fp, (long)(i + 1) * OB_LINE_LEN, SEEK_SET);
+            }
+            write_address(fp, MEM_START_ADDRESS + i);
+            write_val(fp, word);
+            i_next = i + 1;
+            file->stats.n_ob_lines++;
+        }
+    }
+    fflush(fp);
+    if (n_words < file->n_words) {
+        ftruncate(fileno(fp), (long)(n_words + 1) * OB_LINE_LEN);
+    }
+    file->n_words = n_words;
+    is_ok = !ferror(fp);
+    fclose(fp);
+    return is_ok;
+}
+
+/* Generates the .ob file (only rewriting the lines that changed since the last run, if possible) */
+void _create_object_file(IncrementalFile* file, char* output_path, int* ranges, int n_ranges) {
+    char* path;
+    int i;
+
+    path = create_file_name(output_path, ".ob");
+    if (!_update_object_file(file, path, ranges, n_ranges)) {
+        write_object_file(path);
+        file->n_words = get_IC() - MEM_START_ADDRESS + get_DC();
+        free(file->words);
+        file->words = (int*)malloc(sizeof(int) * (file->n_words + 1));
+        for (i = 0; file->words != NULL && i < file->n_words; i++) {
+            file->words[i] = encode_word(i);
+        }
+        file->stats.n_ob_lines = file->n_words + 1;
+    }
+    printf("  - Successfully created %s\n", path);
+    free(path);
+}
+
+/* Hands over the state of a successful run to the file */
+void _retain_state(IncrementalFile* file) {
+    detach_images(&file->image);
+    detach_symbol_table(&file->symbols);
+    file->symbol_refs = symbol_references;
+    file->n_symbol_refs = i_symbol_ref;
+    symbol_references = NULL;
+    i_symbol_ref = 0;
+    n_symbol_refs = 0;
+    file->is_valid = 1;
+}
+
+/*
+ * Reassembles a file from the source lines of its new version (taking over the 'texts' array),
+ * reusing the state of the last run. Files including other files (.include/.incbin), defining constants (.equ) or
+ * reserving space (.space) are not supported.
+ * Returns the number of errors found, or -1 if the file is one of those (nothing was done then)
+ */
+int reassemble_incremental(IncrementalFile* file, char* input_arg, char* input_path, char** texts, int n_texts) {
+    char buf[LINE_LEN];
+    LineRecord* mid;        /* the records of the changed lines */
+    LineRecord* records;
+    SymbolList rest;        /* the symbols declared after the changed lines */
+    SymbolInfo* refs;
+    int* ranges;            /* the ranges of .ob words which may have changed */
+    int n_ranges;
+    int n_old;
+    int i_mid;              /* the first changed line */
+    int n_same_end;         /* the number of unchanged lines at the end */
+    int n_old_mid;
+    int n_new_mid;
+    int code_at = 0, data_at = 0, sym_at = 0, ref_at = 0;  /* the prefix sums up to the first changed line */
+    int n_old_code = 0, n_old_data = 0, n_old_syms = 0, n_old_refs = 0;
+    int n_new_code = 0, n_new_data = 0, n_new_refs = 0;
+    int n_end_refs;
+    int code_delta;
+    int data_delta;
+    int line_delta;
+    int i;
+    unsigned int ic;
+    unsigned int dc;
+    int n_syms;
+    int i_ref;
+
+    reset_counters();
+    memset(&file->stats, 0, sizeof(IncrementalStats));
+    if (!file->is_valid) {
+        free_incremental(file);
+    }
+    n_old = file->n_records;
+
+    /* The changed lines are the ones between the longest common prefix and suffix of the two versions */
+    i_mid = 0;
+    while (i_mid < n_old && i_mid < n_texts && _is_same_line(&file->records[i_mid], texts[i_mid])) {
+        i_mid++;
+    }
+    n_same_end = 0;
+    while (n_same_end < n_old - i_mid && n_same_end < n_texts - i_mid &&
+           _is_same_line(&file->records[n_old - 1 - n_same_end], texts[n_texts - 1 - n_same_end])) {
+        n_same_end++;
+    }
+    n_old_mid = n_old - i_mid - n_same_end;
+    n_new_mid = n_texts - i_mid - n_same_end;
+
+    /* Pre-processing stage, for the changed lines only */
+    set_incbin_source(input_path);
+    mid = (LineRecord*)calloc(n_new_mid + 1, sizeof(LineRecord));
+    if (mid == NULL) {
+        report_error(DIAG_MEMORY, 0, "Failed to allocate memory for parsing input lines");
+    }
+    for (i = 0; mid != NULL && i < n_new_mid && !diag_limit_reached(); i++) {
+        line_num = i_mid + i + 1;
+        mid[i].text = texts[i_mid + i];
+        texts[i_mid + i] = NULL;
+        mid[i].hash = hash_str(mid[i].text);
+        strcpy(buf, mid[i].text);
+        mid[i].parsed_line = parse_line(line_num, buf);
+        if (mid[i].parsed_line == NULL) {
+            continue;
+        }
+        if (is_include_directive(mid[i].parsed_line) || is_incbin_directive(mid[i].parsed_line) ||
+            _is_equ_or_space(mid[i].parsed_line)) {
+            _free_records(mid, n_new_mid);
+            free(mid);
+            _free_texts(texts, n_texts);
+            free_incremental(file);
+            reset_diagnostics();
+            set_incbin_source(NULL);
+            return -1;
+        }
+        mid[i].is_entry = mid[i].parsed_line->directive != NULL && strcmp(mid[i].parsed_line->directive, ".entry") == 0;
+        n_new_code += get_num_code_words(mid[i].parsed_line);
+        n_new_data += get_num_data_words(mid[i].parsed_line);
+        n_new_refs += get_num_symbol_refs(mid[i].parsed_line);
+    }
+    set_incbin_source(NULL);
+    file->stats.n_reparsed = n_new_mid;
+    fprintf(status_stream(), "\n>>> \'%s\'\n\n", input_path);
+
+    if (n_errors) {
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** Syntax checker found %i errors. Skipping file. ***\n", n_errors);
+        if (mid != NULL) {
+            _free_records(mid, n_new_mid);
+        }
+        free(mid);
+        _free_texts(texts, n_texts);
+        free_incremental(file);
+        return n_errors;
+    }
+
+    /* Prefix sums of the unchanged lines before the changed ones, and the totals of the lines they replace */
+    for (i = 0; i < i_mid; i++) {
+        code_at += file->records[i].n_code_words;
+        data_at += file->records[i].n_data_words;
+        sym_at += file->records[i].n_symbols;
+        ref_at += file->records[i].n_symbol_refs;
+    }
+    for (i = i_mid; i < i_mid + n_old_mid; i++) {
+        n_old_code += file->records[i].n_code_words;
+        n_old_data += file->records[i].n_data_words;
+        n_old_syms += file->records[i].n_symbols;
+        n_old_refs += file->records[i].n_symbol_refs;
+    }
+    n_end_refs = file->n_symbol_refs - ref_at - n_old_refs;
+    code_delta = n_new_code - n_old_code;
+    data_delta = n_new_data - n_old_data;
+    line_delta = n_texts - n_old;
+
+    /* Allocate memory: the records and symbol references of the unchanged lines at the end are moved later */
+    records = (LineRecord*)realloc(file->records, sizeof(LineRecord) * ((n_old > n_texts ? n_old : n_texts) + 1));
+    if (records != NULL) {
+        file->records = records;
+    }
+    refs = (SymbolInfo*)realloc(file->symbol_refs, sizeof(SymbolInfo) * (file->n_symbol_refs + n_new_refs + 1));
+    if (refs != NULL) {
+        file->symbol_refs = refs;
+    }
+    ranges = (int*)malloc(sizeof(int) * 2 * (file->n_symbol_refs + n_new_refs + 2));
+    if (records == NULL || refs == NULL || ranges == NULL ||
+        !splice_images(&file->image, code_at, n_old_code, n_new_code, data_at, n_old_data, n_new_data)) {
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** Memory allocation error. Skipping file. ***.\n");
+        _free_records(mid, n_new_mid);
+        free(mid);
+        free(ranges);
+        _free_texts(texts, n_texts);
+        free_incremental(file);
+        return 1;
+    }
+
+    for (i = ref_at; i < ref_at + n_old_refs; i++) {
+        free(refs[i].label);
+    }
+    memmove(refs + ref_at + n_new_refs, refs + ref_at + n_old_refs, sizeof(SymbolInfo) * n_end_refs);
+    symbol_references = refs;
+    i_symbol_ref = ref_at;
+    file->symbol_refs = NULL;
+    file->n_symbol_refs = 0;
+    resume_symbol_table(&file->symbols, sym_at, n_old_syms, file->image.IC, &rest);
+
+    /* First pass over the changed lines (their words go where the replaced lines' words were) */
+    for (i = 0; i < n_new_mid; i++) {
+        if (mid[i].parsed_line == NULL) {
+            continue;
+        }
+        ic = get_IC();
+        dc = get_DC();
+        n_syms = get_n_symbols();
+        i_ref = i_symbol_ref;
+        first_pass_line(mid[i].parsed_line);
+        mid[i].n_code_words = get_IC() - ic;
+        mid[i].n_data_words = get_DC() - dc;
+        mid[i].n_symbols = get_n_symbols() - n_syms;
+        mid[i].n_symbol_refs = i_symbol_ref - i_ref;
+    }
+
+    /* The lines after them are shifted by the difference in words and lines */
+    offset_symbols(&rest, code_delta, data_delta, line_delta);
+    append_symbols(&rest);
+    i_symbol_ref = ref_at + n_new_refs + n_end_refs;
+    if (code_delta != 0 || line_delta != 0) {
+        for (i = ref_at + n_new_refs; i < i_symbol_ref; i++) {
+            symbol_references[i].IC += code_delta;
+            symbol_references[i].line_num += line_delta;
+        }
+    }
+    seek_counters(file->image.IC + code_delta, file->image.DC + data_delta, 0);
+    shift_data_addresses();
+
+    _free_records(file->records + i_mid, n_old_mid);
+    memmove(records + i_mid + n_new_mid, records + i_mid + n_old_mid, sizeof(LineRecord) * n_same_end);
+    memcpy(records + i_mid, mid, sizeof(LineRecord) * n_new_mid);
+    free(mid);
+    file->n_records = n_texts;
+    if (line_delta != 0) {
+        for (i = i_mid + n_new_mid; i < n_texts; i++) {
+            if (records[i].parsed_line != NULL) {
+                records[i].parsed_line->line_num += line_delta;
+            }
+        }
+    }
+    _free_texts(texts, n_texts);
+
+    if (n_errors) {
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** %i errors found in first pass. Skipping file. ***\n", n_errors);
+        free(ranges);
+        free_memory();
+        free_incremental(file);
+        return n_errors;
+    }
+
+    /* Second pass: the 'entry' attributes, and then only the symbol references whose operand word may have changed */
+    for (i = 0; i < n_texts; i++) {
+        if (records[i].is_entry) {
+            line_num = i + 1;
+            update_entry_symbol(records[i].parsed_line->args[0]);
+        }
+    }
+    n_ranges = 0;
+    for (i = 0; i < i_symbol_ref; i++) {
+        if ((i >= ref_at && i < ref_at + n_new_refs) ||
+            _is_fixup_stale(&symbol_references[i], i >= ref_at + n_new_refs, i_mid + 1, i_mid + n_new_mid, code_delta, data_delta)) {
+            line_num = symbol_references[i].line_num;
+            line_source = symbol_references[i].source;
+            edit_operand(symbol_references[i].IC, symbol_references[i].label, symbol_references[i].addrMode);
+            ranges[2 * n_ranges] = symbol_references[i].IC - MEM_START_ADDRESS;
+            ranges[2 * n_ranges + 1] = symbol_references[i].IC - MEM_START_ADDRESS + 1;
+            n_ranges++;
+        }
+    }
+    file->stats.n_fixups = n_ranges;
+    if (n_errors) {
+        flush_diagnostics(input_path);
+        fprintf(status_stream(), "*** %i errors found in second pass. Skipping file. ***\n", n_errors);
+        free(ranges);
+        free_memory();
+        free_incremental(file);
+        return n_errors;
+    }
+
+    /* The words of the changed lines, and if the number of words changed, all the words after them */
+    if (code_delta != 0 || data_delta != 0) {
+        ranges[2 * n_ranges] = code_at;
+        ranges[2 * n_ranges + 1] = get_IC() - MEM_START_ADDRESS + get_DC();
+        n_ranges++;
+    }
+    else {
+        ranges[2 * n_ranges] = code_at;
+        ranges[2 * n_ranges + 1] = code_at + n_new_code;
+        ranges[2 * n_ranges + 2] = get_IC() - MEM_START_ADDRESS + data_at;
+        ranges[2 * n_ranges + 3] = get_IC() - MEM_START_ADDRESS + data_at + n_new_data;
+        n_ranges += 2;
+    }
+
+    flush_diagnostics(input_path); /* warnings */
+    if (options.emit_stdout != EMIT_FILES) {
+        create_output_files(input_arg);
+        free(file->words);
+        file->words = NULL;
+        file->n_words = 0;
+    }
+    else {
+        _create_object_file(file, input_arg, ranges, n_ranges);
+        create_symbol_files(input_arg);
+    }
+    flush_diagnostics(input_path);
+    free(ranges);
+    _retain_state(file);
+    return 0;
+}
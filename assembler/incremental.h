@@ -0,0 +1,73 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "assembler.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+
+/* Every line of the .ob file (including the header) is this long */
+#define OB_LINE_LEN 15
+
+/* Largest address that still fits in an .ob line */
+#define OB_MAX_ADDRESS 9999999
+
+/*
+ * LineRecord:
+ * The results of a source line in the last run of a file, reused as long as the line doesn't change.
+ * The IC/DC (and the index of its first symbol and symbol reference) of a line aren't stored,
+ * they are the prefix sums of the counts of the lines before it
+ */
+typedef struct LineRecord {
+    char* text;
+    unsigned int hash;         /* of the text */
+    ParsedLine* parsed_line;   /* NULL for blank lines and comments */
+    int is_entry;              /* an .entry directive */
+    int n_code_words;
+    int n_data_words;
+    int n_symbols;             /* symbols it declared */
+    int n_symbol_refs;         /* symbol references (fixups) in it */
+} LineRecord;
+
+/*
+ * IncrementalStats:
+ * How much work the last run of a file took
+ */
+typedef struct IncrementalStats {
+    int n_reparsed;    /* source lines */
+    int n_fixups;      /* symbol references resolved */
+    int n_ob_lines;    /* lines (re)written to the .ob file */
+} IncrementalStats;
+
+/*
+ * IncrementalFile:
+ * The state of a file kept between runs, from which a new version of the file is reassembled
+ * by re-parsing and re-encoding only the lines that changed: the addresses after them are shifted
+ * by the difference in the number of words, only the symbol references whose target moved are resolved again,
+ * and only the lines of the .ob file that changed are rewritten.
+ * (Warnings of lines that didn't change are not reported again)
+ */
+typedef struct IncrementalFile {
+    int is_valid;              /* whether the fields below hold the state of the last successful run */
+    int n_records;
+    LineRecord* records;       /* one per source line */
+    MachineImage image;
+    SymbolList symbols;
+    SymbolInfo* symbol_refs;
+    int n_symbol_refs;
+    int n_words;
+    int* words;                /* the encoded words in the .ob file (NULL if it wasn't written) */
+    IncrementalStats stats;
+} IncrementalFile;
+
+/*
+ * Reassembles a file from the source lines of its new version (taking over the 'texts' array),
+ * reusing the state of the last run. Files including other files (.include/.incbin), defining constants (.equ) or
+ * reserving space (.space) are not supported.
+ * Returns the number of errors found, or -1 if the file is one of those (nothing was done then)
+ */
+int reassemble_incremental(IncrementalFile* file, char* input_arg, char* input_path, char** texts, int n_texts);
+
+/* Frees the state of a file (its next run will be a full one) */
+void free_incremental(IncrementalFile* file);
+
+#endif
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "json.h"
+
+/* Deepest nesting of arrays/objects accepted (the parser is recursive) */
+#define JSON_MAX_DEPTH 64
+
+/* Initial size of the text of a JsonWriter (doubled whenever it's exceeded) */
+#define JSON_WRITER_INITIAL_SIZE 256
+
+JsonValue* _parse_value(char** ptr, int depth);
+
+/* Skips whitespace */
+void _skip_ws(char** ptr) {
+    while (**ptr == ' ' || **ptr == '\t' || **ptr == '\n' || **ptr == '\r') {
+        (*ptr)++;
+    }
+}
+
+/* Creates a value of the given type */
+JsonValue* _new_value(JsonType type) {
+    JsonValue* value = (JsonValue*)calloc(1, sizeof(JsonValue));
+    if (value != NULL) {
+        value->type = type;
+    }
+    return value;
+}
+
+/* Value of a hex digit (-1 if not a hex digit) */
+int _hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Reads the 4 hex digits of a \u escape. Returns -1 if they are invalid */
+long _parse_hex4(char* str) {
+    long code = 0;
+    int i;
+    int digit;
+    for (i = 0; i < 4; i++) {
+        digit = _hex_digit(str[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        code = code * 16 + digit;
+    }
+    return code;
+}
+
+/* Writes a code point as UTF-8. Returns the number of chars written */
+int _write_utf8(char* out, long code) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+/* Parses a string literal (the pointer is at the opening quote). Returns NULL if it's invalid */
+char* _parse_string(char** ptr) {
+    char* str;
+    char* out;
+    char* in;
+    long code;
+    long low;
+
+    in = *ptr + 1;
+    /* (the unescaped string is never longer than the literal) */
+    str = (char*)malloc(strlen(in) + 1);
+    if (str == NULL) {
+        return NULL;
+    }
+    out = str;
+    while (*in != '"') {
+        if (*in == '\0' || (unsigned char)*in < 0x20) {
+            free(str);
+            return NULL;
+        }
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in) {
+            case '"': case '\\': case '/': *out++ = *in; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                code = _parse_hex4(in + 1);
+                if (code < 0) {
+                    free(str);
+                    return NULL;
+                }
+                in += 4;
+                if (code >= 0xD800 && code < 0xDC00 && in[1] == '\\' && in[2] == 'u') { /* a surrogate pair */
+                    low = _parse_hex4(in + 3);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        in += 6;
+                    }
+                }
+                out += _write_utf8(out, code);
+                break;
+            default:
+                free(str);
+                return NULL;
+        }
+        in++;
+    }
+    *out = '\0';
+    *ptr = in + 1;
+    return str;
+}
+
+/* Parses the elements of an array or the members of an object (the pointer is at the opening bracket) */
+JsonValue* _parse_children(char** ptr, JsonValue* value, char close, int depth) {
+    JsonValue* child;
+    JsonValue* last = NULL;
+    char* key;
+
+    (*ptr)++;
+    _skip_ws(ptr);
+    if (**ptr == close) {
+        (*ptr)++;
+        return value;
+    }
+    while (1) {
+        key = NULL;
+        if (close == '}') {
+            if (**ptr != '"' || (key = _parse_string(ptr)) == NULL) {
+                break;
+            }
+            _skip_ws(ptr);
+            if (**ptr != ':') {
+                free(key);
+                break;
+            }
+            (*ptr)++;
+        }
+        child = _parse_value(ptr, depth + 1);
+        if (child == NULL) {
+            free(key);
+            break;
+        }
+        child->key = key;
+        if (last == NULL) {
+            value->children = child;
+        }
+        else {
+            last->next = child;
+        }
+        last = child;
+
+        _skip_ws(ptr);
+        if (**ptr == close) {
+            (*ptr)++;
+            return value;
+        }
+        if (**ptr != ',') {
+            break;
+        }
+        (*ptr)++;
+        _skip_ws(ptr);
+    }
+    free_json(value);
+    return NULL;
+}
+
+/* Parses a value (and the whitespace before it). Returns NULL if it's invalid */
+JsonValue* _parse_value(char** ptr, int depth) {
+    JsonValue* value;
+    char* end;
+
+    _skip_ws(ptr);
+    if (depth > JSON_MAX_DEPTH) {
+        return NULL;
+    }
+    switch (**ptr) {
+        case '{':
+        case '[':
+            value = _new_value(**ptr == '{' ? JSON_OBJECT : JSON_ARRAY);
+            if (value == NULL) {
+                return NULL;
+            }
+            return _parse_children(ptr, value, **ptr == '{' ? '}' : ']', depth);
+        case '"':
+            value = _new_value(JSON_STRING);
+            if (value != NULL && (value->string = _parse_string(ptr)) == NULL) {
+                free(value);
+                return NULL;
+            }
+            return value;
+        case 't':
+        case 'f':
+        case 'n':
+            if (strncmp(*ptr, "true", 4) == 0 || strncmp(*ptr, "null", 4) == 0 || strncmp(*ptr, "false", 5) == 0) {
+                value = _new_value(**ptr == 'n' ? JSON_NULL : JSON_BOOL);
+                if (value != NULL) {
+                    value->number = **ptr == 't';
+                }
+                *ptr += **ptr == 'f' ? 5 : 4;
+                return value;
+            }
+            return NULL;
+        default:
+            if (**ptr != '-' && !isdigit((unsigned char)**ptr)) {
+                return NULL;
+            }
+            value = _new_value(JSON_NUMBER);
+            if (value != NULL) {
+                value->number = strtod(*ptr, &end);
+                *ptr = end;
+            }
+            return value;
+    }
+}
+
+/* Parses a JSON text. Returns NULL if it's invalid (remember to free_json when done) */
+JsonValue* parse_json(char* text) {
+    JsonValue* value;
+    char* ptr = text;
+
+    value = _parse_value(&ptr, 0);
+    if (value == NULL) {
+        return NULL;
+    }
+    _skip_ws(&ptr);
+    if (*ptr != '\0') { /* trailing garbage */
+        free_json(value);
+        return NULL;
+    }
+    return value;
+}
+
+/* Frees a parsed JSON value */
+void free_json(JsonValue* value) {
+    JsonValue* child;
+    JsonValue* next;
+    if (value == NULL) {
+        return;
+    }
+    for (child = value->children; child != NULL; child = next) {
+        next = child->next;
+        free_json(child);
+    }
+    free(value->key);
+    free(value->string);
+    free(value);
+}
+
+/* The member of an object with the given name (NULL if the value is not an object or has no such member) */
+JsonValue* json_get(JsonValue* object, char* key) {
+    JsonValue* member;
+    if (object == NULL || object->type != JSON_OBJECT) {
+        return NULL;
+    }
+    for (member = object->children; member != NULL; member = member->next) {
+        if (strcmp(member->key, key) == 0) {
+            return member;
+        }
+    }
+    return NULL;
+}
+
+/* The string member of an object (NULL if missing or not a string) */
+char* json_get_str(JsonValue* object, char* key) {
+    JsonValue* member = json_get(object, key);
+    return member != NULL && member->type == JSON_STRING ? member->string : NULL;
+}
+
+/* The number member of an object as an int ('fallback' if missing or not a number) */
+int json_get_int(JsonValue* object, char* key, int fallback) {
+    JsonValue* member = json_get(object, key);
+    return member != NULL && member->type == JSON_NUMBER ? (int)member->number : fallback;
+}
+
+/* Writes a str as a quoted JSON string (escaped as needed) to 'buf', which must have room for 6 times its length + 3.
+ * Returns the number of chars written */
+int write_json_str(char* buf, char* str) {
+    char* out = buf;
+    *out++ = '"';
+    for (; str != NULL && *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            *out++ = '\\';
+            *out++ = *str;
+        }
+        else if ((unsigned char)*str < 0x20) {
+            out += sprintf(out, "\\u%04x", (unsigned char)*str);
+        }
+        else {
+            *out++ = *str;
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+    return out - buf;
+}
+
+/* Makes sure a writer has room for 'n' more chars (and the terminating '\0') */
+int _reserve(JsonWriter* writer, size_t n) {
+    char* data;
+    size_t capacity;
+    if (writer->failed) {
+        return 0;
+    }
+    if (writer->len + n + 1 <= writer->capacity) {
+        return 1;
+    }
+    capacity = writer->capacity > 0 ? writer->capacity : JSON_WRITER_INITIAL_SIZE;
+    while (capacity < writer->len + n + 1) {
+        capacity *= 2;
+    }
+    data = (char*)realloc(writer->data, capacity);
+    if (data == NULL) {
+        writer->failed = 1;
+        return 0;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return 1;
+}
+
+/* Appends raw text to a writer */
+void json_append(JsonWriter* writer, char* text) {
+    size_t len = strlen(text);
+    if (_reserve(writer, len)) {
+        memcpy(writer->data + writer->len, text, len + 1);
+        writer->len += len;
+    }
+}
+
+/* Appends a str to a writer as a quoted JSON string */
+void json_append_str(JsonWriter* writer, char* str) {
+    if (_reserve(writer, 6 * (str != NULL ? strlen(str) : 0) + 2)) {
+        writer->len += write_json_str(writer->data + writer->len, str);
+    }
+}
+
+/* Appends an int to a writer */
+void json_append_int(JsonWriter* writer, int n) {
+    char buf[32];
+    sprintf(buf, "%i", n);
+    json_append(writer, buf);
+}
+
+/* Frees the text of a writer (it can then be reused) */
+void json_free_writer(JsonWriter* writer) {
+    free(writer->data);
+    writer->data = NULL;
+    writer->len = 0;
+    writer->capacity = 0;
+    writer->failed = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+
+/*!
+ * JsonType:
+ *  The type of a JSON value
+ */
+typedef enum JsonType {
+    JSON_NULL = 0,
+    JSON_BOOL = 1,
+    JSON_NUMBER = 2,
+    JSON_STRING = 3,
+    JSON_ARRAY = 4,
+    JSON_OBJECT = 5
+} JsonType;
+
+/*!
+ * JsonValue:
+ *  A parsed JSON value. The elements of an array (or members of an object) are a linked list
+ */
+typedef struct JsonValue {
+    JsonType type;
+    char* key;       /* the member name (if it's a member of an object) */
+    char* string;    /* JSON_STRING */
+    double number;   /* JSON_NUMBER, and JSON_BOOL (1 or 0) */
+    struct JsonValue* children;  /* the first element/member (JSON_ARRAY/JSON_OBJECT) */
+    struct JsonValue* next;
+} JsonValue;
+
+/*!
+ * JsonWriter:
+ *  A growing buffer that a JSON text is written into (always '\0' terminated)
+ */
+typedef struct JsonWriter {
+    char* data;
+    size_t len;
+    size_t capacity;
+    int failed;  /* an allocation failed (the text is incomplete) */
+} JsonWriter;
+
+/* Parses a JSON text. Returns NULL if it's invalid (remember to free_json when done) */
+JsonValue* parse_json(char* text);
+
+/* Frees a parsed JSON value */
+void free_json(JsonValue* value);
+
+/* The member of an object with the given name (NULL if the value is not an object or has no such member) */
+JsonValue* json_get(JsonValue* object, char* key);
+
+/* The string member of an object (NULL if missing or not a string) */
+char* json_get_str(JsonValue* object, char* key);
+
+/* The number member of an object as an int ('fallback' if missing or not a number) */
+int json_get_int(JsonValue* object, char* key, int fallback);
+
+/* Writes a str as a quoted JSON string (escaped as needed) to 'buf', which must have room for 6 times its length + 3.
+ * Returns the number of chars written */
+int write_json_str(char* buf, char* str);
+
+/* Appends raw text to a writer */
+void json_append(JsonWriter* writer, char* text);
+
+/* Appends a str to a writer as a quoted JSON string */
+void json_append_str(JsonWriter* writer, char* str);
+
+/* Appends an int to a writer */
+void json_append_int(JsonWriter* writer, int n);
+
+/* Frees the text of a writer (it can then be reused) */
+void json_free_writer(JsonWriter* writer);
+
+#endif
@@ -0,0 +1,199 @@
+#define _POSIX_C_SOURCE 200809L /* for fmemopen() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libassembler.h"
+#include "assembler.h"
+#include "parser.h"
+#include "passes.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+#include "include_cache.h"
+#include "incbin.h"
+#include "diagnostics.h"
+
+/* What an asm_assemble source is called in the include cache (its includes are relative to the current directory) */
+#define BUFFER_PATH "<buffer>"
+
+int _preprocess_buffer(const char* source, size_t len);
+int _collect_result(AsmResult* result);
+void _free_state();
+
+/*
+ * Assembles a source buffer in memory (see libassembler.h).
+ * The state of the assembler (the globals of assembler.c and the other modules) is thread-local in the library,
+ * so each thread does its assembly on its own, the same way assemble_file does it for a file
+ */
+int asm_assemble(const char* source, size_t len, AsmResult* result) {
+    int rc;
+
+    memset(result, 0, sizeof(AsmResult));
+    options.jobs = 1; /* (the passes run in the calling thread) */
+    options.max_retained_mb = 0; /* (nothing is kept after the call) */
+    set_max_errors(0);
+    reset_counters();
+
+    /* Pre-processing stage, then the 2 passes (if there are no errors so far) */
+    if (!_preprocess_buffer(source, len)) {
+        report_error(DIAG_MEMORY, 0, "Unable to read the source buffer");
+    }
+    else if (!n_errors) {
+        if (!init_code_image(n_code_words) ||
+            !init_data_image(n_data_words) ||
+            !init_word_types(n_code_words + n_data_words) ||
+            !init_symbol_refs()) {
+            report_error(DIAG_MEMORY, 0, "Memory allocation error");
+        }
+        else {
+            first_pass();
+            if (!n_errors) {
+                second_pass();
+            }
+        }
+    }
+
+    rc = _collect_result(result) ? n_errors : -1;
+    _free_state();
+    return rc;
+}
+
+/* Frees what asm_assemble put in 'result' */
+void asm_free_result(AsmResult* result) {
+    free(result->arena);
+    memset(result, 0, sizeof(AsmResult));
+}
+
+/* Parses the lines of the source buffer into parsed_lines (expanding the includes), like assemble_file does.
+ * Returns 1 if success, 0 if the buffer couldn't be read */
+int _preprocess_buffer(const char* source, size_t len) {
+    FILE* fp;
+    ParsedLine* parsed_line;
+    char buf[LINE_LEN];
+
+    fp = fmemopen((void*)source, len, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    while (!diag_limit_reached() && fgets(buf, sizeof(buf), fp) != NULL) {
+        line_num++;
+        parsed_line = parse_line(line_num, buf);
+        if (parsed_line == NULL) {
+            continue;
+        }
+        if (is_include_directive(parsed_line)) {
+            expand_include(BUFFER_PATH, parsed_line, register_parsed_line);
+            free_parsed_line(parsed_line);
+        }
+        else {
+            register_parsed_line(parsed_line);
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+/*
+ * Copies the images, the external references, the entry symbols and the diagnostics into one block
+ * (the structs first, then the words, then the strings, so that each is aligned).
+ * Returns 1 if success, 0 if out of memory
+ */
+int _collect_result(AsmResult* result) {
+    Diagnostic* diagnostics;
+    Symbol* symbol;
+    size_t size;
+    char* block;
+    char* strings;
+    int n_code;
+    int n_data;
+    int i;
+
+    n_code = n_errors ? 0 : (int)(get_IC() - MEM_START_ADDRESS);
+    n_data = n_errors ? 0 : (int)get_DC();
+    result->n_space_words = n_errors ? 0 : (int)get_SC();
+    diagnostics = get_diagnostics();
+
+    /* Count and measure everything first: */
+    result->n_diagnostics = get_n_diagnostics();
+    size = sizeof(AsmDiagnostic) * result->n_diagnostics + sizeof(int) * (n_code + n_data);
+    for (i = 0; i < result->n_diagnostics; i++) {
+        size += strlen(diagnostics[i].message) + 1;
+        size += diagnostics[i].source != NULL ? strlen(diagnostics[i].source) + 1 : 0;
+    }
+    for (i = 0; !n_errors && i < i_symbol_ref; i++) {
+        symbol = find_symbol(symbol_references[i].label);
+        if (symbol != NULL && symbol->loc == LOC_EXTERNAL) {
+            result->n_externs++;
+            size += sizeof(AsmSymbolRef) + strlen(symbol->label) + 1;
+        }
+    }
+    for (symbol = get_first_symbol(); !n_errors && symbol != NULL; symbol = symbol->next) {
+        if (symbol->loc == LOC_ENTRY) {
+            result->n_entries++;
+            size += sizeof(AsmSymbolRef) + strlen(symbol->label) + 1;
+        }
+    }
+
+    block = (char*)malloc(size > 0 ? size : 1);
+    if (block == NULL) {
+        memset(result, 0, sizeof(AsmResult));
+        return 0;
+    }
+    result->arena = block;
+    result->n_errors = n_errors;
+    result->externs = (AsmSymbolRef*)block;
+    result->entries = result->externs + result->n_externs;
+    result->diagnostics = (AsmDiagnostic*)(result->entries + result->n_entries);
+    result->code_words = (int*)(result->diagnostics + result->n_diagnostics);
+    result->data_words = result->code_words + n_code;
+    strings = (char*)(result->data_words + n_data);
+
+    /* Then fill it in: */
+    result->n_code_words = n_code;
+    result->n_data_words = n_data;
+    for (i = 0; i < n_code + n_data; i++) {
+        result->code_words[i] = encode_word(i);
+    }
+    result->n_externs = 0;
+    for (i = 0; !n_errors && i < i_symbol_ref; i++) {
+        symbol = find_symbol(symbol_references[i].label);
+        if (symbol != NULL && symbol->loc == LOC_EXTERNAL) {
+            result->externs[result->n_externs].label = strcpy(strings, symbol->label);
+            result->externs[result->n_externs++].address = symbol_references[i].IC;
+            strings += strlen(strings) + 1;
+        }
+    }
+    result->n_entries = 0;
+    for (symbol = get_first_symbol(); !n_errors && symbol != NULL; symbol = symbol->next) {
+        if (symbol->loc == LOC_ENTRY) {
+            result->entries[result->n_entries].label = strcpy(strings, symbol->label);
+            result->entries[result->n_entries++].address = symbol->address;
+            strings += strlen(strings) + 1;
+        }
+    }
+    for (i = 0; i < result->n_diagnostics; i++) {
+        result->diagnostics[i].severity = diagnostics[i].severity == SEV_ERROR ? ASM_SEVERITY_ERROR : ASM_SEVERITY_WARNING;
+        result->diagnostics[i].line_num = diagnostics[i].line_num;
+        result->diagnostics[i].code = diagnostics[i].code;
+        result->diagnostics[i].code_name = diag_code_str(diagnostics[i].code);
+        result->diagnostics[i].message = strcpy(strings, diagnostics[i].message);
+        strings += strlen(strings) + 1;
+        result->diagnostics[i].source = NULL;
+        if (diagnostics[i].source != NULL) {
+            result->diagnostics[i].source = strcpy(strings, diagnostics[i].source);
+            strings += strlen(strings) + 1;
+        }
+    }
+    return 1;
+}
+
+/* Frees everything the calling thread allocated for the assembly (so that nothing is left when the thread exits) */
+void _free_state() {
+    release_workspace();
+    free_memory();
+    free_diagnostics();
+    free_include_cache();
+    free_incbin_cache();
+    reset_parse_memo();
+}
@@ -0,0 +1,74 @@
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include <stddef.h>
+
+/* The functions exported by libassembler.a/libassembler.so (the rest of the library is hidden) */
+#if defined(__GNUC__)
+#define ASM_API __attribute__((visibility("default")))
+#else
+#define ASM_API
+#endif
+
+/* Severities of an AsmDiagnostic */
+#define ASM_SEVERITY_WARNING 0
+#define ASM_SEVERITY_ERROR 1
+
+/*!
+ * AsmSymbolRef:
+ * An external symbol reference (a label and the address of the word referring to it),
+ * or an entry symbol (a label and the address it's declared at)
+ */
+typedef struct AsmSymbolRef {
+    char* label;
+    unsigned int address;
+} AsmSymbolRef;
+
+/*!
+ * AsmDiagnostic:
+ * An error or a warning found in the source
+ */
+typedef struct AsmDiagnostic {
+    int severity;          /* ASM_SEVERITY_WARNING or ASM_SEVERITY_ERROR */
+    int line_num;          /* 0 if not related to a specific line */
+    int code;              /* stable code of the kind of problem (see DiagCode) */
+    const char* code_name; /* e.g. "undefined-symbol" */
+    char* message;
+    char* source;          /* the included file the line is in (NULL if in the source buffer itself) */
+} AsmDiagnostic;
+
+/*!
+ * AsmResult:
+ * What a source buffer was assembled into. The words are encoded as in the .ob file (24 bits each);
+ * the code words start at address 100 and the data words follow them.
+ * The images, externs and entries are only filled in if there were no errors.
+ * Everything is allocated in one block (the arena), which asm_free_result frees
+ */
+typedef struct AsmResult {
+    int n_errors;
+    int n_code_words;
+    int* code_words;
+    int n_data_words;
+    int* data_words;
+    int n_space_words;      /* the zero words reserved by .space after the data words (they aren't in data_words) */
+    int n_externs;
+    AsmSymbolRef* externs;  /* in the order of the .ext file */
+    int n_entries;
+    AsmSymbolRef* entries;  /* in the order of the .ent file */
+    int n_diagnostics;
+    AsmDiagnostic* diagnostics;
+    void* arena;
+} AsmResult;
+
+/*
+ * Assembles a source buffer of 'len' bytes (the contents of a .as file) in memory, without touching the disk
+ * (except for the files that it .include's, which are looked up relative to the current directory).
+ * It can be called from several threads at once (each assembly is done in its calling thread's own state).
+ * Returns the number of errors (0 if success), or -1 if out of memory (*result is then left empty)
+ */
+ASM_API int asm_assemble(const char* source, size_t len, AsmResult* result);
+
+/* Frees what asm_assemble put in 'result' */
+ASM_API void asm_free_result(AsmResult* result);
+
+#endif
@@ -0,0 +1,829 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lsp.h"
+#include "json.h"
+#include "parser.h"
+#include "passes.h"
+#include "machine_coder.h"
+#include "string_utils.h"
+#include "include_cache.h"
+#include "incbin.h"
+
+/* Prefix of the URIs of local files */
+#define FILE_URI_PREFIX "file://"
+
+static LspDocument* documents = NULL;
+
+/* The lines of the files included by the document being analyzed, and the line of the '.include' each came from */
+static ParsedLine** included_lines = NULL;
+static int* included_at = NULL;
+static int n_included = 0;
+static int included_capacity = 0;
+static int include_line_num = 0;
+
+char* _uri_to_path(char* uri);
+
+/*********************************** Documents ***********************************/
+
+/* Frees diagnostics taken from the sink */
+void _free_diagnostics(Diagnostic* diagnostics, int n_diagnostics) {
+    int i;
+    for (i = 0; i < n_diagnostics; i++) {
+        free(diagnostics[i].message);
+        free(diagnostics[i].source);
+    }
+    free(diagnostics);
+}
+
+/* Takes over the diagnostics recorded by the sink so far (and clears it) */
+Diagnostic* _take_diagnostics(int* n_diagnostics) {
+    Diagnostic* taken;
+    int i;
+
+    *n_diagnostics = get_n_diagnostics();
+    taken = *n_diagnostics > 0 ? (Diagnostic*)malloc(sizeof(Diagnostic) * *n_diagnostics) : NULL;
+    if (taken == NULL) {
+        *n_diagnostics = 0;
+    }
+    for (i = 0; i < *n_diagnostics; i++) {
+        taken[i] = get_diagnostics()[i];
+        taken[i].message = str_cpy(taken[i].message);
+        taken[i].source = str_cpy(taken[i].source);
+    }
+    reset_diagnostics();
+    return taken;
+}
+
+/* Frees a line of a document */
+void _free_line(LspLine* line) {
+    free(line->text);
+    if (line->parsed_line != NULL) {
+        free_parsed_line(line->parsed_line);
+    }
+    _free_diagnostics(line->diagnostics, line->n_diagnostics);
+}
+
+/* Parses a line of a document (whose line number is 'line_num') */
+void _parse_doc_line(LspLine* line, int line_num) {
+    char buf[LINE_LEN];
+    size_t len;
+
+    len = strlen(line->text);
+    if (len > LINE_LEN - 2) {
+        len = LINE_LEN - 2;
+    }
+    memcpy(buf, line->text, len);
+    strcpy(buf + len, "\n");
+    reset_diagnostics();
+    line->parsed_line = parse_line(line_num, buf);
+    line->diagnostics = _take_diagnostics(&line->n_diagnostics);
+}
+
+/* Frees the symbol index of a document */
+void _free_index(LspDocument* doc) {
+    int i;
+    free_symbol_list(&doc->symbols);
+    for (i = 0; i < doc->n_symbol_refs; i++) {
+        free(doc->symbol_refs[i].label);
+    }
+    free(doc->symbol_refs);
+    doc->symbol_refs = NULL;
+    doc->n_symbol_refs = 0;
+    _free_diagnostics(doc->diagnostics, doc->n_diagnostics);
+    doc->diagnostics = NULL;
+    doc->n_diagnostics = 0;
+}
+
+/* Finds an open document (NULL if it's not open) */
+LspDocument* _get_document(char* uri) {
+    LspDocument* doc;
+    for (doc = documents; doc != NULL && uri != NULL; doc = doc->next) {
+        if (strcmp(doc->uri, uri) == 0) {
+            return doc;
+        }
+    }
+    return NULL;
+}
+
+/* Closes a document */
+void _close_document(LspDocument* doc) {
+    LspDocument** link;
+    int i;
+
+    for (link = &documents; *link != NULL; link = &(*link)->next) {
+        if (*link == doc) {
+            *link = doc->next;
+            break;
+        }
+    }
+    for (i = 0; i < doc->n_lines; i++) {
+        _free_line(&doc->lines[i]);
+    }
+    free(doc->lines);
+    _free_index(doc);
+    free(doc->uri);
+    free(doc);
+}
+
+/*
+ * Replaces lines 'first'..'last' of a document with the lines of 'text', which goes between column 'start'
+ * of line 'first' and column 'end' of line 'last' (no lines are replaced if 'last' < 'first').
+ * Only the new lines are parsed. Returns 1 if success, 0 if failure
+ */
+int _replace_lines(LspDocument* doc, int first, int start, int last, int end, char* text) {
+    char* joined;
+    char* piece;
+    char* newline;
+    char* path;
+    char* prefix = "";
+    char* suffix = "";
+    LspLine* lines;
+    int n_removed;
+    int n_added;
+    int i;
+
+    n_removed = last >= first ? last - first + 1 : 0;
+    if (n_removed > 0) {
+        prefix = doc->lines[first].text;
+        suffix = doc->lines[last].text + end;
+    }
+    joined = (char*)malloc(start + strlen(text) + strlen(suffix) + 1);
+    if (joined == NULL) {
+        return 0;
+    }
+    memcpy(joined, prefix, start);
+    strcpy(joined + start, text);
+    strcat(joined, suffix);
+
+    n_added = 1;
+    for (piece = joined; (piece = strchr(piece, '\n')) != NULL; piece++) {
+        n_added++;
+    }
+    if (doc->n_lines - n_removed + n_added > doc->capacity) {
+        lines = (LspLine*)realloc(doc->lines, sizeof(LspLine) * (doc->n_lines - n_removed + n_added + INPUT_BATCH_SIZE));
+        if (lines == NULL) {
+            free(joined);
+            return 0;
+        }
+        doc->lines = lines;
+        doc->capacity = doc->n_lines - n_removed + n_added + INPUT_BATCH_SIZE;
+    }
+
+    for (i = first; i < first + n_removed; i++) {
+        _free_line(&doc->lines[i]);
+    }
+    memmove(doc->lines + first + n_added, doc->lines + first + n_removed, sizeof(LspLine) * (doc->n_lines - first - n_removed));
+    doc->n_lines += n_added - n_removed;
+
+    /* (the '.incbin's of the document are relative to its directory) */
+    path = _uri_to_path(doc->uri);
+    set_incbin_source(path);
+    piece = joined;
+    for (i = first; i < first + n_added; i++) {
+        newline = strchr(piece, '\n');
+        if (newline != NULL) {
+            *newline = '\0';
+        }
+        if (newline != NULL && newline > piece && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        doc->lines[i].text = str_cpy(piece);
+        _parse_doc_line(&doc->lines[i], i + 1);
+        piece = newline + 1;
+    }
+    set_incbin_source(NULL);
+    free(path);
+    free(joined);
+    return 1;
+}
+
+/* Applies a change to a document: an edit of a range, or the whole new text if it has no range */
+void _apply_change(LspDocument* doc, JsonValue* change) {
+    JsonValue* range;
+    char* text;
+    int first;
+    int last;
+    int start;
+    int end;
+
+    text = json_get_str(change, "text");
+    range = json_get(change, "range");
+    if (text == NULL) {
+        return;
+    }
+    if (range == NULL) {
+        _replace_lines(doc, 0, 0, doc->n_lines - 1, doc->n_lines > 0 ? strlen(doc->lines[doc->n_lines - 1].text) : 0, text);
+        return;
+    }
+    first = json_get_int(json_get(range, "start"), "line", 0);
+    start = json_get_int(json_get(range, "start"), "character", 0);
+    last = json_get_int(json_get(range, "end"), "line", 0);
+    end = json_get_int(json_get(range, "end"), "character", 0);
+
+    /* Clamp the range to the document (positions past the end of a line are at its end) */
+    if (first >= doc->n_lines) {
+        first = doc->n_lines - 1;
+        start = doc->n_lines > 0 ? strlen(doc->lines[first].text) : 0;
+    }
+    if (last >= doc->n_lines) {
+        last = doc->n_lines - 1;
+        end = doc->n_lines > 0 ? strlen(doc->lines[last].text) : 0;
+    }
+    if (first < 0 || last < first) {
+        return;
+    }
+    if (start < 0 || start > strlen(doc->lines[first].text)) {
+        start = start < 0 ? 0 : strlen(doc->lines[first].text);
+    }
+    if (end < 0 || end > strlen(doc->lines[last].text)) {
+        end = end < 0 ? 0 : strlen(doc->lines[last].text);
+    }
+    if (first == last && end < start) {
+        return;
+    }
+    _replace_lines(doc, first, start, last, end, text);
+}
+
+/* The path of a document (for its '.include' and '.incbin' directives), decoded from a file URI */
+char* _uri_to_path(char* uri) {
+    char* path;
+    char* out;
+    char hex[3];
+
+    if (strncmp(uri, FILE_URI_PREFIX, strlen(FILE_URI_PREFIX)) == 0) {
+        uri += strlen(FILE_URI_PREFIX);
+    }
+    path = (char*)malloc(strlen(uri) + 1);
+    if (path == NULL) {
+        return NULL;
+    }
+    for (out = path; *uri; uri++) {
+        if (*uri == '%' && isxdigit((unsigned char)uri[1]) && isxdigit((unsigned char)uri[2])) {
+            hex[0] = uri[1];
+            hex[1] = uri[2];
+            hex[2] = '\0';
+            *out++ = (char)strtol(hex, NULL, 16);
+            uri += 2;
+        }
+        else {
+            *out++ = *uri;
+        }
+    }
+    *out = '\0';
+    return path;
+}
+
+/* Collects a line of an included file (a LineHandler) */
+int _collect_included(ParsedLine* parsed_line) {
+    ParsedLine** lines;
+    int* at;
+    if (n_included == included_capacity) {
+        lines = (ParsedLine**)realloc(included_lines, sizeof(ParsedLine*) * (included_capacity + INPUT_BATCH_SIZE));
+        if (lines != NULL) {
+            included_lines = lines;
+        }
+        at = (int*)realloc(included_at, sizeof(int) * (included_capacity + INPUT_BATCH_SIZE));
+        if (at != NULL) {
+            included_at = at;
+        }
+        if (lines == NULL || at == NULL) {
+            report_error(DIAG_MEMORY, line_num, "Failed to allocate memory for included lines");
+            return 0;
+        }
+        included_capacity += INPUT_BATCH_SIZE;
+    }
+    included_lines[n_included] = parsed_line;
+    included_at[n_included++] = include_line_num;
+    return 1;
+}
+
+/* The first pass over a line of an included file (its symbols and references are attributed to the '.include' line) */
+void _first_pass_included(ParsedLine* parsed_line) {
+    if (parsed_line->op != NULL) {
+        handle_op(parsed_line);
+    }
+    else if (parsed_line->directive != NULL) {
+        handle_directive(parsed_line);
+    }
+}
+
+/*
+ * Rebuilds the symbol index of a document from its parsed lines: both passes are run over them
+ * (skipping the lines with syntax errors), and the symbol table and symbol references are kept.
+ * (The include cache is never pruned, since the index of every open document may point into it)
+ */
+void _analyze(LspDocument* doc) {
+    ParsedLine* parsed_line;
+    char* path;
+    int i;
+    int i_included;
+
+    _free_index(doc);
+    reset_counters();
+    n_included = 0;
+    path = _uri_to_path(doc->uri);
+
+    /* Expand the includes, and count how much to allocate */
+    for (i = 0; i < doc->n_lines; i++) {
+        parsed_line = doc->lines[i].parsed_line;
+        if (parsed_line == NULL) {
+            continue;
+        }
+        parsed_line->line_num = i + 1;
+        if (is_include_directive(parsed_line)) {
+            line_num = i + 1;
+            include_line_num = i + 1;
+            if (path != NULL) {
+                expand_include(path, parsed_line, _collect_included);
+            }
+            continue;
+        }
+        n_code_words += get_num_code_words(parsed_line);
+        n_data_words += get_num_data_words(parsed_line);
+        n_symbol_refs += get_num_symbol_refs(parsed_line);
+    }
+    for (i = 0; i < n_included; i++) {
+        n_code_words += get_num_code_words(included_lines[i]);
+        n_data_words += get_num_data_words(included_lines[i]);
+        n_symbol_refs += get_num_symbol_refs(included_lines[i]);
+    }
+    free(path);
+
+    symbol_references = (SymbolInfo*)malloc(sizeof(SymbolInfo) * (n_symbol_refs + 1));
+    if (symbol_references == NULL ||
+        !init_code_image(n_code_words + 1) ||
+        !init_data_image(n_data_words + 1) ||
+        !init_word_types(n_code_words + n_data_words + 1)) {
+        report_error(DIAG_MEMORY, 0, "Failed to allocate memory for the symbol index");
+        doc->diagnostics = _take_diagnostics(&doc->n_diagnostics);
+        free(symbol_references);
+        symbol_references = NULL;
+        free_mc_memory();
+        return;
+    }
+
+    /* First pass */
+    i_included = 0;
+    for (i = 0; i < doc->n_lines; i++) {
+        parsed_line = doc->lines[i].parsed_line;
+        if (parsed_line == NULL) {
+            continue;
+        }
+        if (is_include_directive(parsed_line)) {
+            line_num = i + 1;
+            for (; i_included < n_included && included_at[i_included] == i + 1; i_included++) {
+                _first_pass_included(included_lines[i_included]);
+            }
+        }
+        else {
+            first_pass_line(parsed_line);
+        }
+    }
+    shift_data_addresses();
+
+    /* Second pass */
+    for (i = 0; i < doc->n_lines; i++) {
+        parsed_line = doc->lines[i].parsed_line;
+        if (parsed_line != NULL && parsed_line->directive != NULL && strcmp(parsed_line->directive, ".entry") == 0) {
+            line_num = i + 1;
+            update_entry_symbol(parsed_line->args[0]);
+        }
+    }
+    for (i = 0; i < i_symbol_ref; i++) {
+        line_num = symbol_references[i].line_num;
+        edit_operand(symbol_references[i].IC, symbol_references[i].label, symbol_references[i].addrMode);
+    }
+
+    doc->diagnostics = _take_diagnostics(&doc->n_diagnostics);
+    free_mc_memory();
+    detach_symbol_table(&doc->symbols);
+    doc->symbol_refs = symbol_references;
+    doc->n_symbol_refs = i_symbol_ref;
+    symbol_references = NULL;
+    i_symbol_ref = 0;
+    n_symbol_refs = 0;
+}
+
+
+/*********************************** Queries ***********************************/
+
+/* Returns whether a char can be part of a label */
+int _is_label_char(char c) {
+    return isalnum((unsigned char)c);
+}
+
+/* Column of the first whole-word occurrence of 'word' in 'text' from column 'from' (-1 if there is none) */
+int _find_word(char* text, char* word, int from) {
+    char* found;
+    size_t len = strlen(word);
+    for (found = strstr(text + from, word); found != NULL; found = strstr(found + 1, word)) {
+        if ((found == text || !_is_label_char(found[-1])) && !_is_label_char(found[len])) {
+            return found - text;
+        }
+    }
+    return -1;
+}
+
+/* Copies the label at a position of a document into 'label' (empty if there is none there) */
+void _label_at(LspDocument* doc, JsonValue* position, char* label) {
+    char* text;
+    int line;
+    int start;
+    int end;
+
+    label[0] = '\0';
+    line = json_get_int(position, "line", -1);
+    start = json_get_int(position, "character", -1);
+    if (line < 0 || line >= doc->n_lines || start < 0) {
+        return;
+    }
+    text = doc->lines[line].text;
+    if (start > strlen(text)) {
+        start = strlen(text);
+    }
+    end = start;
+    while (start > 0 && _is_label_char(text[start - 1])) {
+        start--;
+    }
+    while (_is_label_char(text[end])) {
+        end++;
+    }
+    if (end - start < LINE_LEN) {
+        memcpy(label, text + start, end - start);
+        label[end - start] = '\0';
+    }
+}
+
+/* Finds a symbol in the index of a document (NULL if it's not there) */
+Symbol* _find_doc_symbol(LspDocument* doc, char* label) {
+    Symbol* symbol;
+    for (symbol = doc->symbols.head; label[0] != '\0' && symbol != NULL; symbol = symbol->next) {
+        if (strcmp(symbol->label, label) == 0) {
+            return symbol;
+        }
+    }
+    return NULL;
+}
+
+/* Appends a range within a line */
+void _append_range(JsonWriter* writer, int line, int start, int end) {
+    json_append(writer, "{\"start\":{\"line\":");
+    json_append_int(writer, line);
+    json_append(writer, ",\"character\":");
+    json_append_int(writer, start);
+    json_append(writer, "},\"end\":{\"line\":");
+    json_append_int(writer, line);
+    json_append(writer, ",\"character\":");
+    json_append_int(writer, end);
+    json_append(writer, "}}");
+}
+
+/* Appends the location of a label in a line of a document (or of the whole line if the label isn't there) */
+void _append_location(JsonWriter* writer, LspDocument* doc, int line, int column, char* label) {
+    json_append(writer, "{\"uri\":");
+    json_append_str(writer, doc->uri);
+    json_append(writer, ",\"range\":");
+    if (column >= 0) {
+        _append_range(writer, line, column, column + strlen(label));
+    }
+    else {
+        _append_range(writer, line, 0, strlen(doc->lines[line].text));
+    }
+    json_append(writer, "}");
+}
+
+/* Appends the location where a symbol is declared (its label, or the name after '.extern' or '.equ') */
+void _append_declaration(JsonWriter* writer, LspDocument* doc, Symbol* symbol) {
+    int line = symbol->line_num - 1;
+    _append_location(writer, doc, line, _find_word(doc->lines[line].text, symbol->label, 0), symbol->label);
+}
+
+/* Appends the locations of all the occurrences of a label in a line (returns the number appended) */
+int _append_line_locations(JsonWriter* writer, LspDocument* doc, int line, char* label, int n_appended) {
+    int column;
+    int n = 0;
+    for (column = _find_word(doc->lines[line].text, label, 0); column >= 0;
+         column = _find_word(doc->lines[line].text, label, column + 1)) {
+        if (n_appended + n > 0) {
+            json_append(writer, ",");
+        }
+        _append_location(writer, doc, line, column, label);
+        n++;
+    }
+    return n;
+}
+
+/* textDocument/definition: where the symbol at the position is declared */
+void _definition(JsonWriter* writer, LspDocument* doc, JsonValue* params) {
+    char label[LINE_LEN];
+    Symbol* symbol;
+
+    _label_at(doc, json_get(params, "position"), label);
+    symbol = _find_doc_symbol(doc, label);
+    if (symbol == NULL || symbol->line_num < 1 || symbol->line_num > doc->n_lines) {
+        json_append(writer, "null");
+        return;
+    }
+    _append_declaration(writer, doc, symbol);
+}
+
+/* textDocument/references: the operands and the '.entry' directives referencing the symbol at the position */
+void _references(JsonWriter* writer, LspDocument* doc, JsonValue* params) {
+    char label[LINE_LEN];
+    Symbol* symbol;
+    ParsedLine* parsed_line;
+    JsonValue* include_declaration;
+    int last_line = -1;
+    int n = 0;
+    int i;
+
+    _label_at(doc, json_get(params, "position"), label);
+    symbol = _find_doc_symbol(doc, label);
+    json_append(writer, "[");
+    if (symbol != NULL) {
+        include_declaration = json_get(json_get(params, "context"), "includeDeclaration");
+        if (include_declaration != NULL && include_declaration->number && symbol->line_num <= doc->n_lines) {
+            _append_declaration(writer, doc, symbol);
+            n++;
+        }
+        for (i = 0; i < doc->n_symbol_refs; i++) { /* (in line order) */
+            if (doc->symbol_refs[i].line_num != last_line && doc->symbol_refs[i].line_num <= doc->n_lines &&
+                strcmp(doc->symbol_refs[i].label, label) == 0) {
+                last_line = doc->symbol_refs[i].line_num;
+                n += _append_line_locations(writer, doc, last_line - 1, label, n);
+            }
+        }
+        for (i = 0; i < doc->n_lines; i++) {
+            parsed_line = doc->lines[i].parsed_line;
+            if (parsed_line != NULL && parsed_line->directive != NULL && strcmp(parsed_line->directive, ".entry") == 0 &&
+                strcmp(parsed_line->args[0], label) == 0) {
+                n += _append_line_locations(writer, doc, i, label, n);
+            }
+        }
+    }
+    json_append(writer, "]");
+}
+
+/* textDocument/hover: the address (or value), type and location of the symbol at the position */
+void _hover(JsonWriter* writer, LspDocument* doc, JsonValue* params) {
+    char label[LINE_LEN];
+    char text[LINE_LEN + 128];
+    Symbol* symbol;
+
+    _label_at(doc, json_get(params, "position"), label);
+    symbol = _find_doc_symbol(doc, label);
+    if (symbol == NULL) {
+        json_append(writer, "null");
+        return;
+    }
+    if (symbol->loc == LOC_EXTERNAL) {
+        sprintf(text, "%s\ntype: %s\nlocation: %s", symbol->label, sym_type_str(symbol->type), sym_loc_str(symbol->loc));
+    }
+    else if (symbol->type == TYPE_CONST) {
+        sprintf(text, "%s\nvalue: %i\ntype: %s", symbol->label, symbol->address, sym_type_str(symbol->type));
+    }
+    else {
+        sprintf(text, "%s\naddress: %i\ntype: %s\nlocation: %s",
+                symbol->label, symbol->address, sym_type_str(symbol->type), sym_loc_str(symbol->loc));
+    }
+    json_append(writer, "{\"contents\":{\"kind\":\"plaintext\",\"value\":");
+    json_append_str(writer, text);
+    json_append(writer, "}}");
+}
+
+
+/*********************************** Protocol ***********************************/
+
+/* Reads the next message from stdin. Returns NULL at the end of the input (remember to free when done) */
+char* _read_message() {
+    char header[LSP_HEADER_LEN];
+    char* body;
+    long length = -1;
+
+    while (fgets(header, sizeof(header), stdin) != NULL) {
+        if (strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0) {
+            if (length >= 0) {
+                break;
+            }
+        }
+        else if (strncmp(header, "Content-Length:", strlen("Content-Length:")) == 0) {
+            length = strtol(header + strlen("Content-Length:"), NULL, 10);
+        }
+    }
+    if (length < 0) {
+        return NULL;
+    }
+    body = (char*)malloc(length + 1);
+    if (body == NULL) {
+        return NULL;
+    }
+    if (fread(body, 1, length, stdin) != length) {
+        free(body);
+        return NULL;
+    }
+    body[length] = '\0';
+    return body;
+}
+
+/* Sends a message to stdout (and clears the writer) */
+void _send(JsonWriter* writer) {
+    if (!writer->failed) {
+        printf("Content-Length: %lu\r\n\r\n", (unsigned long)writer->len);
+        fwrite(writer->data, 1, writer->len, stdout);
+        fflush(stdout);
+    }
+    json_free_writer(writer);
+}
+
+/* Starts the response to a request (the result is appended next, and then the closing brace) */
+void _begin_response(JsonWriter* writer, JsonValue* id) {
+    json_append(writer, "{\"jsonrpc\":\"2.0\",\"id\":");
+    if (id->type == JSON_NUMBER) {
+        json_append_int(writer, (int)id->number);
+    }
+    else {
+        json_append_str(writer, id->string);
+    }
+    json_append(writer, ",\"result\":");
+}
+
+/* Appends a diagnostic of a line of a document */
+void _append_diagnostic(JsonWriter* writer, LspDocument* doc, Diagnostic* diagnostic, int line) {
+    if (line < 0 || line >= doc->n_lines) {
+        line = 0;
+    }
+    json_append(writer, "{\"range\":");
+    _append_range(writer, line, 0, doc->n_lines > 0 ? strlen(doc->lines[line].text) : 0);
+    json_append(writer, ",\"severity\":");
+    json_append_int(writer, diagnostic->severity == SEV_ERROR ? 1 : 2);
+    json_append(writer, ",\"code\":");
+    json_append_str(writer, diag_code_str(diagnostic->code));
+    json_append(writer, ",\"source\":\"assembler\",\"message\":");
+    json_append_str(writer, diagnostic->message);
+    json_append(writer, "}");
+}
+
+/* Sends the diagnostics of a document (none if it's closed) */
+void _publish_diagnostics(char* uri, LspDocument* doc) {
+    JsonWriter writer = {NULL, 0, 0, 0};
+    int i;
+    int j;
+    int n = 0;
+
+    json_append(&writer, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    json_append_str(&writer, uri);
+    json_append(&writer, ",\"diagnostics\":[");
+    for (i = 0; doc != NULL && i < doc->n_lines; i++) {
+        for (j = 0; j < doc->lines[i].n_diagnostics; j++) {
+            json_append(&writer, n++ > 0 ? "," : "");
+            _append_diagnostic(&writer, doc, &doc->lines[i].diagnostics[j], i);
+        }
+    }
+    for (i = 0; doc != NULL && i < doc->n_diagnostics; i++) {
+        json_append(&writer, n++ > 0 ? "," : "");
+        _append_diagnostic(&writer, doc, &doc->diagnostics[i], doc->diagnostics[i].line_num - 1);
+    }
+    json_append(&writer, "]}}");
+    _send(&writer);
+}
+
+/* Handles the notifications about documents being opened, changed and closed */
+void _handle_sync(char* method, JsonValue* params) {
+    JsonValue* text_document;
+    JsonValue* change;
+    LspDocument* doc;
+    char* uri;
+    char* text;
+
+    text_document = json_get(params, "textDocument");
+    uri = json_get_str(text_document, "uri");
+    if (uri == NULL) {
+        return;
+    }
+    doc = _get_document(uri);
+    if (strcmp(method, "textDocument/didOpen") == 0) {
+        text = json_get_str(text_document, "text");
+        if (doc != NULL) {
+            _close_document(doc);
+        }
+        doc = (LspDocument*)calloc(1, sizeof(LspDocument));
+        if (doc == NULL) {
+            return;
+        }
+        doc->uri = str_cpy(uri);
+        doc->next = documents;
+        documents = doc;
+        _replace_lines(doc, 0, 0, -1, 0, text != NULL ? text : "");
+    }
+    else if (strcmp(method, "textDocument/didChange") == 0 && doc != NULL) {
+        change = json_get(params, "contentChanges");
+        for (change = change != NULL ? change->children : NULL; change != NULL; change = change->next) {
+            _apply_change(doc, change);
+        }
+    }
+    else if (strcmp(method, "textDocument/didClose") == 0 && doc != NULL) {
+        _close_document(doc);
+        _publish_diagnostics(uri, NULL);
+        return;
+    }
+    else {
+        return;
+    }
+    _analyze(doc);
+    _publish_diagnostics(uri, doc);
+}
+
+/* Handles a request, sending the response */
+void _handle_request(char* method, JsonValue* id, JsonValue* params) {
+    JsonWriter writer = {NULL, 0, 0, 0};
+    LspDocument* doc;
+
+    doc = _get_document(json_get_str(json_get(params, "textDocument"), "uri"));
+    if (strcmp(method, "initialize") == 0) {
+        _begin_response(&writer, id);
+        json_append(&writer, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},"
+                             "\"definitionProvider\":true,\"referencesProvider\":true,\"hoverProvider\":true},"
+                             "\"serverInfo\":{\"name\":\"assembler\"}}");
+    }
+    else if (strcmp(method, "shutdown") == 0) {
+        _begin_response(&writer, id);
+        json_append(&writer, "null");
+    }
+    else if (strcmp(method, "textDocument/definition") == 0 ||
+             strcmp(method, "textDocument/references") == 0 ||
+             strcmp(method, "textDocument/hover") == 0) {
+        _begin_response(&writer, id);
+        if (doc == NULL) {
+            json_append(&writer, "null");
+        }
+        else if (strcmp(method, "textDocument/definition") == 0) {
+            _definition(&writer, doc, params);
+        }
+        else if (strcmp(method, "textDocument/references") == 0) {
+            _references(&writer, doc, params);
+        }
+        else {
+            _hover(&writer, doc, params);
+        }
+    }
+    else {
+        json_append(&writer, "{\"jsonrpc\":\"2.0\",\"id\":");
+        if (id->type == JSON_NUMBER) {
+            json_append_int(&writer, (int)id->number);
+        }
+        else {
+            json_append_str(&writer, id->string);
+        }
+        json_append(&writer, ",\"error\":{\"code\":");
+        json_append_int(&writer, LSP_METHOD_NOT_FOUND);
+        json_append(&writer, ",\"message\":\"Unsupported method\"}");
+    }
+    json_append(&writer, "}");
+    _send(&writer);
+}
+
+/*
+ * Language server mode (--lsp): serves the Language Server Protocol over stdin/stdout
+ * (diagnostics, go-to-definition, find-references and hover) until the editor exits.
+ * Returns 0 if the editor shut the server down before exiting, 1 otherwise
+ */
+int serve_lsp() {
+    char* body;
+    char* method;
+    JsonValue* message;
+    JsonValue* id;
+    int is_shut_down = 0;
+
+    while ((body = _read_message()) != NULL) {
+        message = parse_json(body);
+        free(body);
+        method = json_get_str(message, "method");
+        if (method == NULL) { /* invalid, or a response to a request of ours (there are none) */
+            free_json(message);
+            continue;
+        }
+        if (strcmp(method, "exit") == 0) {
+            free_json(message);
+            break;
+        }
+        id = json_get(message, "id");
+        if (id != NULL && (id->type == JSON_NUMBER || id->type == JSON_STRING)) {
+            is_shut_down |= strcmp(method, "shutdown") == 0;
+            _handle_request(method, id, json_get(message, "params"));
+        }
+        else {
+            _handle_sync(method, json_get(message, "params"));
+        }
+        free_json(message);
+    }
+
+    while (documents != NULL) {
+        _close_document(documents);
+    }
+    free(included_lines);
+    free(included_at);
+    return !is_shut_down;
+}
@@ -0,0 +1,52 @@
+#ifndef LSP_H
+#define LSP_H
+
+#include "assembler.h"
+#include "symbol_table.h"
+#include "diagnostics.h"
+
+/* Amount to allocate for the headers of a message */
+#define LSP_HEADER_LEN 256
+
+/* Error code of the response to a request whose method is not supported */
+#define LSP_METHOD_NOT_FOUND (-32601)
+
+/*
+ * LspLine:
+ * A line of an open document, together with the result of parsing it
+ * (a line is only parsed again when an edit touches it)
+ */
+typedef struct LspLine {
+    char* text;               /* without the newline */
+    ParsedLine* parsed_line;  /* NULL for blank lines, comments and lines with syntax errors */
+    int n_diagnostics;
+    Diagnostic* diagnostics;  /* the syntax errors/warnings of the line */
+} LspLine;
+
+/*
+ * LspDocument:
+ * A document opened by the editor. The symbol index (the symbol table, the symbol references
+ * and the .entry/.extern lines) is rebuilt from the parsed lines after every change.
+ * Open documents are stored as a linked list
+ */
+typedef struct LspDocument {
+    char* uri;
+    int n_lines;
+    int capacity;
+    LspLine* lines;
+    SymbolList symbols;
+    SymbolInfo* symbol_refs;
+    int n_symbol_refs;
+    int n_diagnostics;
+    Diagnostic* diagnostics;  /* found by the passes */
+    struct LspDocument* next;
+} LspDocument;
+
+/*
+ * Language server mode (--lsp): serves the Language Server Protocol over stdin/stdout
+ * (diagnostics, go-to-definition, find-references and hover) until the editor exits.
+ * Returns 0 if the editor shut the server down before exiting, 1 otherwise
+ */
+int serve_lsp();
+
+#endif
@@ -1,61 +1,115 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "symbol_table.h"
 #include "file_utils.h"
 #include "machine_coder.h"
+#include "diagnostics.h"
+#include "parallel.h"
 
 /*********************************** Variables ***********************************/
 
 /* The instructions counter holding the address where the next instruction/operand word will go */
-static unsigned int IC = MEM_START_ADDRESS;
+static THREAD_LOCAL unsigned int IC = MEM_START_ADDRESS;
 
 /* The machine code (instructions/operands) to be generated will accumulate here */
-static union Code* code_image;
+static THREAD_LOCAL union Code* code_image;
 
 /* To keep track of the types of each word entered into the code output array (i.e. instruction or operand) */
-static WordType* word_types;
+static THREAD_LOCAL WordType* word_types;
 
 /* The data words (string/int) to be generated will accumulate here */
-static int* data_image;
+static THREAD_LOCAL int* data_image;
 
 /* The data counter pointing to where in the data image the next data word will go */
-static unsigned int DC = 0;
+static THREAD_LOCAL unsigned int DC = 0;
+
+/* The space counter: the number of zero words reserved by the .space directives so far (they go to the zero region
+ * after the data, which is neither stored nor written word by word) */
+static THREAD_LOCAL unsigned int SC = 0;
+
+/* The number of words allocated for the code/data images */
+static THREAD_LOCAL size_t code_capacity = 0;
+static THREAD_LOCAL size_t data_capacity = 0;
 
 /* Needed to write extern file */
-extern int i_symbol_ref;
-extern  SymbolInfo* symbol_references;
+extern THREAD_LOCAL int i_symbol_ref;
+extern THREAD_LOCAL SymbolInfo* symbol_references;
 
 
 /*********************************** Functions ***********************************/
 
+void _fill_operand(int ic, Symbol* symbol, AddrMode mode);
+int _format_object_header(char* out);
+int _format_object_record(int i_item, char* out);
+int _format_ext_record(int i_item, char* out);
+
 /*!
-* Initialize code image array:
+* Initialize code image array (reusing the one of the previous file if it's large enough):
  * returns 1 if success, 0 if failure
 */
 int init_code_image(size_t n) {
     IC = MEM_START_ADDRESS;
-    code_image = (Code*)malloc(sizeof(Code) * n);
-    return code_image != NULL;
+    return reserve_images(n, data_capacity);
 }
 
 /*!
-* Initialize data image array:
+* Initialize data image array (reusing the one of the previous file if it's large enough):
  * returns 1 if success, 0 if failure
 */
 int init_data_image(size_t n) {
     DC = 0;
-    data_image = (int*)malloc(sizeof(int) * n);
-    return data_image != NULL;
+    SC = 0;
+    return reserve_images(code_capacity, n);
 }
 
 /*!
-* Initialize word_types array:
+* Initialize word_types array (which is kept as large as both images together):
  * returns 1 if success, 0 if failure
 */
 int init_word_types(size_t n) {
-    word_types = (WordType*)malloc(sizeof(WordType) * n);
-    return word_types != NULL;
+    return n <= code_capacity + data_capacity || reserve_images(n - data_capacity, data_capacity);
+}
+
+/*!
+* Makes sure the images (and word_types) have room for at least 'n_code' code words and 'n_data' data words,
+ * growing them geometrically (for when the number of words isn't known in advance, and across input files).
+ * returns 1 if success, 0 if failure (the images are left as they were)
+*/
+int reserve_images(size_t n_code, size_t n_data) {
+    union Code* new_code_image;
+    WordType* new_word_types;
+    int* new_data_image;
+    size_t new_code_capacity = grow_capacity(code_capacity, n_code);
+    size_t new_data_capacity = grow_capacity(data_capacity, n_data);
+
+    if (new_code_capacity == code_capacity && new_data_capacity == data_capacity) {
+        return 1;
+    }
+    new_word_types = (WordType*)realloc(word_types, sizeof(WordType) * (new_code_capacity + new_data_capacity));
+    if (new_word_types == NULL) {
+        return 0;
+    }
+    word_types = new_word_types;
+    new_code_image = (Code*)realloc(code_image, sizeof(Code) * (new_code_capacity > 0 ? new_code_capacity : 1));
+    if (new_code_image == NULL) {
+        return 0;
+    }
+    code_image = new_code_image;
+    code_capacity = new_code_capacity;
+    new_data_image = (int*)realloc(data_image, sizeof(int) * (new_data_capacity > 0 ? new_data_capacity : 1));
+    if (new_data_image == NULL) {
+        return 0;
+    }
+    data_image = new_data_image;
+    data_capacity = new_data_capacity;
+    return 1;
+}
+
+/* The number of bytes allocated for the images (and word_types) */
+size_t get_images_size() {
+    return code_capacity * sizeof(Code) + data_capacity * sizeof(int) + (code_capacity + data_capacity) * sizeof(WordType);
 }
 
 /* Frees memory allocated for code image, data image and word_types array */
@@ -63,6 +117,141 @@ void free_mc_memory() {
     free(code_image);
     free(data_image);
     free(word_types);
+    code_image = NULL;
+    data_image = NULL;
+    word_types = NULL;
+    code_capacity = 0;
+    data_capacity = 0;
+}
+
+/* Hands over the current code/data images to 'image' (so they are not freed with the rest of the file) */
+void detach_images(MachineImage* image) {
+    image->code_image = code_image;
+    image->word_types = word_types;
+    image->data_image = data_image;
+    image->IC = IC;
+    image->DC = DC;
+    code_image = NULL;
+    word_types = NULL;
+    data_image = NULL;
+    code_capacity = 0;
+    data_capacity = 0;
+}
+
+/*!
+* Resumes from images detached in a previous run, in which 'n_old_code'/'n_old_data' words were generated
+ * from 'code_at'/'data_at' onward for some lines which are now replaced by lines generating 'n_new_code'/'n_new_data' words:
+ * the words after them are moved to their new place, and the next words will go at 'code_at'/'data_at'.
+ * returns 1 if success, 0 if failure (the image is freed either way)
+*/
+int splice_images(MachineImage* image, unsigned int code_at, int n_old_code, int n_new_code,
+                  unsigned int data_at, int n_old_data, int n_new_data) {
+    union Code* new_code_image;
+    WordType* new_word_types;
+    int* new_data_image;
+    int n_code;  /* the old number of code words */
+    int n_data;
+    int n_tail_code;  /* the number of words to move */
+    int n_tail_data;
+
+    n_code = image->IC - MEM_START_ADDRESS;
+    n_data = image->DC;
+    n_tail_code = n_code - code_at - n_old_code;
+    n_tail_data = n_data - data_at - n_old_data;
+    n_code = n_code > n_code - n_old_code + n_new_code ? n_code : n_code - n_old_code + n_new_code;
+    n_data = n_data > n_data - n_old_data + n_new_data ? n_data : n_data - n_old_data + n_new_data;
+
+    /* (realloc of 0 bytes may return NULL, so allocate at least 1 word) */
+    new_code_image = (Code*)realloc(image->code_image, sizeof(Code) * (n_code + 1));
+    if (new_code_image != NULL) {
+        image->code_image = new_code_image;
+    }
+    new_word_types = (WordType*)realloc(image->word_types, sizeof(WordType) * (n_code + n_data + 1));
+    if (new_word_types != NULL) {
+        image->word_types = new_word_types;
+    }
+    new_data_image = (int*)realloc(image->data_image, sizeof(int) * (n_data + 1));
+    if (new_data_image != NULL) {
+        image->data_image = new_data_image;
+    }
+    if (new_code_image == NULL || new_word_types == NULL || new_data_image == NULL) {
+        free_images(image);
+        return 0;
+    }
+    memmove(image->code_image + code_at + n_new_code, image->code_image + code_at + n_old_code, sizeof(Code) * n_tail_code);
+    memmove(image->word_types + code_at + n_new_code, image->word_types + code_at + n_old_code, sizeof(WordType) * n_tail_code);
+    memmove(image->data_image + data_at + n_new_data, image->data_image + data_at + n_old_data, sizeof(int) * n_tail_data);
+
+    code_image = image->code_image;
+    word_types = image->word_types;
+    data_image = image->data_image;
+    code_capacity = n_code;
+    data_capacity = n_data;
+    IC = MEM_START_ADDRESS + code_at;
+    DC = data_at;
+    SC = 0; /* (a file reserving space is always assembled from scratch) */
+    image->code_image = NULL;
+    image->word_types = NULL;
+    image->data_image = NULL;
+    return 1;
+}
+
+/* Moves the IC/DC/SC (the next words will go there) */
+void seek_counters(unsigned int ic, unsigned int dc, unsigned int sc) {
+    IC = ic;
+    DC = dc;
+    SC = sc;
+}
+
+/* The code word at address 'ic' (its type goes to *type) */
+Code* get_code_word(unsigned int ic, WordType* type) {
+    *type = word_types[ic - MEM_START_ADDRESS];
+    return &code_image[ic - MEM_START_ADDRESS];
+}
+
+/* Removes the code words flagged in 'is_removed' (a flag per code word), moving the words after them back */
+void remove_code_words(char* is_removed) {
+    unsigned int i;
+    unsigned int n_kept;
+
+    n_kept = 0;
+    for (i = 0; i < IC - MEM_START_ADDRESS; i++) {
+        if (!is_removed[i]) {
+            code_image[n_kept] = code_image[i];
+            word_types[n_kept] = word_types[i];
+            n_kept++;
+        }
+    }
+    IC = MEM_START_ADDRESS + n_kept;
+}
+
+/* The data word at 'dc' */
+int get_data_word(unsigned int dc) {
+    return data_image[dc];
+}
+
+/* Removes the data words flagged in 'is_removed' (a flag per data word), moving the words after them back */
+void remove_data_words(char* is_removed) {
+    unsigned int i;
+    unsigned int n_kept;
+
+    n_kept = 0;
+    for (i = 0; i < DC; i++) {
+        if (!is_removed[i]) {
+            data_image[n_kept++] = data_image[i];
+        }
+    }
+    DC = n_kept;
+}
+
+/* Frees detached images */
+void free_images(MachineImage* image) {
+    free(image->code_image);
+    free(image->word_types);
+    free(image->data_image);
+    image->code_image = NULL;
+    image->word_types = NULL;
+    image->data_image = NULL;
 }
 
 /* Symbol table needs to know the current IC when adding new symbol */
@@ -75,12 +264,22 @@ unsigned int get_DC() {
     return DC;
 }
 
+/* Symbol table needs to know the current SC when adding a new .space symbol */
+unsigned int get_SC() {
+    return SC;
+}
+
 /* Add an instruction word to the code image */
 void add_instruction(int opcode, AddrMode addrMode_1, int reg_1, AddrMode addrMod_2, int reg_2, int funct) {
+    put_instruction(IC++, opcode, addrMode_1, reg_1, addrMod_2, reg_2, funct);
+}
+
+/* Put an instruction word at a given address of the code image (without moving the IC) */
+void put_instruction(unsigned int ic, int opcode, AddrMode addrMode_1, int reg_1, AddrMode addrMod_2, int reg_2, int funct) {
     union Code word;
     Instruction instruction;
     int index;
-    index = IC - MEM_START_ADDRESS;
+    index = ic - MEM_START_ADDRESS;
     instruction.opcode = opcode;
     instruction.arg_1_mode = addrMode_1;
     instruction.reg_1 = reg_1;
@@ -91,21 +290,43 @@ void add_instruction(int opcode, AddrMode addrMode_1, int reg_1, AddrMode addrMo
     word.instruction = instruction;
     code_image[index] = word;
     word_types[index] = INSTRUCTION;
-    IC++;
 }
 
 /* Edit an operand word in the code image whose address and linker info was missing */
 void edit_operand(int ic, char*label, AddrMode mode) {
-    int index;
-    Operand* operand;
     Symbol* symbol;
 
-    index = ic - MEM_START_ADDRESS;
     symbol = lookup_symbol(label);
     if (symbol == NULL) {
         return;
     }
+    if (symbol->type == TYPE_CONST) {
+        report_error(DIAG_CONSTANT, line_num, "Constant \'%s\' can't be used as an address (use \'#%s\' for its value)",
+                     label, label);
+        return;
+    }
+    _fill_operand(ic, symbol, mode);
+}
 
+/* Like edit_operand, but an undefined symbol (or a constant) is not reported (returns 0 instead of 1).
+ * Only reads the symbol table, so several threads can resolve different operands at once */
+int resolve_operand(int ic, char* label, AddrMode mode) {
+    Symbol* symbol;
+
+    symbol = find_symbol(label);
+    if (symbol == NULL || symbol->type == TYPE_CONST) {
+        return 0;
+    }
+    _fill_operand(ic, symbol, mode);
+    return 1;
+}
+
+/* Fills in the address and linker info of an operand word which refers to 'symbol' */
+void _fill_operand(int ic, Symbol* symbol, AddrMode mode) {
+    int index;
+    Operand* operand;
+
+    index = ic - MEM_START_ADDRESS;
     if (word_types[index] == OPERAND) {
         operand = &(code_image[index].operand);
         if (mode == DIRECT) {
@@ -126,16 +347,20 @@ void edit_operand(int ic, char*label, AddrMode mode) {
 
 /* Add an operand word to the code image */
 void add_operand(int value, LinkerInfo linker_info) {
+    put_operand(IC++, value, linker_info);
+}
+
+/* Put an operand word at a given address of the code image (without moving the IC) */
+void put_operand(unsigned int ic, int value, LinkerInfo linker_info) {
     union Code word;
     Operand operand;
     int index;
-    index = IC - MEM_START_ADDRESS;
+    index = ic - MEM_START_ADDRESS;
     operand.value = value;
     operand.linker_info = linker_info;
     word.operand = operand;
     code_image[index] = word;
     word_types[index] = OPERAND;
-    IC++;
 }
 
 /* Add a data word to the data image */
@@ -143,6 +368,11 @@ void add_data(int data) {
     data_image[DC++] = data;
 }
 
+/* Put a data word at a given place of the data image (without moving the DC) */
+void put_data(unsigned int dc, int data) {
+    data_image[dc] = data;
+}
+
 /* converts a number to 2's complement */
 int twos_comp(int val) {
     if (val < 0) {
@@ -168,68 +398,132 @@ int encode_operand(Operand operand) {
     return twos_comp(operand.value << 3) + (operand.linker_info);
 }
 
-/* Generate the machine code to .ob file */
-void write_object_file(char* file_path) {
+/* Encodes a word of the .ob output (the code words come first, and then the data words) */
+int encode_word(int i_word) {
+    int n_code;
+    n_code = IC - MEM_START_ADDRESS;
+    if (i_word >= n_code) {
+        return twos_comp(data_image[i_word - n_code]);
+    }
+    if (word_types[i_word] == INSTRUCTION) {
+        return encode_instruction(code_image[i_word].instruction);
+    }
+    return encode_operand(code_image[i_word].operand);
+}
+
+/* Formats the header of the .ob output: the number of code words and data words, and then the number of words of
+ * the zero region if there is one (so the header of a file without .space is as it always was) */
+int _format_object_header(char* out) {
+    if (SC > 0) {
+        return sprintf(out, "%7i %i %i\n", IC - MEM_START_ADDRESS, DC, SC);
+    }
+    return sprintf(out, "%7i %-6i\n", IC - MEM_START_ADDRESS, DC);
+}
+
+/* Formats the header (item 0) or a word of the .ob output, the same as write_object (a RecordFormatter) */
+int _format_object_record(int i_item, char* out) {
+    if (i_item == 0) {
+        return _format_object_header(out);
+    }
+    return sprintf(out, "%07d %06x\n", MEM_START_ADDRESS + i_item - 1, encode_word(i_item - 1));
+}
+
+/* Write the machine code (in .ob format) to a stream */
+void write_object(FILE* fp) {
     int i;
     int address;
     WordType wordType;
-    FILE *fp;
-    fp = fopen(file_path, "w");
+    char header[LINE_LEN];
 
     address = MEM_START_ADDRESS;
-    if (fp) {
-        /* Header */
-        fprintf(fp, "%7i %-6i\n", IC - MEM_START_ADDRESS, DC);
 
-        /* Code section: */
-        for (i = 0; i < IC - MEM_START_ADDRESS; i++, address++) {
-            write_address(fp, address);
-            wordType = word_types[i];
-            switch (wordType) {
-                case INSTRUCTION:
-                    write_val(fp, encode_instruction(code_image[i].instruction));
-                    break;
-                case OPERAND:
-                    write_val(fp, encode_operand(code_image[i].operand));
-                    break;
-                case DATA: {/* not relevant here */}
-            }
-        }
+    /* Header */
+    _format_object_header(header);
+    fputs(header, fp);
 
-        /* Data section: */
-        for (i = 0; i < DC; i++, address++) {
-            write_address(fp, address);
-            write_val(fp, twos_comp(data_image[i]));
+    /* Code section: */
+    for (i = 0; i < IC - MEM_START_ADDRESS; i++, address++) {
+        write_address(fp, address);
+        wordType = word_types[i];
+        switch (wordType) {
+            case INSTRUCTION:
+                write_val(fp, encode_instruction(code_image[i].instruction));
+                break;
+            case OPERAND:
+                write_val(fp, encode_operand(code_image[i].operand));
+                break;
+            case DATA: {/* not relevant here */}
         }
-        fclose(fp);
+    }
+
+    /* Data section: */
+    for (i = 0; i < DC; i++, address++) {
+        write_address(fp, address);
+        write_val(fp, twos_comp(data_image[i]));
+    }
+}
+
+/* Generate the machine code to .ob file */
+void write_object_file(char* file_path) {
+    FILE *fp;
+    int n_jobs;
+
+    n_jobs = get_n_jobs(IC - MEM_START_ADDRESS + DC);
+    if (n_jobs > 1 && write_parallel(file_path, IC - MEM_START_ADDRESS + DC + 1, _format_object_record, n_jobs)) {
+        return;
+    }
+    fp = open_output_file(file_path);
+    if (fp) {
+        write_object(fp);
+        close_output_file(fp);
     } else {
-        n_errors++;
+        report_error(DIAG_IO, 0, "Unable to create '%s'", file_path);
     }
 }
 
-/* Generate the .ext file */
-void write_ext_file(char* file_path) {
+/* Formats a symbol reference for the .ext output if it's external, the same as write_ext (a RecordFormatter) */
+int _format_ext_record(int i_item, char* out) {
+    Symbol* symbol;
+    symbol = find_symbol(symbol_references[i_item].label);
+    if (symbol == NULL || symbol->loc != LOC_EXTERNAL) {
+        return 0;
+    }
+    return sprintf(out, "%s %07d \n", symbol_references[i_item].label, symbol_references[i_item].IC);
+}
+
+/* Write the external symbol references (in .ext format) to a stream */
+void write_ext(FILE* fp) {
     int i;
     int address;
     char* label = NULL;
     Symbol* symbol;
+    for (i = 0; i < i_symbol_ref; i++) {
+        address = symbol_references[i].IC;
+        label = symbol_references[i].label;
+        symbol = lookup_symbol(label);
+        if (symbol != NULL && symbol->loc == LOC_EXTERNAL) {
+            fprintf(fp, "%s ", label);
+            write_address(fp, address);
+            fprintf(fp, "\n");
+        }
+    }
+}
+
+/* Generate the .ext file */
+void write_ext_file(char* file_path) {
     FILE *fp;
-    fp = fopen(file_path, "w");
-    if (fp) {
-        for (i = 0; i < i_symbol_ref; i++) {
-            address = symbol_references[i].IC;
-            label = symbol_references[i].label;
-            symbol = lookup_symbol(label);
-            if (symbol != NULL && symbol->loc == LOC_EXTERNAL) {
-                fprintf(fp, "%s ", label);
-                write_address(fp, address);
-                fprintf(fp, "\n");
-            }
+    int n_jobs;
 
-        }
-        fclose(fp);
+    n_jobs = get_n_jobs(i_symbol_ref);
+    if (n_jobs > 1 && write_parallel(file_path, i_symbol_ref, _format_ext_record, n_jobs)) {
+        return;
+    }
+    fp = open_output_file(file_path);
+    if (fp) {
+        write_ext(fp);
+        close_output_file(fp);
     }
     else {
-        n_errors++;
+        report_error(DIAG_IO, 0, "Unable to create '%s'", file_path);
     }
 }
@@ -3,6 +3,19 @@
 
 #include "assembler.h"
 
+/*
+ * MachineImage:
+ * The code and data images of a file, kept between assembler runs (e.g. in watch mode)
+ * so that a run only has to encode the lines that changed
+ */
+typedef struct MachineImage {
+    union Code* code_image;
+    WordType* word_types;
+    int* data_image;
+    unsigned int IC;
+    unsigned int DC;
+} MachineImage;
+
 /*********************************** Function Prototypes ***********************************/
 
 /* Initialize code image array:
@@ -13,34 +26,95 @@ int init_code_image(size_t n);
  * returns 1 if success, 0 if failure */
 int init_data_image(size_t n);
 
-/* Initialize word_types array:
+/* Initialize word_types array (which is kept as large as both images together):
  * returns 1 if success, 0 if failure */
 int init_word_types(size_t n);
 
+/* Makes sure the images have room for 'n_code' code words and 'n_data' data words (growing them geometrically)
+ * returns 1 if success, 0 if failure */
+int reserve_images(size_t n_code, size_t n_data);
+
+/* The number of bytes allocated for the images (and word_types) */
+size_t get_images_size();
+
 /* Frees memory allocated for code image, data image and word_types array */
 void free_mc_memory();
 
+/* Hands over the current code/data images to 'image' (so they are not freed with the rest of the file) */
+void detach_images(MachineImage* image);
+
+/* Resumes from images detached in a previous run, in which 'n_old_code'/'n_old_data' words were generated
+ * from 'code_at'/'data_at' onward for some lines which are now replaced by lines generating 'n_new_code'/'n_new_data' words:
+ * the words after them are moved to their new place, and the next words will go at 'code_at'/'data_at'.
+ * returns 1 if success, 0 if failure (the image is freed either way) */
+int splice_images(MachineImage* image, unsigned int code_at, int n_old_code, int n_new_code,
+                  unsigned int data_at, int n_old_data, int n_new_data);
+
+/* Moves the IC/DC/SC (the next words will go there) */
+void seek_counters(unsigned int ic, unsigned int dc, unsigned int sc);
+
+/* The code word at address 'ic' (its type goes to *type) */
+Code* get_code_word(unsigned int ic, WordType* type);
+
+/* Removes the code words flagged in 'is_removed' (a flag per code word), moving the words after them back */
+void remove_code_words(char* is_removed);
+
+/* The data word at 'dc' */
+int get_data_word(unsigned int dc);
+
+/* Removes the data words flagged in 'is_removed' (a flag per data word), moving the words after them back */
+void remove_data_words(char* is_removed);
+
+/* Frees detached images */
+void free_images(MachineImage* image);
+
 /* Symbol table needs to know the current IC when adding new symbol */
 unsigned int get_IC();
 
 /* Symbol table needs to know the current DC when adding new symbol */
 unsigned int get_DC();
 
+/* Symbol table needs to know the current SC when adding a new .space symbol
+ * (the number of zero words reserved so far, in the zero region after the data) */
+unsigned int get_SC();
+
 /* Add an instruction word to the code stack */
 void add_instruction(int opcode, AddrMode addrMode_1, int reg_1, AddrMode addrMod_2, int reg_2, int funct);
 
+/* Put an instruction word at a given address (without moving the IC, so that lines can be encoded in parallel) */
+void put_instruction(unsigned int ic, int opcode, AddrMode addrMode_1, int reg_1, AddrMode addrMod_2, int reg_2, int funct);
+
 /* Add an operand word to the code stack */
 void add_operand(int value, LinkerInfo linker_info);
 
+/* Put an operand word at a given address (without moving the IC) */
+void put_operand(unsigned int ic, int value, LinkerInfo linker_info);
+
 /* Edit an operand word in the code image */
 void edit_operand(int ic, char*label, AddrMode mode);
 
+/* Edit an operand word without reporting an undefined symbol (returns 0 if undefined, 1 otherwise).
+ * Only reads the symbol table, so it can run in several threads at once (each on different words) */
+int resolve_operand(int ic, char* label, AddrMode mode);
+
 /* Add a data word to the data stack */
 void add_data(int data);
 
+/* Put a data word at a given place (without moving the DC) */
+void put_data(unsigned int dc, int data);
+
+/* Encodes a word of the .ob output (the code words come first, and then the data words) */
+int encode_word(int i_word);
+
+/* Write the machine code (in .ob format) to a stream */
+void write_object(FILE* fp);
+
 /* Generate the machine code */
 void write_object_file(char* file_path);
 
+/* Write the external symbol references (in .ext format) to a stream */
+void write_ext(FILE* fp);
+
 /* Generate the .ext file */
 void write_ext_file(char* file_path);
 
@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L /* for sysconf(), pwrite() and the pthreads */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "assembler.h"
+
+/* The number of cores (looked up once, since sysconf reads it from /sys on every call) */
+static long n_cores = 0;
+
+/* What a thread of run_parallel runs */
+typedef struct ChunkTask {
+    ChunkWorker worker;
+    void* chunk;
+} ChunkTask;
+
+/* Entry point of a thread of run_parallel */
+void* _run_chunk(void* arg) {
+    ChunkTask* task = (ChunkTask*)arg;
+    task->worker(task->chunk);
+    return NULL;
+}
+
+/* The number of threads to split 'n_items' between (by --jobs, or the number of cores); 1 means don't split them */
+int get_n_jobs(int n_items) {
+    long n_jobs;
+
+    if (options.jobs <= 0 && n_cores == 0) {
+        n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    n_jobs = options.jobs > 0 ? options.jobs : n_cores;
+    if (n_jobs > n_items / PARALLEL_MIN_ITEMS_PER_JOB) {
+        n_jobs = n_items / PARALLEL_MIN_ITEMS_PER_JOB;
+    }
+    if (n_jobs > PARALLEL_MAX_JOBS) {
+        n_jobs = PARALLEL_MAX_JOBS;
+    }
+    return n_jobs > 1 ? (int)n_jobs : 1;
+}
+
+/* Splits 'n_items' into 'n_chunks' consecutive ranges: the 'i_chunk'th one is from..to-1 */
+void get_chunk_range(int n_items, int n_chunks, int i_chunk, int* from, int* to) {
+    *from = (int)((double)n_items * i_chunk / n_chunks);
+    *to = (int)((double)n_items * (i_chunk + 1) / n_chunks);
+}
+
+/*
+ * Runs 'worker' on each of the 'n_chunks' chunks (of 'chunk_size' bytes each) in its own thread, and waits for them.
+ * (A chunk whose thread can't be started is handled by the calling thread, so all of them are always done)
+ */
+void run_parallel(ChunkWorker worker, void* chunks, size_t chunk_size, int n_chunks) {
+    pthread_t threads[PARALLEL_MAX_JOBS];
+    ChunkTask tasks[PARALLEL_MAX_JOBS];
+    int is_started[PARALLEL_MAX_JOBS];
+    int i;
+
+    /* (the first chunk is handled by the calling thread while the others run) */
+    for (i = 1; i < n_chunks && i < PARALLEL_MAX_JOBS; i++) {
+        tasks[i].worker = worker;
+        tasks[i].chunk = (char*)chunks + i * chunk_size;
+        is_started[i] = pthread_create(&threads[i], NULL, _run_chunk, &tasks[i]) == 0;
+    }
+    if (n_chunks > 0) {
+        worker(chunks);
+    }
+    for (i = 1; i < n_chunks && i < PARALLEL_MAX_JOBS; i++) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            worker((char*)chunks + i * chunk_size);
+        }
+    }
+}
+
+/* Formats the records of a chunk into its buffer (a ChunkWorker) */
+void _format_chunk(void* arg) {
+    WriteChunk* chunk = (WriteChunk*)arg;
+    char* buffer;
+    size_t capacity;
+    int i;
+
+    for (i = chunk->from; i < chunk->to; i++) {
+        if (chunk->len + LINE_LEN > chunk->capacity) {
+            capacity = chunk->capacity > 0 ? 2 * chunk->capacity : (size_t)(chunk->to - chunk->from) * 16 + LINE_LEN;
+            buffer = (char*)realloc(chunk->buffer, capacity);
+            if (buffer == NULL) {
+                chunk->failed = 1;
+                return;
+            }
+            chunk->buffer = buffer;
+            chunk->capacity = capacity;
+        }
+        chunk->len += chunk->format(i, chunk->buffer + chunk->len);
+    }
+}
+
+/* Writes the buffer of a chunk at its offset (a ChunkWorker) */
+void _write_chunk(void* arg) {
+    WriteChunk* chunk = (WriteChunk*)arg;
+    size_t written = 0;
+    ssize_t n;
+
+    while (written < chunk->len) {
+        n = pwrite(chunk->fd, chunk->buffer + written, chunk->len - written, chunk->offset + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            chunk->failed = 1;
+            return;
+        }
+        written += n;
+    }
+}
+
+/*
+ * Writes a file made of the records of 'n_items' items, split between 'n_jobs' threads: each thread formats a range
+ * of the records into its own buffer, and once their lengths are known (and the file is sized exactly)
+ * each buffer is written at its offset with pwrite (all at once).
+ * Returns 1 if success, 0 if failure (then the file should be written again some other way)
+ */
+int write_parallel(char* file_path, int n_items, RecordFormatter format, int n_jobs) {
+    WriteChunk* chunks;
+    long size = 0;
+    int is_ok = 1;
+    int fd = -1;
+    int i;
+
+    chunks = (WriteChunk*)calloc(n_jobs, sizeof(WriteChunk));
+    if (chunks == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n_jobs; i++) {
+        get_chunk_range(n_items, n_jobs, i, &chunks[i].from, &chunks[i].to);
+        chunks[i].format = format;
+    }
+    run_parallel(_format_chunk, chunks, sizeof(WriteChunk), n_jobs);
+
+    for (i = 0; i < n_jobs; i++) {
+        chunks[i].offset = size;
+        size += chunks[i].len;
+        is_ok &= !chunks[i].failed;
+    }
+    if (is_ok) {
+        fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        is_ok = fd >= 0 && ftruncate(fd, size) == 0;
+    }
+    if (is_ok) {
+        for (i = 0; i < n_jobs; i++) {
+            chunks[i].fd = fd;
+        }
+        run_parallel(_write_chunk, chunks, sizeof(WriteChunk), n_jobs);
+        for (i = 0; i < n_jobs; i++) {
+            is_ok &= !chunks[i].failed;
+        }
+    }
+    if (fd >= 0 && close(fd) != 0) {
+        is_ok = 0;
+    }
+    for (i = 0; i < n_jobs; i++) {
+        free(chunks[i].buffer);
+    }
+    free(chunks);
+    return is_ok;
+}
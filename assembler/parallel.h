@@ -0,0 +1,64 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/* A file is only split between threads if each of them gets at least this many items (lines, references...),
+ * since starting a thread costs more than handling a few thousand items */
+#define PARALLEL_MIN_ITEMS_PER_JOB 4096
+
+/* Most threads used at once (regardless of --jobs) */
+#define PARALLEL_MAX_JOBS 64
+
+/*
+ * ChunkWorker:
+ * Handles one chunk of the items being processed in parallel. The chunk is an element of the array given to
+ * run_parallel: it says which items to handle, and collects the results to be merged once all the chunks are done
+ */
+typedef void (*ChunkWorker)(void* chunk);
+
+/*
+ * RecordFormatter:
+ * Formats the 'i_item'th record of a file being written in parallel into 'out' (which has room for LINE_LEN chars).
+ * Returns its length (0 if that item has no record)
+ */
+typedef int (*RecordFormatter)(int i_item, char* out);
+
+/*
+ * WriteChunk:
+ * A range of the records of a file written in parallel (items from..to-1), formatted into its own buffer,
+ * which goes at 'offset' in the file (the prefix sum of the lengths of the buffers before it)
+ */
+typedef struct WriteChunk {
+    int from;
+    int to;
+    RecordFormatter format;
+    char* buffer;
+    size_t len;
+    size_t capacity;
+    long offset;
+    int fd;
+    int failed;
+} WriteChunk;
+
+/* The number of threads to split 'n_items' between (by --jobs, or the number of cores); 1 means don't split them */
+int get_n_jobs(int n_items);
+
+/* Splits 'n_items' into 'n_chunks' consecutive ranges: the 'i_chunk'th one is from..to-1 */
+void get_chunk_range(int n_items, int n_chunks, int i_chunk, int* from, int* to);
+
+/*
+ * Runs 'worker' on each of the 'n_chunks' chunks (of 'chunk_size' bytes each) in its own thread, and waits for them.
+ * (A chunk whose thread can't be started is handled by the calling thread, so all of them are always done)
+ */
+void run_parallel(ChunkWorker worker, void* chunks, size_t chunk_size, int n_chunks);
+
+/*
+ * Writes a file made of the records of 'n_items' items, split between 'n_jobs' threads: each thread formats a range
+ * of the records into its own buffer, and once their lengths are known (and the file is sized exactly)
+ * each buffer is written at its offset with pwrite (all at once).
+ * Returns 1 if success, 0 if failure (then the file should be written again some other way)
+ */
+int write_parallel(char* file_path, int n_items, RecordFormatter format, int n_jobs);
+
+#endif
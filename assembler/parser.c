@@ -2,17 +2,33 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "parser.h"
 #include "string_utils.h"
 #include "passes.h"
-
-/* Constructor' for ParsedLine struct */
+#include "diagnostics.h"
+#include "symbol_table.h"
+#include "incbin.h"
+
+/* The parse memo: valid lines by their text after the label (a hash table) */
+static THREAD_LOCAL MemoEntry** memo_buckets = NULL;
+static THREAD_LOCAL int n_memo_entries = 0;
+static THREAD_LOCAL ParseStats parse_stats = {0, 0};
+
+int _parse_sum(char** p, int* value, int is_folding);
+int _parse_product(char** p, int* value, int is_folding);
+int _parse_factor(char** p, int* value, int is_folding);
+int _fit_int(long result, int* value, int is_folding);
+int _has_spaced_expression(char* arg_input);
+
+/* Constructor' for ParsedLine struct (takes ownership of label, the rest is copied) */
 ParsedLine* construct_parsed_line(char* label, char* op, char* directive, int n_args, char** args) {
     int i;
     ParsedLine* parsed_line;
     parsed_line = (ParsedLine*)malloc(sizeof(ParsedLine));
     parsed_line->line_num = line_num;
+    parsed_line->source = line_source;
     parsed_line->label = label; /*str_cpy(label);*/
     parsed_line->op = str_cpy(op);
     parsed_line->directive = str_cpy(directive);
@@ -21,7 +37,8 @@ ParsedLine* construct_parsed_line(char* label, char* op, char* directive, int n_
         parsed_line->args[i] = str_cpy(args[i]);
     }
     parsed_line->n_args = n_args;
-    free(args);
+    parsed_line->is_cached = 0;
+    parsed_line->binary = NULL;
     return parsed_line;
 }
 
@@ -81,11 +98,26 @@ int get_num_data_words(ParsedLine* line) {
     else if (line->directive != NULL && strcmp(line->directive, ".string") == 0) {
         return strlen(line->args[0]) -2 + 1; /* the number of chars, minus the quotes, plus the terminating '\0' */
     }
-    else { /* .entry and .extern directives don't generate words in the machine code output */
+    else if (is_incbin_directive(line)) {
+        return get_incbin_words(line); /* (known once the line is loaded, without reading the file) */
+    }
+    else { /* .entry and .extern directives don't generate words in the machine code output
+            * (nor does .space, whose words are only reserved, see get_num_space_words) */
         return 0;
     }
 }
 
+/*
+ * Calculates the number of zero words reserved by this line (.space), which go to the zero region after the data
+ * (0 if its size is a constant expression: the first pass isn't split between threads then, so it isn't needed)
+ */
+int get_num_space_words(ParsedLine* line) {
+    if (line->directive != NULL && strcmp(line->directive, ".space") == 0 && is_integer(line->args[0], 0)) {
+        return get_int_value(line->args[0], 0);
+    }
+    return 0;
+}
+
 /*
 * Calculates the number of symbol declarations in this line (to help when
  * initializing the symbol table)
@@ -96,23 +128,26 @@ int get_num_symbols(ParsedLine* line) {
 
     n_line_symbols = 0;
 
-    /* A symbol can come from either a lable preceding an op or a .data / .string directive,
-     * or as the arg of a .extern directive.
-     * Labels preceding an .extern or an .entry directive do not count (and are ignored) */
+    /* A symbol can come from either a lable preceding an op or a .data / .string / .incbin / .space directive,
+     * or as the (first) arg of a .extern or an .equ directive.
+     * Labels preceding an .extern, an .equ or an .entry directive do not count (and are ignored) */
     is_label_declaration =
             (line->label != NULL &&
                 (line->op != NULL ||
-                (line->directive != NULL && (strcmp(line->directive, ".data") == 0 || strcmp(line->directive, ".string") == 0))));
+                (line->directive != NULL && (strcmp(line->directive, ".data") == 0 || strcmp(line->directive, ".string") == 0 ||
+                                             is_incbin_directive(line) || strcmp(line->directive, ".space") == 0))));
 
-    is_label_declaration |= (line->directive != NULL && strcmp(line->directive, ".extern") == 0);
+    is_label_declaration |= (line->directive != NULL &&
+            (strcmp(line->directive, ".extern") == 0 || strcmp(line->directive, ".equ") == 0));
 
     if (is_label_declaration) {
         n_line_symbols++;
     }
     /* Give warning for redundant label declaration */
     if (line->label != NULL &&
-            (line->directive != NULL && (strcmp(line->directive, ".entry") == 0 || strcmp(line->directive, ".extern") == 0))) {
-        printf("Warning in line %i. Ignoring redundant label \'%s\' in directive \'%s\' ...\n", line_num, line->label, line->directive);
+            (line->directive != NULL && (strcmp(line->directive, ".entry") == 0 || strcmp(line->directive, ".extern") == 0 ||
+                                         strcmp(line->directive, ".equ") == 0))) {
+        report_warning(DIAG_REDUNDANT_LABEL, line_num, "Ignoring redundant label \'%s\' in directive \'%s\' ...", line->label, line->directive);
     }
 
     return n_line_symbols;
@@ -137,47 +172,93 @@ int get_num_symbol_refs(ParsedLine* line) {
     return n_symbol_refs;
 }
 
+/*
+ * Calculates the number of constant expressions (with names in them) in this line, counting an .equ as one
+ * (so that a file that has none can have its first pass split between threads)
+ */
+int get_num_expressions(ParsedLine* line) {
+    int n_expressions;
+    int i;
+    n_expressions = 0;
+    if (line->op != NULL) {
+        for (i = 0; i < line->n_args; i++) {
+            n_expressions += get_addr_mode(line->args[i]) == IMMEDIATE && !is_integer(line->args[i], 1);
+        }
+    }
+    else if (line->directive != NULL && (strcmp(line->directive, ".data") == 0 || strcmp(line->directive, ".space") == 0)) {
+        for (i = 0; i < line->n_args; i++) {
+            n_expressions += !is_integer(line->args[i], 0);
+        }
+    }
+    else if (line->directive != NULL && strcmp(line->directive, ".equ") == 0) {
+        n_expressions++;
+    }
+    return n_expressions;
+}
+
 /*
  * Checks label validity (alpha-numeric, doesn't exceed max length, not reserved words etc.)
  * Returns 1 if valid, otherwise 0
  */
 int _validate_label(char* label) {
     if (!isalpha(label[0]) || !is_alnum(label)) {
-        printf("Error in line %i: Invalid label: \'%s\' (labels must start with a letter and contain only letters and numbers)\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_INVALID_LABEL, line_num, "Invalid label: \'%s\' (labels must start with a letter and contain only letters and numbers)", label);
         return 0;
     }
     if (strlen(label) > MAX_LABEL_LEN) {
-        printf("Error in line %i: Label exceeds max length (31): \'%s\'\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_INVALID_LABEL, line_num, "Label exceeds max length (31): \'%s\'", label);
         return 0;
     }
     if (get_register(label) != -1) {
-        printf("Error in line %i: Invalid label: \'%s\' (register names are reserved)\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_INVALID_LABEL, line_num, "Invalid label: \'%s\' (register names are reserved)", label);
         return 0;
     }
     if (get_op(label) != NULL) {
-        printf("Error in line %i: Invalid label: \'%s\' (op names are reserved)\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_INVALID_LABEL, line_num, "Invalid label: \'%s\' (op names are reserved)", label);
         return 0;
     }
     if (get_directive(label) != NULL) {
-        printf("Error in line %i: Invalid label: \'%s\' (directive names are reserved)\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_INVALID_LABEL, line_num, "Invalid label: \'%s\' (directive names are reserved)", label);
         return 0;
     }
     return 1;
 }
 
 /*
- * Checks validity of a (pos/neg) integer arg
+ * Checks validity of a (pos/neg) integer arg, or of a constant expression (see get_expression_value)
  * Returns 1 if valid, otherwise 0
  */
 int _validate_int(char* arg, int start_idx) {
-    if (!is_integer(arg, start_idx)) {
-        printf("Error in line %i: Invalid integer value: \'%s\'\n", line_num, arg);
-        n_errors++;
+    if (!is_expression(arg, start_idx)) {
+        report_error(DIAG_INVALID_INT, line_num, "Invalid integer value: \'%s\'", arg);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Checks validity of a plain integer arg (the offset, length and width of an .incbin, which are needed before
+ * the first pass, so they can't be constant expressions)
+ * Returns 1 if valid, otherwise 0
+ */
+int _validate_plain_int(char* arg) {
+    if (!is_integer(arg, 0)) {
+        report_error(DIAG_INVALID_INT, line_num, "Invalid integer value: \'%s\'", arg);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Checks validity of the size of a .space (a constant expression, or an integer that isn't negative)
+ * Returns 1 if valid, otherwise 0
+ */
+int _validate_size(char* arg) {
+    if (!_validate_int(arg, 0)) {
+        return 0;
+    }
+    if (is_integer(arg, 0) && get_int_value(arg, 0) < 0) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Invalid size %s for \'.space\' (must not be negative)", arg);
         return 0;
     }
     return 1;
@@ -189,18 +270,15 @@ int _validate_int(char* arg, int start_idx) {
  */
 int _validate_string(char* arg) {
     if (strlen(arg) < 2 || arg[0] != '"' || arg[strlen(arg)-1] != '"') {
-        printf("Error in line %i: String literal missing quotes: %s\n", line_num, arg);
-        n_errors++;
+        report_error(DIAG_INVALID_STRING, line_num, "String literal missing quotes: %s", arg);
         return 0;
     }
     if (count_char(arg, '"') > 2) { /* we don't allow this, nor do we support escape characters to allow this */
-        printf("Error in line %i: Quotes found inside string literal: \'%s\'\n", line_num, arg);
-        n_errors++;
+        report_error(DIAG_INVALID_STRING, line_num, "Quotes found inside string literal: \'%s\'", arg);
         return 0;
     }
     if (!is_printable(arg)) {
-        printf("Error in line %i: Invalid string literal \'%s\'. (must contain only printable chars)\n", line_num, arg);
-        n_errors++;
+        report_error(DIAG_INVALID_STRING, line_num, "Invalid string literal \'%s\'. (must contain only printable chars)", arg);
         return 0;
     }
     return 1;
@@ -214,15 +292,13 @@ int _validate_directive(char* directive_name, char** args, int n_args ,int line_
     int i;
     Directive* directive = get_directive(directive_name);
     if (directive == NULL) {
-        printf("Error in line %i. Unrecognized directive: \'%s\'\n", line_num, directive_name);
-        n_errors++;
+        report_error(DIAG_UNKNOWN_DIRECTIVE, line_num, "Unrecognized directive: \'%s\'", directive_name);
         return 0;
     }
 
-    if (n_args == 0 || n_args > directive->n_args) {
-        printf("Error in line %i. Incorrect number of args for \'%s\' directive. Expected %i but got %i\n",
-                line_num, directive_name, directive->n_args, n_args);
-        n_errors++;
+    if (n_args == 0 || n_args > directive->n_args || (directive->arg_type == CONSTANT && n_args != directive->n_args)) {
+        report_error(DIAG_DIRECTIVE_ARGS, line_num, "Incorrect number of args for \'%s\' directive. Expected %i but got %i",
+                directive_name, directive->n_args, n_args);
         return 0;
     }
 
@@ -230,7 +306,12 @@ int _validate_directive(char* directive_name, char** args, int n_args ,int line_
         char* arg = args[i];
         if ((directive->arg_type == LABEL && !_validate_label(arg)) ||
                 (directive->arg_type == INT && !_validate_int(arg, 0)) ||
-                (directive->arg_type == STRING && !_validate_string(arg))) {
+                (directive->arg_type == STRING && !_validate_string(arg)) ||
+                (directive->arg_type == CONSTANT && i == 0 && !_validate_label(arg)) ||
+                (directive->arg_type == CONSTANT && i == 1 && !_validate_int(arg, 0)) ||
+                (directive->arg_type == BINARY && i == 0 && !_validate_string(arg)) ||
+                (directive->arg_type == BINARY && i > 0 && !_validate_plain_int(arg)) ||
+                (directive->arg_type == SPACE && !_validate_size(arg))) {
             return 0;
         }
     }
@@ -245,9 +326,8 @@ int _validate_operand(char* op_name, char* operand, char* operand_name, int* val
     char* substr;
     AddrMode mode = get_addr_mode(operand);
     if (!valid_addr_modes[mode]) {
-        printf("Error in line: %i. %s operand \'%s\' of \'%s\'. Invalid addr mode: %s'\n",
-                line_num, operand_name, operand, op_name, addr_mode_str(mode));
-        n_errors++;
+        report_error(DIAG_ADDR_MODE, line_num, "%s operand \'%s\' of \'%s\'. Invalid addr mode: %s",
+                operand_name, operand, op_name, addr_mode_str(mode));
         return 0;
     }
     if ((mode == IMMEDIATE && !_validate_int(operand, 1)) ||
@@ -272,15 +352,13 @@ int _validate_operand(char* op_name, char* operand, char* operand_name, int* val
 int _validate_op(char* op_name, char** args, int n_args) {
     Op* op = get_op(op_name);
     if (op == NULL) {
-        printf("Error in line %i. Unrecognized op: \'%s\'\n", line_num, op_name);
-        n_errors++;
+        report_error(DIAG_UNKNOWN_OP, line_num, "Unrecognized op: \'%s\'", op_name);
         return 0;
     }
 
     if (n_args != op->n_args) { /* checking the number of args */
-        printf("Error in line %i. Incorrect number of args for \'%s\'. Expected %i but got %i\n",
-               line_num, op_name, op->n_args, n_args);
-        n_errors++;
+        report_error(DIAG_OP_ARGS, line_num, "Incorrect number of args for \'%s\'. Expected %i but got %i",
+               op_name, op->n_args, n_args);
         return 0;
     }
 
@@ -329,13 +407,36 @@ int check_comma_formatting(char* arg_input_str) {
 }
 
 /*
- * This is the main input parsing function which parses and checks the syntax of
- * each input line, and restructures it for the subsequent assembler stages:
+ * Returns whether an arg has spaces next to an operator of a constant expression (e.g. '-A - -2'), which would
+ * otherwise split it into several args
  */
-ParsedLine* parse_line(int line_num, char* line) {
+int _has_spaced_expression(char* arg_input) {
+    int i;
+    int j;
+    for (i = 0; arg_input[i] != '\0'; i++) {
+        if (arg_input[i] != ' ' && arg_input[i] != '\t') {
+            continue;
+        }
+        for (j = i; arg_input[j] == ' ' || arg_input[j] == '\t'; j++) {
+            /* (find the end of the spaces) */
+        }
+        if (i > 0 && arg_input[i - 1] != ',' && arg_input[j] != ',' && arg_input[j] != '\0' &&
+            (strchr("+-*/()", arg_input[i - 1]) != NULL || strchr("+-*/()", arg_input[j]) != NULL)) {
+            return 1;
+        }
+        i = j - 1;
+    }
+    return 0;
+}
+
+/*
+ * This is the main input lexing function which checks the syntax of each input line
+ * without allocating anything: the fields of 'view' are pointed into the (modified) line buffer,
+ * and view->args must have room for MAX_ARGS args.
+ * Returns 1 for a valid op/directive line, 0 for an empty line, a comment or a syntax error
+ */
+int lex_line(int line_num, char* line, ParsedLine* view) {
     char* label = NULL;
-    char* op = NULL;
-    char* directive = NULL;
     int n_args;
     int n_commas;
     int bad_commas;
@@ -343,9 +444,10 @@ ParsedLine* parse_line(int line_num, char* line) {
     char* token;
     char* next_arg;
     char* arg_input;
+    char* rest;
     int token_len;
 
-    args = (char**)malloc(sizeof(char*) * MAX_LINE_LEN); /* can't have more args than the max length of line! */
+    args = view->args;
 
     /* Strip newline character and trim leading and trailing whitespaces */
     line[strcspn(line, "\n")] = 0;
@@ -353,42 +455,41 @@ ParsedLine* parse_line(int line_num, char* line) {
 
     /* Skip empty lines and comments */
     if (strlen(line) == 0 || line[0] == ';') {
-        return NULL;
+        return 0;
     }
 
     if (strlen(line) > MAX_LINE_LEN) {
-        printf("Error in line: %i. Line exceeds max length of %i chars\n", line_num, MAX_LINE_LEN);
-        n_errors++;
+        report_error(DIAG_LINE_TOO_LONG, line_num, "Line exceeds max length of %i chars", MAX_LINE_LEN);
     }
 
     /* Get first token of line */
-    token = strtok(line, " \t");
+    token = str_tok(line, " \t", &rest);
 
     /* See if it's a label */
     token_len = strlen(token);
     if (token[token_len - 1] == ':') {
-        label = get_substr(token, 0, token_len - 1);
+        token[token_len - 1] = '\0';
+        label = token;
 
         /* Validate the label */
         if (!_validate_label(label)) {
-            return NULL;
+            return 0;
         }
 
         /* Move on to next token of line */
-        token = trim(strtok(NULL, " \t"));
+        token = trim(str_tok(NULL, " \t", &rest));
     }
 
     /* A label by itself (with no op or directive) is an error: */
     if (token == NULL) {
-        printf("Error in line %i. No op or directive given\n", line_num);
-        n_errors++;
-        return NULL;
+        report_error(DIAG_MISSING_OP, line_num, "No op or directive given");
+        return 0;
     }
 
     /* Get args: */
     n_args = 0;
     bad_commas = 0;
-    arg_input = trim(strtok(NULL, "")); /* the remaining part of the line are the args */
+    arg_input = trim(str_tok(NULL, "", &rest)); /* the remaining part of the line are the args */
     n_commas = 0;
     if (arg_input != NULL) {
         /* If we're expecting a string arg or we got a string arg, don't split by commas and spaces
@@ -396,35 +497,346 @@ ParsedLine* parse_line(int line_num, char* line) {
         if (strcmp(token, ".string") == 0 || (arg_input[0]=='"' && arg_input[strlen(arg_input)-1]=='"')) {
             args[n_args++] = arg_input;
         }
+        else if (_has_spaced_expression(arg_input)) {
+            report_error(DIAG_INVALID_EXPR, line_num, "Spaces aren't allowed inside a constant expression: \'%s\'", arg_input);
+            return 0;
+        }
         else { /* otherwise, read in comma separated list of args one by one (if any) */
             n_commas = count_char(arg_input, ',');
             bad_commas = !check_comma_formatting(arg_input);
-            next_arg = trim(strtok(arg_input, ", \t"));
+            next_arg = trim(str_tok(arg_input, ", \t", &rest));
             while (next_arg != NULL) {
                 args[n_args++] = next_arg;
-                next_arg = trim(strtok(NULL, ", \t"));
+                next_arg = trim(str_tok(NULL, ", \t", &rest));
             }
         }
     }
 
+    view->line_num = line_num;
+    view->label = label;
+    view->op = NULL;
+    view->directive = NULL;
+    view->n_args = n_args;
+    view->is_cached = 0;
+    view->source = NULL;
+    view->binary = NULL;
+
     /* Check the type of the command (directive/op) and validate accordingly: */
     if (token[0] == '.') { /* directive */
         if (!_validate_directive(token, args, n_args, line_num)) {
-            return NULL;
+            return 0;
         }
-        directive = token;
+        view->directive = token;
     }
     else { /* op */
         if (!_validate_op(token, args, n_args)) {
-            return NULL;
+            return 0;
         }
-        op = token;
+        view->op = token;
     }
 
     bad_commas |= (n_args == 0 && n_commas != 0) || (n_args > 0 && n_commas != n_args - 1);
     if (bad_commas) {
-        printf("Error in line %i. Bad comma formatting (a SINGLE comma is required BETWEEN each argument)\n", line_num);
-        n_errors++;
+        report_error(DIAG_COMMAS, line_num, "Bad comma formatting (a SINGLE comma is required BETWEEN each argument)");
+    }
+    return 1;
+}
+
+/*
+ * Returns whether str (from start_idx) is an integer, or a constant expression: integers and the names of
+ * constants, with + - * / and parentheses (written without spaces, e.g. 'SIZE*4+1')
+ */
+int is_expression(char* str, int start_idx) {
+    char* p;
+    int value;
+    if (is_integer(str, start_idx)) {
+        return 1;
+    }
+    p = str + start_idx;
+    return _parse_sum(&p, &value, 0) && *p == '\0';
+}
+
+/*
+ * The value of an integer or a constant expression (see is_expression) from start_idx, folded with the values of
+ * the constants defined so far (the .equ's before it).
+ * Returns 1 if success, 0 if error (a name that isn't a constant, or a division by zero, which is reported)
+ */
+int get_expression_value(char* str, int start_idx, int* value) {
+    char* p;
+    if (is_integer(str, start_idx)) {
+        *value = get_int_value(str, start_idx);
+        return 1;
+    }
+    p = str + start_idx;
+    if (!_parse_sum(&p, value, 1)) {
+        *value = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/* Parses (and if 'is_folding', evaluates) the terms of a sum, moving *p past them. Returns 1 if success, 0 if error */
+int _parse_sum(char** p, int* value, int is_folding) {
+    int term;
+    char op;
+    if (!_parse_product(p, value, is_folding)) {
+        return 0;
+    }
+    while (**p == '+' || **p == '-') {
+        op = *(*p)++;
+        if (!_parse_product(p, &term, is_folding)) {
+            return 0;
+        }
+        if (!_fit_int(op == '+' ? (long)*value + term : (long)*value - term, value, is_folding)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parses (and if 'is_folding', evaluates) the factors of a product. Returns 1 if success, 0 if error */
+int _parse_product(char** p, int* value, int is_folding) {
+    int factor;
+    char op;
+    if (!_parse_factor(p, value, is_folding)) {
+        return 0;
+    }
+    while (**p == '*' || **p == '/') {
+        op = *(*p)++;
+        if (!_parse_factor(p, &factor, is_folding)) {
+            return 0;
+        }
+        if (op == '/' && factor == 0 && is_folding) {
+            report_error(DIAG_INVALID_EXPR, line_num, "Division by zero in constant expression");
+            return 0;
+        }
+        if (!_fit_int(op == '*' ? (long)*value * factor : factor != 0 ? (long)*value / factor : 0, value, is_folding)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Stores a result of the folding in *value if it's in the range of an int. Returns 1 if success, 0 if it's out of
+ * range, which is reported (unless the expression is only being validated, where its value doesn't matter) */
+int _fit_int(long result, int* value, int is_folding) {
+    if (result >= INT_MIN && result <= INT_MAX) {
+        *value = (int)result;
+        return 1;
+    }
+    *value = 0;
+    if (!is_folding) {
+        return 1;
+    }
+    report_error(DIAG_INVALID_EXPR, line_num, "Constant expression is out of range (%i to %i)", INT_MIN, INT_MAX);
+    return 0;
+}
+
+/* Parses (and if 'is_folding', evaluates) a signed integer, a constant or a parenthesized expression.
+ * Returns 1 if success, 0 if error */
+int _parse_factor(char** p, int* value, int is_folding) {
+    char name[MAX_LABEL_LEN + 1];
+    Symbol* symbol;
+    long number;
+    int len;
+
+    if (**p == '+' || **p == '-') {
+        if (*(*p)++ == '-') {
+            if (!_parse_factor(p, value, is_folding)) {
+                return 0;
+            }
+            return _fit_int(-(long)*value, value, is_folding);
+        }
+        return _parse_factor(p, value, is_folding);
+    }
+    if (**p == '(') {
+        (*p)++;
+        if (!_parse_sum(p, value, is_folding) || **p != ')') {
+            return 0;
+        }
+        (*p)++;
+        return 1;
+    }
+    if (isdigit(**p)) {
+        for (number = 0; isdigit(**p); (*p)++) { /* (stops growing once it's out of range) */
+            number = number > INT_MAX ? number : number * 10 + (**p - '0');
+        }
+        return _fit_int(number, value, is_folding);
+    }
+    for (len = 0; isalnum((*p)[len]); len++) {
+        if (len >= MAX_LABEL_LEN) {
+            return 0;
+        }
+        name[len] = (*p)[len];
+    }
+    if (len == 0 || !isalpha(name[0])) {
+        return 0;
+    }
+    name[len] = '\0';
+    *p += len;
+    *value = 0;
+    if (!is_folding) {
+        return 1;
+    }
+    symbol = find_symbol(name);
+    if (symbol == NULL) {
+        report_error(DIAG_UNDEFINED_SYMBOL, line_num, "Unrecognized constant \'%s\' (a constant is defined by an .equ before it's used)", name);
+        return 0;
+    }
+    if (symbol->type != TYPE_CONST) {
+        report_error(DIAG_CONSTANT, line_num, "Symbol \'%s\' is not a constant (only .equ's can be used in expressions)", name);
+        return 0;
+    }
+    *value = symbol->address;
+    return 1;
+}
+
+/* Looks up the text of a line in the parse memo (NULL if it's not there) */
+MemoEntry* _find_memo(char* body, int has_label) {
+    MemoEntry* entry;
+    if (memo_buckets == NULL) {
+        return NULL;
+    }
+    for (entry = memo_buckets[hash_str(body) % PARSE_MEMO_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->has_label == has_label && strcmp(entry->body, body) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Remembers a valid parsed line by the text after its label (unless the memo is full) */
+void _add_memo(char* body, int has_label, ParsedLine* view) {
+    MemoEntry* entry;
+    unsigned int i_bucket;
+
+    if (n_memo_entries >= PARSE_MEMO_MAX_ENTRIES) {
+        return;
+    }
+    if (memo_buckets == NULL) {
+        memo_buckets = (MemoEntry**)calloc(PARSE_MEMO_BUCKETS, sizeof(MemoEntry*));
+        if (memo_buckets == NULL) {
+            return;
+        }
+    }
+    entry = (MemoEntry*)malloc(sizeof(MemoEntry));
+    if (entry == NULL) {
+        return;
+    }
+    entry->body = str_cpy(body);
+    entry->has_label = has_label;
+    entry->parsed_line = construct_parsed_line(NULL, view->op, view->directive, view->n_args, view->args);
+    i_bucket = hash_str(body) % PARSE_MEMO_BUCKETS;
+    entry->next = memo_buckets[i_bucket];
+    memo_buckets[i_bucket] = entry;
+    n_memo_entries++;
+}
+
+/*
+ * Finds the text of a line after its label (which is how lex_line splits it), copying the line into 'buf'.
+ * The label (if any) is left '\0' terminated at the start of 'buf', and the length of the trimmed line is set.
+ * Returns NULL for an empty line, a comment, or a label by itself (these aren't remembered)
+ */
+char* _split_label(char* line, char* buf, char** label, size_t* len) {
+    char* body;
+    size_t token_len;
+
+    strcpy(buf, line);
+    buf[strcspn(buf, "\n")] = 0;
+    body = trim(buf);
+    *label = NULL;
+    *len = strlen(body);
+    if (*len == 0 || body[0] == ';') {
+        return NULL;
+    }
+    token_len = strcspn(body, " \t");
+    if (body[token_len - 1] == ':') {
+        *label = body;
+        body[token_len - 1] = '\0';
+        body += token_len;
+        body += strspn(body, " \t");
+    }
+    return *body != '\0' ? body : NULL;
+}
+
+/*
+ * This is the main input parsing function which parses and checks the syntax of
+ * each input line, and restructures it for the subsequent assembler stages.
+ * A line whose text after the label was already found valid in this file is taken from the parse memo,
+ * so only its label has to be validated
+ */
+ParsedLine* parse_line(int line_num, char* line) {
+    ParsedLine view;
+    char* args[MAX_ARGS];
+    char buf[LINE_LEN];
+    char* body;
+    char* label;
+    size_t len;
+    MemoEntry* entry;
+    ParsedLine* parsed_line;
+    int n_errors_before;
+    int n_diagnostics_before;
+
+    body = _split_label(line, buf, &label, &len);
+    entry = NULL;
+    if (body != NULL) {
+        parse_stats.n_lookups++;
+        entry = _find_memo(body, label != NULL);
+    }
+    if (entry != NULL) {
+        parse_stats.n_hits++;
+        if (len > MAX_LINE_LEN) {
+            report_error(DIAG_LINE_TOO_LONG, line_num, "Line exceeds max length of %i chars", MAX_LINE_LEN);
+        }
+        if (label != NULL && !_validate_label(label)) {
+            return NULL;
+        }
+        parsed_line = construct_parsed_line(str_cpy(label), entry->parsed_line->op, entry->parsed_line->directive,
+                                            entry->parsed_line->n_args, entry->parsed_line->args);
+    }
+    else {
+        n_errors_before = n_errors;
+        n_diagnostics_before = get_n_diagnostics();
+        view.args = args;
+        if (!lex_line(line_num, line, &view)) {
+            return NULL;
+        }
+        if (body != NULL && n_errors == n_errors_before && get_n_diagnostics() == n_diagnostics_before && !diag_limit_reached()) {
+            _add_memo(body, label != NULL, &view);
+        }
+        parsed_line = construct_parsed_line(str_cpy(view.label), view.op, view.directive, view.n_args, view.args);
     }
-    return construct_parsed_line(label, op, directive, n_args, args);
+
+    /* The file of an .incbin is mapped (and the line is completed) every time, since the same text may stand for
+     * another file, in another directory */
+    if (is_incbin_directive(parsed_line) && !load_incbin(parsed_line)) {
+        free_parsed_line(parsed_line);
+        return NULL;
+    }
+    return parsed_line;
+}
+
+/* Forgets the lines remembered by the parse memo, and resets its stats (before each file) */
+void reset_parse_memo() {
+    MemoEntry* entry;
+    MemoEntry* next;
+    int i;
+    for (i = 0; memo_buckets != NULL && i < PARSE_MEMO_BUCKETS; i++) {
+        for (entry = memo_buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->body);
+            free_parsed_line(entry->parsed_line);
+            free(entry);
+        }
+    }
+    free(memo_buckets);
+    memo_buckets = NULL;
+    n_memo_entries = 0;
+    parse_stats.n_lookups = 0;
+    parse_stats.n_hits = 0;
+}
+
+/* The stats of the parse memo for the current file */
+ParseStats get_parse_stats() {
+    return parse_stats;
 }
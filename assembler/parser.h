@@ -5,7 +5,37 @@
 
 #define MAX_LABEL_LEN 31
 
-/* ParsedLine 'constructor' */
+/* Max number of args on a line (a line of 'LINE_LEN' chars can't have more, since they're comma separated) */
+#define MAX_ARGS (LINE_LEN / 2 + 1)
+
+/* Most distinct lines remembered by the parse memo (per file) */
+#define PARSE_MEMO_MAX_ENTRIES 65536
+
+/* Number of buckets of the hash table of the parse memo */
+#define PARSE_MEMO_BUCKETS 16384
+
+/*!
+ * MemoEntry:
+ * A line that was parsed and found valid (without any errors or warnings), remembered by the text after its label,
+ * so that the same text on another line isn't lexed and validated again (only its label is)
+ */
+typedef struct MemoEntry {
+    char* body;               /* the text of the line after the label (key) */
+    int has_label;            /* (a line with a label is lexed slightly differently, so they aren't mixed up) */
+    ParsedLine* parsed_line;  /* the parsed line, without the label */
+    struct MemoEntry* next;   /* next entry in the same bucket */
+} MemoEntry;
+
+/*!
+ * ParseStats:
+ * How well the parse memo did for the current file
+ */
+typedef struct ParseStats {
+    int n_lookups;
+    int n_hits;
+} ParseStats;
+
+/* ParsedLine 'constructor' (takes ownership of label, the rest is copied) */
 ParsedLine* construct_parsed_line(char* label, char* op, char* directive, int n_args, char** args);
 
 /* Free memory allocated to a ParsedLine */
@@ -25,6 +55,12 @@ ParsedLine* construct_parsed_line(char* label, char* op, char* directive, int n_
 */
 int get_num_data_words(ParsedLine* line);
 
+/*
+ * Calculates the number of zero words reserved by this line (.space), which go to the zero region after the data
+ * (0 if its size is a constant expression: the first pass isn't split between threads then, so it isn't needed)
+ */
+int get_num_space_words(ParsedLine* line);
+
 /*
 * Calculates the number of symbol declarations in the current line (to help when
  * initializing the symbol table)
@@ -37,9 +73,41 @@ int get_num_symbols(ParsedLine* line);
 */
 int get_num_symbol_refs(ParsedLine* line);
 
+/*
+ * Calculates the number of constant expressions (with names in them) in this line, counting an .equ as one
+ * (so that a file that has none can have its first pass split between threads)
+ */
+int get_num_expressions(ParsedLine* line);
+
+/*
+ * Returns whether str (from start_idx) is an integer, or a constant expression: integers and the names of
+ * constants, with + - * / and parentheses (written without spaces, e.g. 'SIZE*4+1')
+ */
+int is_expression(char* str, int start_idx);
+
+/*
+ * The value of an integer or a constant expression (see is_expression) from start_idx, folded with the values of
+ * the constants defined so far (the .equ's before it).
+ * Returns 1 if success, 0 if error (a name that isn't a constant, or a division by zero, which is reported)
+ */
+int get_expression_value(char* str, int start_idx, int* value);
+
+/*
+ * Checks syntax is according to specification without allocating anything: the fields of 'view'
+ * are pointed into the (modified) line buffer, and view->args must have room for MAX_ARGS args.
+ * Returns 1 for a valid op/directive line, 0 for an empty line, a comment or a syntax error
+ */
+int lex_line(int line_num, char* line, ParsedLine* view);
+
 /*
  * Parses, checks syntax is according to specification, and restructures each input line
  */
 ParsedLine* parse_line(int line_num, char* line);
 
+/* Forgets the lines remembered by the parse memo, and resets its stats (before each file) */
+void reset_parse_memo();
+
+/* The stats of the parse memo for the current file */
+ParseStats get_parse_stats();
+
 #endif
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "passes.h"
@@ -5,6 +6,17 @@
 #include "machine_coder.h"
 #include "symbol_table.h"
 #include "parser.h"
+#include "parallel.h"
+#include "diagnostics.h"
+#include "incbin.h"
+
+int _first_pass_parallel(int n_jobs);
+int _resolve_parallel(int n_jobs);
+void _begin_cursor(LineCursor* cursor);
+void _end_cursor(LineCursor* cursor);
+void _encode_op(ParsedLine *parsed_line, LineCursor* cursor);
+void _encode_operand(char *arg, AddrMode addr_mod, LineCursor* cursor);
+void _encode_directive(ParsedLine *parsed_line, LineCursor* cursor);
 
 /*!
  * In the first pass over the parsed input, all label declarations are entered into the symbol table,
@@ -15,17 +27,15 @@
  */
  void first_pass() {
      int i_line;
+     int n_jobs;
      n_errors = 0;
      line_num = 0;
+     line_source = NULL;
 
-     for (i_line = 0; i_line < n_lines; i_line++) {
-         ParsedLine* parsed_line = parsed_lines[i_line];
-         line_num = parsed_line->line_num;
-         if (parsed_line->op != NULL) { /* a code instruction word */
-             handle_op(parsed_line);
-         }
-         else if (parsed_line->directive != NULL) { /* an assembler directive */
-             handle_directive(parsed_line);
+     n_jobs = n_expressions > 0 ? 1 : get_n_jobs(n_lines); /* (see n_expressions) */
+     if (n_jobs == 1 || !_first_pass_parallel(n_jobs)) {
+         for (i_line = 0; i_line < n_lines; i_line++) {
+             first_pass_line(parsed_lines[i_line]);
          }
      }
 
@@ -34,6 +44,127 @@
      shift_data_addresses();
 }
 
+/* Counts the words and symbol references of a chunk of lines (a ChunkWorker) */
+void _count_chunk(void* arg) {
+    FirstPassChunk* chunk = (FirstPassChunk*)arg;
+    int i_line;
+    for (i_line = chunk->from; i_line < chunk->to; i_line++) {
+        chunk->n_code_words += get_num_code_words(parsed_lines[i_line]);
+        chunk->n_data_words += get_num_data_words(parsed_lines[i_line]);
+        chunk->n_space_words += get_num_space_words(parsed_lines[i_line]);
+        chunk->n_symbol_refs += get_num_symbol_refs(parsed_lines[i_line]);
+    }
+}
+
+/* Encodes a chunk of lines from its precomputed place, collecting its symbols (a ChunkWorker) */
+void _encode_chunk(void* arg) {
+    FirstPassChunk* chunk = (FirstPassChunk*)arg;
+    int i_line;
+    for (i_line = chunk->from; i_line < chunk->to; i_line++) {
+        chunk->cursor.line_num = parsed_lines[i_line]->line_num;
+        chunk->cursor.source = parsed_lines[i_line]->source;
+        encode_line(parsed_lines[i_line], &chunk->cursor);
+    }
+}
+
+/*!
+ * The first pass split between 'n_jobs' threads: the number of words and symbol references of each chunk
+ * of lines is counted (in parallel), so that a prefix sum of them gives the IC, DC and place in symbol_references
+ * where each chunk starts. Then the chunks are encoded in parallel, each directly at its place, with the symbols
+ * of each chunk collected into its own list. The lists are then appended to the symbol table in the order of
+ * the lines, so duplicate symbols are reported just like in the serial pass.
+ * Returns 1 if success, 0 if failure (nothing was done, so the serial pass can take over)
+ */
+int _first_pass_parallel(int n_jobs) {
+    FirstPassChunk* chunks;
+    LineCursor start;
+    int i;
+
+    chunks = (FirstPassChunk*)calloc(n_jobs, sizeof(FirstPassChunk));
+    if (chunks == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n_jobs; i++) {
+        get_chunk_range(n_lines, n_jobs, i, &chunks[i].from, &chunks[i].to);
+    }
+    run_parallel(_count_chunk, chunks, sizeof(FirstPassChunk), n_jobs);
+
+    _begin_cursor(&start);
+    for (i = 0; i < n_jobs; i++) {
+        chunks[i].cursor = start;
+        chunks[i].cursor.symbols = &chunks[i].symbols;
+        start.IC += chunks[i].n_code_words;
+        start.DC += chunks[i].n_data_words;
+        start.SC += chunks[i].n_space_words;
+        start.i_symbol_ref += chunks[i].n_symbol_refs;
+    }
+    run_parallel(_encode_chunk, chunks, sizeof(FirstPassChunk), n_jobs);
+
+    for (i = 0; i < n_jobs; i++) {
+        append_symbols(&chunks[i].symbols);
+    }
+    start.line_num = n_lines > 0 ? parsed_lines[n_lines - 1]->line_num : 0;
+    start.source = n_lines > 0 ? parsed_lines[n_lines - 1]->source : NULL;
+    _end_cursor(&start);
+    free(chunks);
+    return 1;
+}
+
+/*!
+ * The first pass over a single parsed line (its symbol, and the code/data words it generates go at the current IC/DC)
+ */
+void first_pass_line(ParsedLine* parsed_line) {
+    LineCursor cursor;
+    line_num = parsed_line->line_num;
+    line_source = parsed_line->source;
+    _begin_cursor(&cursor);
+    encode_line(parsed_line, &cursor);
+    _end_cursor(&cursor);
+}
+
+/*!
+ * Encodes a single parsed line at the place given by 'cursor' (which is moved past its words and references)
+ */
+void encode_line(ParsedLine* parsed_line, LineCursor* cursor) {
+    if (parsed_line->op != NULL) { /* a code instruction word */
+        _encode_op(parsed_line, cursor);
+    }
+    else if (parsed_line->directive != NULL) { /* an assembler directive */
+        _encode_directive(parsed_line, cursor);
+    }
+}
+
+/* A cursor at the current IC, DC and symbol reference (whose symbols go to the symbol table right away) */
+void _begin_cursor(LineCursor* cursor) {
+    cursor->IC = get_IC();
+    cursor->DC = get_DC();
+    cursor->SC = get_SC();
+    cursor->i_symbol_ref = i_symbol_ref;
+    cursor->line_num = line_num;
+    cursor->source = line_source;
+    cursor->symbols = NULL;
+}
+
+/* Moves the current IC, DC and symbol reference to where a cursor got to */
+void _end_cursor(LineCursor* cursor) {
+    seek_counters(cursor->IC, cursor->DC, cursor->SC);
+    i_symbol_ref = cursor->i_symbol_ref;
+    line_num = cursor->line_num;
+    line_source = cursor->source;
+}
+
+/* Enters a symbol declared by the line at the cursor (before any of the line's words) */
+void _add_cursor_symbol(LineCursor* cursor, char* label, SymType type, SymLoc loc) {
+    if (cursor->symbols == NULL) {
+        add_symbol(label, type, loc); /* (the cursor is at the current IC/DC) */
+    }
+    else {
+        list_symbol(cursor->symbols, label, type, loc,
+                    loc == LOC_EXTERNAL ? 0 : type == TYPE_CODE ? cursor->IC : type == TYPE_SPACE ? cursor->SC : cursor->DC,
+                    cursor->line_num, cursor->source);
+    }
+}
+
 /*!
 * Now that all the symbols have been entered into the table, we can resolve all the addresses of the
  * labels that were referenced (either 'directly' or 'relatively') and fill in the information in the placeholders
@@ -43,13 +174,16 @@
 void second_pass() {
     int i;
     int i_line;
+    int n_jobs;
     line_num = 0;
+    line_source = NULL;
     n_errors = 0;
 
     /*! Update symbols from 'entry' directives with the 'entry' attribute in the table */
     for (i_line = 0; i_line < n_lines; i_line++) {
         ParsedLine* parsed_line = parsed_lines[i_line];
         line_num = parsed_line->line_num;
+        line_source = parsed_line->source;
         if (parsed_line->directive != NULL && strcmp(parsed_line->directive, ".entry") == 0) {
             update_entry_symbol(parsed_line->args[0]);
         }
@@ -57,19 +191,89 @@ void second_pass() {
 
     /*! Finally fill in addresses and linker info (A-R-E) for label operands that were referenced
      * using direct and relative address modes, and whose addresses are now in the symbol table */
-    for (i = 0; i < i_symbol_ref; i++) {
-        SymbolInfo symbol_info = symbol_references[i];
-        line_num = symbol_info.line_num;
-        edit_operand(symbol_info.IC, symbol_info.label, symbol_info.addrMode);
+    n_jobs = get_n_jobs(i_symbol_ref);
+    if (n_jobs == 1 || !_resolve_parallel(n_jobs)) {
+        for (i = 0; i < i_symbol_ref; i++) {
+            SymbolInfo symbol_info = symbol_references[i];
+            line_num = symbol_info.line_num;
+            line_source = symbol_info.source;
+            edit_operand(symbol_info.IC, symbol_info.label, symbol_info.addrMode);
+        }
+    }
+}
+
+/* Resolves a chunk of the symbol references, collecting the undefined ones (a ChunkWorker) */
+void _resolve_chunk(void* arg) {
+    FixupChunk* chunk = (FixupChunk*)arg;
+    SymbolInfo* symbol_info;
+    int* undefined;
+    int i;
+
+    for (i = chunk->from; i < chunk->to; i++) {
+        symbol_info = &symbol_references[i];
+        if (resolve_operand(symbol_info->IC, symbol_info->label, symbol_info->addrMode) || chunk->failed) {
+            continue;
+        }
+        if (chunk->n_undefined % INPUT_BATCH_SIZE == 0) {
+            undefined = (int*)realloc(chunk->undefined, sizeof(int) * (chunk->n_undefined + INPUT_BATCH_SIZE));
+            if (undefined == NULL) {
+                chunk->failed = 1;
+                continue;
+            }
+            chunk->undefined = undefined;
+        }
+        chunk->undefined[chunk->n_undefined++] = i;
     }
 }
 
+/*!
+ * Resolves the symbol references split between 'n_jobs' threads (the symbol table is complete, so they only read it,
+ * and each reference edits its own operand word). The undefined symbols found by each chunk are then reported
+ * in the order of the chunks, which is the order of the lines, so the errors are the same as in the serial pass.
+ * Returns 1 if success, 0 if failure (nothing was done, so the serial pass can take over)
+ */
+int _resolve_parallel(int n_jobs) {
+    FixupChunk* chunks;
+    SymbolInfo* symbol_info;
+    int i;
+    int j;
+
+    chunks = (FixupChunk*)calloc(n_jobs, sizeof(FixupChunk));
+    if (chunks == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n_jobs; i++) {
+        get_chunk_range(i_symbol_ref, n_jobs, i, &chunks[i].from, &chunks[i].to);
+    }
+    run_parallel(_resolve_chunk, chunks, sizeof(FixupChunk), n_jobs);
+
+    for (i = 0; i < n_jobs; i++) {
+        for (j = chunks[i].from; j < chunks[i].to; j++) {
+            if (chunks[i].failed) { /* (couldn't collect them, so resolve the chunk again to report them) */
+                symbol_info = &symbol_references[j];
+            }
+            else if (j - chunks[i].from < chunks[i].n_undefined) {
+                symbol_info = &symbol_references[chunks[i].undefined[j - chunks[i].from]];
+            }
+            else {
+                break;
+            }
+            line_num = symbol_info->line_num;
+            line_source = symbol_info->source;
+            edit_operand(symbol_info->IC, symbol_info->label, symbol_info->addrMode);
+        }
+        free(chunks[i].undefined);
+    }
+    free(chunks);
+    return 1;
+}
+
 /*!
  * Used in the first pass: Generates instruction words and operand words (for the lines with an 'op'
  * in the source code) to go into the code image. Some info will be missing due to label references whose
  * addresses have not yet been entered into the symbol table. This will be filled in in the second pass.
  */
-void handle_op(ParsedLine *parsed_line) {
+void _encode_op(ParsedLine *parsed_line, LineCursor* cursor) {
     int i_arg;
     int reg_1 = 0;
     int reg_2 = 0;
@@ -81,7 +285,7 @@ void handle_op(ParsedLine *parsed_line) {
 
     /* Enter label (if there is one) into symbol table before adding new code */
     if (parsed_line->label != NULL) {
-        add_symbol(parsed_line->label, TYPE_CODE, LOC_UNK);
+        _add_cursor_symbol(cursor, parsed_line->label, TYPE_CODE, LOC_UNK);
     }
 
     /* Add instruction word to code image: */
@@ -108,17 +312,25 @@ void handle_op(ParsedLine *parsed_line) {
             }
         }
     }
-    add_instruction(op->opcode, addr_mod_1, reg_1, addr_mod_2, reg_2, op->funct);
+    put_instruction(cursor->IC++, op->opcode, addr_mod_1, reg_1, addr_mod_2, reg_2, op->funct);
 
     /* Add an operand word for each (non-register) arg: */
     if (arg_1 != NULL) {
-        handle_operand(arg_1, addr_mod_1);
+        _encode_operand(arg_1, addr_mod_1, cursor);
     }
     if (arg_2 != NULL) {
-        handle_operand(arg_2, addr_mod_2);
+        _encode_operand(arg_2, addr_mod_2, cursor);
     }
 }
 
+/* Used in the first pass: the op line at the current IC */
+void handle_op(ParsedLine *parsed_line) {
+    LineCursor cursor;
+    _begin_cursor(&cursor);
+    _encode_op(parsed_line, &cursor);
+    _end_cursor(&cursor);
+}
+
 /*!
  * Used in first pass: Adds an operand word for each (non-register) arg
  * For IMMEDIATE operands, we can add the full information.
@@ -126,27 +338,38 @@ void handle_op(ParsedLine *parsed_line) {
  * and we will store some other information on the side to be used in the
  * 'second pass' to fill in the missing details:
  */
-void handle_operand(char *arg, AddrMode addr_mod) {
+void _encode_operand(char *arg, AddrMode addr_mod, LineCursor* cursor) {
+    int value;
     switch (addr_mod) {
-        case IMMEDIATE: /* first remove the '#' prefix */
-            add_operand(get_int_value(arg, 1), Linker_A);
+        case IMMEDIATE: /* first remove the '#' prefix (a constant expression is folded into an absolute word) */
+            get_expression_value(arg, 1, &value);
+            put_operand(cursor->IC++, value, Linker_A);
             return;
         case RELATIVE: /* first remove the '&' prefix */
             arg = get_substr(arg, 1, strlen(arg));
         case DIRECT: {
             SymbolInfo symbolInfo;
-            symbolInfo.line_num = line_num;
-            symbolInfo.IC = get_IC();
+            symbolInfo.line_num = cursor->line_num;
+            symbolInfo.source = cursor->source;
+            symbolInfo.IC = cursor->IC;
             symbolInfo.label = arg;
             symbolInfo.addrMode = addr_mod;
-            symbol_references[i_symbol_ref++] = symbolInfo;
-            add_operand(0, Linker_UNK);
+            symbol_references[cursor->i_symbol_ref++] = symbolInfo;
+            put_operand(cursor->IC++, 0, Linker_UNK);
         case REGISTER:
             {/* these are encoded inside the instruction word and do not generate operand words */}
         }
     }
 }
 
+/* Used in first pass: an operand word at the current IC */
+void handle_operand(char *arg, AddrMode addr_mod) {
+    LineCursor cursor;
+    _begin_cursor(&cursor);
+    _encode_operand(arg, addr_mod, &cursor);
+    _end_cursor(&cursor);
+}
+
 /* Detect AddrMode of input arg */
 AddrMode get_addr_mode(char* str) {
     if (str[0] == '#') {
@@ -165,29 +388,69 @@ AddrMode get_addr_mode(char* str) {
  * For first pass - enter numerical and string data into data image and symbol table
  * and also extern symbols into the symbol table:
  */
-void handle_directive(ParsedLine *parsed_line) {
+void _encode_directive(ParsedLine *parsed_line, LineCursor* cursor) {
     int i_arg;
     int i;
+    int value;
+    int n_words;
+    int width;
 
-    if (strcmp(parsed_line->directive, ".data") == 0 || strcmp(parsed_line->directive, ".string") == 0) {
+    if (strcmp(parsed_line->directive, ".data") == 0 || strcmp(parsed_line->directive, ".string") == 0 ||
+        is_incbin_directive(parsed_line)) {
         /* Enter data symbol (if there is was a label in the src code) into symbol table,
-         * and then add the new integer/string data: */
+         * and then add the new integer/string/binary data: */
         if (parsed_line->label != NULL) {
-            add_symbol(parsed_line->label, TYPE_DATA, LOC_UNK);
+            _add_cursor_symbol(cursor, parsed_line->label, TYPE_DATA, LOC_UNK);
         }
         if (strcmp(parsed_line->directive, ".data") == 0) {
             for (i_arg = 0; i_arg < parsed_line->n_args; i_arg++) {
-                add_data(get_int_value(parsed_line->args[i_arg], 0));
+                get_expression_value(parsed_line->args[i_arg], 0, &value);
+                put_data(cursor->DC++, value);
+            }
+        }
+        else if (is_incbin_directive(parsed_line)) { /* binary data: the words are read from the mapped file */
+            n_words = get_incbin_words(parsed_line);
+            width = get_incbin_width(parsed_line);
+            for (i = 0; i < n_words; i++) {
+                put_data(cursor->DC++, get_incbin_word(parsed_line->binary + i * width, width));
             }
         }
         else { /* string data: need to convert it to a seq of ascii values (excluding the quotes) */
             for (i = 1; i < strlen(parsed_line->args[0]) -1; i++) {
-                add_data((int)parsed_line->args[0][i]);
+                put_data(cursor->DC++, (int)parsed_line->args[0][i]);
             }
-            add_data(0); /* terminating 0 */
+            put_data(cursor->DC++, 0); /* terminating 0 */
+        }
+    }
+    else if (strcmp(parsed_line->directive, ".space") == 0) {
+        /* Reserved words only move the SC: they're zeros in the zero region, which isn't kept in the data image
+         * (a negative size in a constant expression is reported here, and taken as 0) */
+        if (parsed_line->label != NULL) {
+            _add_cursor_symbol(cursor, parsed_line->label, TYPE_SPACE, LOC_UNK);
         }
+        if (get_expression_value(parsed_line->args[0], 0, &value) && value < 0) {
+            report_error(DIAG_DIRECTIVE_ARGS, cursor->line_num, "Invalid size %i for \'.space\' (must not be negative)", value);
+        }
+        cursor->SC += value > 0 ? value : 0;
     }
     else if (strcmp(parsed_line->directive, ".extern") == 0) {
-        add_symbol(parsed_line->args[0], TYPE_UNK, LOC_EXTERNAL);
+        _add_cursor_symbol(cursor, parsed_line->args[0], TYPE_UNK, LOC_EXTERNAL);
+    }
+    else if (strcmp(parsed_line->directive, ".equ") == 0) {
+        /* A constant goes to the symbol table right away, even when the other symbols of the line are collected
+         * into the cursor's list, since the lines after it need its value. The table isn't safe to share between
+         * threads (it's a plain global, only THREAD_LOCAL with -DASM_LIBRARY); that's fine because files with
+         * constants are encoded on one thread (see n_expressions, and the pipeline's deferred lines).
+         * (If its expression is wrong, it's still defined, as 0, so that its uses aren't reported too) */
+        get_expression_value(parsed_line->args[1], 0, &value);
+        add_constant(parsed_line->args[0], value);
     }
 }
+
+/* For first pass - the directive line at the current DC */
+void handle_directive(ParsedLine *parsed_line) {
+    LineCursor cursor;
+    _begin_cursor(&cursor);
+    _encode_directive(parsed_line, &cursor);
+    _end_cursor(&cursor);
+}
@@ -2,6 +2,49 @@
 #define FIRST_PASS_H
 
 #include "assembler.h"
+#include "symbol_table.h"
+
+/*
+ * LineCursor:
+ * Where the words, symbol references and symbols of the lines being encoded go
+ * (when lines are encoded in parallel, each chunk of lines starts at its precomputed place)
+ */
+typedef struct LineCursor {
+    unsigned int IC;
+    unsigned int DC;
+    unsigned int SC;
+    int i_symbol_ref;
+    int line_num;
+    char* source; /* the included file of the line (see ParsedLine) */
+    SymbolList* symbols; /* NULL to add the symbols to the symbol table right away */
+} LineCursor;
+
+/*
+ * FirstPassChunk:
+ * A chunk of the lines encoded in parallel by the first pass (lines from..to-1)
+ */
+typedef struct FirstPassChunk {
+    int from;
+    int to;
+    int n_code_words;
+    int n_data_words;
+    int n_space_words;
+    int n_symbol_refs;
+    LineCursor cursor;   /* where the chunk starts (the prefix sum of the counts of the chunks before it) */
+    SymbolList symbols;  /* the symbols declared by the chunk, in order */
+} FirstPassChunk;
+
+/*
+ * FixupChunk:
+ * A chunk of the symbol references resolved in parallel by the second pass (symbol_references from..to-1)
+ */
+typedef struct FixupChunk {
+    int from;
+    int to;
+    int n_undefined;
+    int* undefined;  /* the indexes of the references to undefined symbols, in order */
+    int failed;      /* failed to allocate 'undefined' */
+} FixupChunk;
 
 /*
 * In the first pass over the parsed input, all label declarations are entered into the symbol table,
@@ -12,6 +55,16 @@
 */
  void first_pass();
 
+/*
+ * The first pass over a single parsed line (its symbol, and the code/data words it generates go at the current IC/DC)
+ */
+void first_pass_line(ParsedLine* parsed_line);
+
+/*
+ * Encodes a single parsed line at the place given by 'cursor' (which is moved past its words and references)
+ */
+void encode_line(ParsedLine* parsed_line, LineCursor* cursor);
+
 /*
 * Now that all the symbols have been entered into the table, we can resolve all the addresses of the
  * labels that were referenced (either 'directly' or 'relatively') and fill in the information in the placeholders
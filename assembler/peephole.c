@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "peephole.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+#include "string_utils.h"
+
+/* What optimize_code did to the current file */
+static THREAD_LOCAL PeepholeStats stats;
+
+/* What relax_branches did to the current file */
+static THREAD_LOCAL RelaxStats relax_stats;
+
+/* What eliminate_unreachable did to the current file */
+static THREAD_LOCAL UnreachableStats unreachable_stats;
+
+int _is_op(int i_word, char* name);
+int _find_target(int i_word, int* ref_at, int n_code);
+int _is_no_op(int i_word, int n_code);
+void _retarget_branch(int i_word, int* ref_at, int n_code);
+void _remove_words(char* is_removed, int* removed_before, int n_code);
+int _is_branch(int i_word);
+int _is_terminator(int i_word);
+void _mark_roots(char* is_root, int n_code);
+int _has_undefined_ref(int from, int to, int* ref_at);
+
+/*
+ * The peephole optimizer (-O), run between the first and the second pass over the encoded code image.
+ * The branches are retargeted first (in order), and then the instructions are removed from the last one back,
+ * so that a jmp is known to be followed only by removed instructions up to its target
+ */
+void optimize_code() {
+    int n_code;
+    int* ref_at;
+    int* starts;
+    char* is_removed;
+    int* removed_before;
+    int n_starts;
+    int next_kept;
+    int target;
+    int end;
+    int i;
+    int k;
+    WordType type;
+
+    memset(&stats, 0, sizeof(PeepholeStats));
+    n_code = get_IC() - MEM_START_ADDRESS;
+    ref_at = (int*)malloc(sizeof(int) * (n_code + 1));
+    starts = (int*)malloc(sizeof(int) * (n_code + 1));
+    is_removed = (char*)malloc(n_code + 1);
+    removed_before = (int*)malloc(sizeof(int) * (n_code + 1));
+    if (ref_at == NULL || starts == NULL || is_removed == NULL || removed_before == NULL) { /* (it's optional) */
+        free(ref_at);
+        free(starts);
+        free(is_removed);
+        free(removed_before);
+        return;
+    }
+
+    /* The symbol reference of each operand word (if any): */
+    for (i = 0; i < n_code; i++) {
+        ref_at[i] = -1;
+    }
+    for (k = 0; k < i_symbol_ref; k++) {
+        ref_at[symbol_references[k].IC - MEM_START_ADDRESS] = k;
+    }
+
+    /* Retarget the branches to jmp's, and collect where the instructions start: */
+    n_starts = 0;
+    for (i = 0; i < n_code; i++) {
+        get_code_word(MEM_START_ADDRESS + i, &type);
+        if (type == INSTRUCTION) {
+            starts[n_starts++] = i;
+            if (_is_op(i, "jmp") || _is_op(i, "bne") || _is_op(i, "jsr")) {
+                _retarget_branch(i, ref_at, n_code);
+            }
+        }
+    }
+
+    /* Remove the no-ops, and the jumps to where the code after them (without the removed instructions) starts
+     * (but not an instruction that references an undefined symbol, which the second pass has to report): */
+    memset(is_removed, 0, n_code + 1);
+    next_kept = n_code;
+    for (k = n_starts - 1; k >= 0; k--) {
+        i = starts[k];
+        end = k + 1 < n_starts ? starts[k + 1] : n_code;
+        target = _is_op(i, "jmp") || _is_op(i, "bne") ? _find_target(i, ref_at, n_code) : -1;
+        if ((_is_no_op(i, n_code) || (target >= end && target <= next_kept)) && !_has_undefined_ref(i, end, ref_at)) {
+            memset(is_removed + i, 1, end - i);
+            stats.n_removed_instructions++;
+            stats.n_removed_words += end - i;
+        }
+        else {
+            next_kept = i;
+        }
+    }
+    if (stats.n_removed_words > 0) {
+        _remove_words(is_removed, removed_before, n_code);
+    }
+
+    free(ref_at);
+    free(starts);
+    free(is_removed);
+    free(removed_before);
+}
+
+/* What optimize_code did to the current file */
+PeepholeStats get_peephole_stats() {
+    return stats;
+}
+
+/*
+ * Unreachable code elimination (--gc-code). A block starts at the first instruction, at a branch target or a root,
+ * and after a branch, a stop or an rts. The blocks are then walked from the roots (the words are reached
+ * through their blocks, so a block is kept whole or removed whole)
+ */
+void eliminate_unreachable() {
+    int n_code;
+    int* ints;
+    char* flags;
+    int* ref_at;
+    char* is_leader;
+    char* is_root;
+    int* block_of;
+    int* block_start;
+    int* block_last;
+    char* is_reached;
+    int* stack;
+    char* is_removed;
+    int* removed_before;
+    int n_stack;
+    int i_block;
+    int target;
+    int last;
+    int i;
+    int k;
+    WordType type;
+
+    memset(&unreachable_stats, 0, sizeof(UnreachableStats));
+    n_code = get_IC() - MEM_START_ADDRESS;
+    /* (the arrays of ints, and those of flags, are each taken from one block) */
+    ints = (int*)malloc(sizeof(int) * 6 * (n_code + 1));
+    flags = (char*)calloc(4 * (n_code + 1), 1);
+    if (ints == NULL || flags == NULL) { /* (it's optional) */
+        free(ints);
+        free(flags);
+        return;
+    }
+    ref_at = ints;
+    block_of = ints + (n_code + 1);
+    block_start = ints + 2 * (n_code + 1);
+    block_last = ints + 3 * (n_code + 1);
+    stack = ints + 4 * (n_code + 1);
+    removed_before = ints + 5 * (n_code + 1);
+    is_leader = flags;
+    is_root = flags + (n_code + 1);
+    is_reached = flags + 2 * (n_code + 1);
+    is_removed = flags + 3 * (n_code + 1);
+
+    for (i = 0; i < n_code; i++) {
+        ref_at[i] = -1;
+    }
+    for (k = 0; k < i_symbol_ref; k++) {
+        ref_at[symbol_references[k].IC - MEM_START_ADDRESS] = k;
+    }
+    _mark_roots(is_root, n_code);
+
+    /* The leaders, then the blocks (from a leader up to the next one) and the last instruction of each: */
+    last = -1;
+    for (i = 0; i < n_code; i++) {
+        get_code_word(MEM_START_ADDRESS + i, &type);
+        if (type != INSTRUCTION) {
+            continue;
+        }
+        is_leader[i] |= last < 0 || is_root[i] || _is_branch(last) || _is_terminator(last);
+        target = _is_branch(i) ? _find_target(i, ref_at, n_code) : -1;
+        if (target >= 0) {
+            is_leader[target] = 1;
+        }
+        last = i;
+    }
+    for (i = 0; i < n_code; i++) {
+        get_code_word(MEM_START_ADDRESS + i, &type);
+        if (type == INSTRUCTION && is_leader[i]) {
+            block_start[unreachable_stats.n_blocks++] = i;
+        }
+        block_of[i] = unreachable_stats.n_blocks - 1;
+        if (type == INSTRUCTION) {
+            block_last[unreachable_stats.n_blocks - 1] = i;
+        }
+    }
+
+    /* Walk the blocks from the roots: */
+    n_stack = 0;
+    for (i = 0; i < n_code; i++) {
+        if ((i == 0 || is_root[i]) && !is_reached[block_of[i]]) {
+            is_reached[block_of[i]] = 1;
+            stack[n_stack++] = block_of[i];
+        }
+    }
+    while (n_stack > 0) {
+        i_block = stack[--n_stack];
+        last = block_last[i_block];
+        target = _is_branch(last) ? _find_target(last, ref_at, n_code) : -1;
+        if (target >= 0 && !is_reached[block_of[target]]) {
+            is_reached[block_of[target]] = 1;
+            stack[n_stack++] = block_of[target];
+        }
+        if (!_is_op(last, "jmp") && !_is_terminator(last) && i_block + 1 < unreachable_stats.n_blocks &&
+            !is_reached[i_block + 1]) {
+            is_reached[i_block + 1] = 1;
+            stack[n_stack++] = i_block + 1;
+        }
+    }
+
+    /* (the blocks that reference undefined symbols are kept, for the second pass to report them) */
+    for (i = 0; i < unreachable_stats.n_blocks; i++) {
+        last = i + 1 < unreachable_stats.n_blocks ? block_start[i + 1] : n_code;
+        if (!is_reached[i] && _has_undefined_ref(block_start[i], last, ref_at)) {
+            is_reached[i] = 1;
+        }
+    }
+    for (i = 0; i < n_code; i++) {
+        if (!is_reached[block_of[i]]) {
+            is_removed[i] = 1;
+            unreachable_stats.n_removed_words++;
+            unreachable_stats.n_removed_blocks += block_start[block_of[i]] == i;
+        }
+    }
+    if (unreachable_stats.n_removed_words > 0) {
+        _remove_words(is_removed, removed_before, n_code);
+    }
+
+    free(ints);
+    free(flags);
+}
+
+/* What eliminate_unreachable did to the current file */
+UnreachableStats get_unreachable_stats() {
+    return unreachable_stats;
+}
+
+/*
+ * Branch relaxation (--relax-branches): the operand word of a branch is the one right after its instruction word,
+ * so a DIRECT reference there to a symbol of this file is switched to RELATIVE (in both the reference, which the
+ * second pass fills in by, and the instruction word). Undefined symbols are left for the second pass to report
+ */
+void relax_branches() {
+    SymbolInfo* reference;
+    Instruction* instruction;
+    Symbol* symbol;
+    WordType type;
+    int i_word;
+    int k;
+
+    memset(&relax_stats, 0, sizeof(RelaxStats));
+    for (k = 0; k < i_symbol_ref; k++) {
+        reference = &symbol_references[k];
+        if (reference->addrMode != DIRECT) {
+            continue;
+        }
+        symbol = find_symbol(reference->label);
+        if (symbol == NULL || symbol->loc == LOC_EXTERNAL) {
+            continue;
+        }
+        relax_stats.n_relocations_before++;
+        i_word = reference->IC - MEM_START_ADDRESS - 1;
+        if (_is_op(i_word, "jmp") || _is_op(i_word, "bne") || _is_op(i_word, "jsr")) {
+            instruction = &get_code_word(reference->IC - 1, &type)->instruction;
+            instruction->arg_2_mode = RELATIVE;
+            reference->addrMode = RELATIVE;
+        }
+        else {
+            relax_stats.n_relocations_after++;
+        }
+    }
+}
+
+/* What relax_branches did to the current file */
+RelaxStats get_relax_stats() {
+    return relax_stats;
+}
+
+/* Whether the instruction at the code word 'i_word' is the op 'name' */
+int _is_op(int i_word, char* name) {
+    Instruction* instruction;
+    WordType type;
+    Op* op;
+
+    instruction = &get_code_word(MEM_START_ADDRESS + i_word, &type)->instruction;
+    op = get_op(name);
+    return type == INSTRUCTION && instruction->opcode == op->opcode && instruction->funct == op->funct;
+}
+
+/* The code word that the branch at 'i_word' goes to, if it's an instruction of this file (-1 if not) */
+int _find_target(int i_word, int* ref_at, int n_code) {
+    Symbol* symbol;
+    WordType type;
+    int target;
+
+    if (i_word + 1 >= n_code || ref_at[i_word + 1] < 0) {
+        return -1;
+    }
+    symbol = find_symbol(symbol_references[ref_at[i_word + 1]].label);
+    if (symbol == NULL || symbol->type != TYPE_CODE || symbol->loc == LOC_EXTERNAL) {
+        return -1;
+    }
+    target = symbol->address - MEM_START_ADDRESS;
+    if (target < 0 || target >= n_code) {
+        return -1;
+    }
+    get_code_word(MEM_START_ADDRESS + target, &type);
+    return type == INSTRUCTION ? target : -1;
+}
+
+/* Whether the instruction at 'i_word' does nothing ('add #0, X', 'sub #0, X' or 'mov rX, rX') */
+int _is_no_op(int i_word, int n_code) {
+    Instruction* instruction;
+    Operand* operand;
+    WordType type;
+
+    instruction = &get_code_word(MEM_START_ADDRESS + i_word, &type)->instruction;
+    if (_is_op(i_word, "mov")) {
+        return instruction->arg_1_mode == REGISTER && instruction->arg_2_mode == REGISTER &&
+               instruction->reg_1 == instruction->reg_2;
+    }
+    if ((_is_op(i_word, "add") || _is_op(i_word, "sub")) && instruction->arg_1_mode == IMMEDIATE && i_word + 1 < n_code) {
+        operand = &get_code_word(MEM_START_ADDRESS + i_word + 1, &type)->operand;
+        return operand->value == 0;
+    }
+    return 0;
+}
+
+/* Retargets the branch at 'i_word' to the end of the chain of jmp's that it goes to (if it goes to one) */
+void _retarget_branch(int i_word, int* ref_at, int n_code) {
+    SymbolInfo* reference;
+    char* label = NULL;
+    int target;
+    int next;
+    int n_hops;
+
+    target = _find_target(i_word, ref_at, n_code);
+    for (n_hops = 0; target >= 0 && n_hops < PEEPHOLE_MAX_CHAIN && _is_op(target, "jmp"); n_hops++) {
+        next = _find_target(target, ref_at, n_code);
+        if (next < 0) {
+            break;
+        }
+        label = symbol_references[ref_at[target + 1]].label;
+        target = next;
+    }
+    reference = &symbol_references[ref_at[i_word + 1]];
+    if (label != NULL && strcmp(label, reference->label) != 0) {
+        label = str_cpy(label);
+        if (label != NULL) {
+            free(reference->label);
+            reference->label = label;
+            stats.n_retargeted_branches++;
+        }
+    }
+}
+
+/* Whether the instruction at 'i_word' is a jmp, a bne or a jsr */
+int _is_branch(int i_word) {
+    return _is_op(i_word, "jmp") || _is_op(i_word, "bne") || _is_op(i_word, "jsr");
+}
+
+/* Whether the instruction at 'i_word' never goes on to the next one (stop or rts) */
+int _is_terminator(int i_word) {
+    return _is_op(i_word, "stop") || _is_op(i_word, "rts");
+}
+
+/*
+ * Flags the code words that the program may start at, other than the first one: those of the .entry labels,
+ * and those of the labels that are referenced other than as the target of a branch (their address may be used)
+ */
+void _mark_roots(char* is_root, int n_code) {
+    Symbol* symbol;
+    int address;
+    int i;
+
+    for (i = 0; i < i_symbol_ref; i++) {
+        symbol = find_symbol(symbol_references[i].label);
+        address = symbol_references[i].IC - MEM_START_ADDRESS;
+        if (symbol != NULL && symbol->type == TYPE_CODE && symbol->loc != LOC_EXTERNAL && !_is_branch(address - 1) &&
+            symbol->address >= MEM_START_ADDRESS && symbol->address < MEM_START_ADDRESS + n_code) {
+            is_root[symbol->address - MEM_START_ADDRESS] = 1;
+        }
+    }
+    for (i = 0; i < n_lines; i++) {
+        if (parsed_lines[i]->directive != NULL && strcmp(parsed_lines[i]->directive, ".entry") == 0) {
+            symbol = find_symbol(parsed_lines[i]->args[0]);
+            if (symbol != NULL && symbol->type == TYPE_CODE &&
+                symbol->address >= MEM_START_ADDRESS && symbol->address < MEM_START_ADDRESS + n_code) {
+                is_root[symbol->address - MEM_START_ADDRESS] = 1;
+            }
+        }
+    }
+}
+
+/* Whether any of the code words from 'from' up to 'to' references a symbol that isn't defined */
+int _has_undefined_ref(int from, int to, int* ref_at) {
+    int i;
+    for (i = from; i < to; i++) {
+        if (ref_at[i] >= 0 && find_symbol(symbol_references[ref_at[i]].label) == NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Removes the flagged code words, and moves back the words, the symbols and the symbol references after them */
+void _remove_words(char* is_removed, int* removed_before, int n_code) {
+    int n_kept;
+    int i;
+    int k;
+
+    removed_before[0] = 0;
+    for (i = 0; i < n_code; i++) {
+        removed_before[i + 1] = removed_before[i] + is_removed[i];
+    }
+    n_kept = 0;
+    for (k = 0; k < i_symbol_ref; k++) {
+        i = symbol_references[k].IC - MEM_START_ADDRESS;
+        if (is_removed[i]) {
+            free(symbol_references[k].label);
+            continue;
+        }
+        symbol_references[n_kept] = symbol_references[k];
+        symbol_references[n_kept].IC -= removed_before[i];
+        n_kept++;
+    }
+    i_symbol_ref = n_kept;
+    remove_code_words(is_removed);
+    remove_code_addresses(removed_before, n_code);
+}
@@ -0,0 +1,72 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "assembler.h"
+
+/* Most jumps followed when retargeting a branch to the end of a chain of jumps (a longer chain is cut there) */
+#define PEEPHOLE_MAX_CHAIN 64
+
+/*!
+ * PeepholeStats:
+ * What the peephole optimizer (-O) did to the file that was just assembled
+ */
+typedef struct PeepholeStats {
+    int n_removed_instructions;
+    int n_removed_words;
+    int n_retargeted_branches;
+} PeepholeStats;
+
+/*
+ * The peephole optimizer (-O), run between the first and the second pass over the encoded code image:
+ *  - a branch (jmp/bne/jsr) to a jmp is retargeted to where that jmp goes (following chains of them)
+ *  - a jmp/bne to the very next instruction is removed
+ *  - 'add #0, X', 'sub #0, X' and 'mov rX, rX' are removed (in this machine only cmp sets the flags)
+ * Then the code after each removed word is moved back, and so are the symbols and the symbol references,
+ * so that the second pass fills in the operands at their new addresses
+ */
+void optimize_code();
+
+/* What optimize_code did to the current file */
+PeepholeStats get_peephole_stats();
+
+/*!
+ * UnreachableStats:
+ * What the unreachable code elimination (--gc-code) did to the file that was just assembled
+ */
+typedef struct UnreachableStats {
+    int n_blocks;           /* the basic blocks of the code */
+    int n_removed_blocks;
+    int n_removed_words;
+} UnreachableStats;
+
+/*
+ * Unreachable code elimination (--gc-code), run between the first and the second pass (after -O):
+ * the code is split into basic blocks, with edges for the fall-through and the jmp/bne/jsr targets (DIRECT or
+ * RELATIVE), and the blocks that can't be reached from the first instruction, an .entry label or a label that is
+ * used other than by a branch (e.g. by lea) are removed, the same way -O removes words
+ */
+void eliminate_unreachable();
+
+/* What eliminate_unreachable did to the current file */
+UnreachableStats get_unreachable_stats();
+
+/*!
+ * RelaxStats:
+ * The relocatable (Linker_R) words of the file that was just assembled, with and without --relax-branches
+ */
+typedef struct RelaxStats {
+    int n_relocations_before;
+    int n_relocations_after;
+} RelaxStats;
+
+/*
+ * Branch relaxation (--relax-branches), run between the first and the second pass:
+ * a jmp/bne/jsr to a symbol of this file is switched from DIRECT to RELATIVE addressing, so that its operand
+ * is an absolute distance instead of an address the loader has to relocate (externals stay DIRECT)
+ */
+void relax_branches();
+
+/* What relax_branches did to the current file */
+RelaxStats get_relax_stats();
+
+#endif
@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200112L /* for sched_yield() and the pthreads */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "parser.h"
+#include "passes.h"
+#include "machine_coder.h"
+#include "symbol_table.h"
+#include "include_cache.h"
+#include "diagnostics.h"
+
+static LineRing ring;
+
+/* Set if the encoder thread couldn't be started (the reader then encodes each line itself), or was stopped
+ * at the first constant */
+static int is_inline = 0;
+static pthread_t encoder;
+
+/* Set from the first constant (an .equ or an expression) on: the lines from there are only kept (in parsed_lines,
+ * from 'first_deferred'), and finish_pipelined_pass encodes them the same way as first_pass */
+static int is_deferred = 0;
+static int first_deferred = 0;
+
+/* The state of the encoder: where the next line goes, and the symbols so far (in the order of the lines) */
+static LineCursor cursor;
+static SymbolList symbols;
+static int is_out_of_memory = 0;
+
+
+/*********************************** Ring ***********************************/
+
+/* Pushes a line to the ring (waiting while it's full). Only called by the reader */
+void _push_line(ParsedLine* parsed_line) {
+    unsigned long head = ring.head;
+    while (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) == PIPELINE_RING_SIZE) {
+        sched_yield();
+    }
+    ring.lines[head % PIPELINE_RING_SIZE] = parsed_line;
+    __atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Pops a line from the ring (waiting while it's empty). Only called by the encoder */
+ParsedLine* _pop_line() {
+    unsigned long tail = ring.tail;
+    ParsedLine* parsed_line;
+    while (__atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) == tail) {
+        sched_yield();
+    }
+    parsed_line = ring.lines[tail % PIPELINE_RING_SIZE];
+    __atomic_store_n(&ring.tail, tail + 1, __ATOMIC_RELEASE);
+    return parsed_line;
+}
+
+
+/*********************************** Encoder ***********************************/
+
+/* Runs the first pass over a line as it arrives, and then either keeps it or frees it.
+ * (Nothing is reported from here, since the reader is reporting the syntax errors meanwhile) */
+void _encode_arrived_line(ParsedLine* parsed_line) {
+    int is_needed;
+
+    is_needed = parsed_line->label != NULL ||
+                (parsed_line->directive != NULL &&
+                 (strcmp(parsed_line->directive, ".entry") == 0 || strcmp(parsed_line->directive, ".extern") == 0 ||
+                  strcmp(parsed_line->directive, ".equ") == 0));
+    if (!is_out_of_memory) {
+        if (!reserve_images(cursor.IC - MEM_START_ADDRESS + get_num_code_words(parsed_line),
+                            cursor.DC + get_num_data_words(parsed_line)) ||
+            !reserve_symbol_refs(cursor.i_symbol_ref + get_num_symbol_refs(parsed_line))) {
+            is_out_of_memory = 1;
+        }
+        else {
+            cursor.line_num = parsed_line->line_num;
+            cursor.source = parsed_line->source;
+            encode_line(parsed_line, &cursor);
+        }
+    }
+    if (is_needed && !is_out_of_memory) {
+        if (reserve_parsed_lines(n_lines + 1)) { /* (it's kept until the file is done) */
+            parsed_lines[n_lines++] = parsed_line;
+            return;
+        }
+        is_out_of_memory = 1;
+    }
+    if (!parsed_line->is_cached) { /* (cached lines are freed with the include cache) */
+        free_parsed_line(parsed_line);
+    }
+}
+
+/* Entry point of the encoder thread */
+void* _run_encoder(void* arg) {
+    ParsedLine* parsed_line;
+    while ((parsed_line = _pop_line()) != NULL) {
+        _encode_arrived_line(parsed_line);
+    }
+    return NULL;
+}
+
+
+/*********************************** Reader ***********************************/
+
+/* Hands a parsed line over to the encoder (a LineHandler).
+ * From the first constant (an .equ or an expression) on, the encoder is stopped and the lines are only kept:
+ * the errors in constant expressions, and the symbols defined among them, have to be reported after the syntax
+ * errors and in the order of the lines, as in the first pass of the serial mode */
+int _hand_over_line(ParsedLine* parsed_line) {
+    get_num_symbols(parsed_line); /* (for its warning about a redundant label, as in register_parsed_line) */
+    if (!is_deferred && get_num_expressions(parsed_line) > 0) {
+        if (!is_inline) {
+            _push_line(NULL);
+            pthread_join(encoder, NULL);
+            is_inline = 1;
+        }
+        is_deferred = 1;
+        first_deferred = n_lines;
+    }
+    if (is_deferred) {
+        if (!is_out_of_memory && reserve_parsed_lines(n_lines + 1)) {
+            parsed_lines[n_lines++] = parsed_line;
+        }
+        else {
+            is_out_of_memory = 1;
+            if (!parsed_line->is_cached) {
+                free_parsed_line(parsed_line);
+            }
+        }
+    }
+    else if (is_inline) {
+        _encode_arrived_line(parsed_line);
+    }
+    else {
+        _push_line(parsed_line);
+    }
+    return 1;
+}
+
+/*
+ * Pipelined mode (--pipeline): reads and parses the input file while a second thread runs the first pass
+ * over the lines as they arrive (growing the images as needed). Only the lines needed by the second pass, or
+ * whose labels the symbols point to, are kept; the rest are freed once encoded.
+ * The symbols are held back until finish_pipelined_pass (so that syntax errors are still reported first)
+ */
+void encode_pipelined(FILE* fp, char* input_path) {
+    char line_buf[LINE_LEN];
+    ParsedLine* parsed_line;
+
+    ring.head = 0;
+    ring.tail = 0;
+    cursor.IC = MEM_START_ADDRESS;
+    cursor.DC = 0;
+    cursor.SC = 0;
+    cursor.i_symbol_ref = 0;
+    cursor.symbols = &symbols;
+    is_out_of_memory = 0;
+    is_deferred = 0;
+    if (!init_code_image(PIPELINE_INITIAL_WORDS) ||
+        !init_data_image(PIPELINE_INITIAL_WORDS) ||
+        !init_word_types(2 * PIPELINE_INITIAL_WORDS)) {
+        is_out_of_memory = 1;
+    }
+    is_inline = pthread_create(&encoder, NULL, _run_encoder, NULL) != 0;
+
+    /* The same as the pre-processing stage of assemble_file, with each line handed over as soon as it's parsed */
+    while (!diag_limit_reached() && fgets(line_buf, sizeof(line_buf), fp) != NULL) {
+        line_num++;
+        parsed_line = parse_line(line_num, line_buf);
+        if (parsed_line == NULL) {
+            continue;
+        }
+        if (is_include_directive(parsed_line)) {
+            expand_include(input_path, parsed_line, _hand_over_line);
+            free_parsed_line(parsed_line);
+        }
+        else {
+            _hand_over_line(parsed_line);
+        }
+    }
+    if (!is_inline) {
+        _push_line(NULL);
+        pthread_join(encoder, NULL);
+    }
+
+    seek_counters(cursor.IC, cursor.DC, cursor.SC);
+    i_symbol_ref = cursor.i_symbol_ref;
+    n_symbol_refs = cursor.i_symbol_ref;
+    n_code_words = cursor.IC - MEM_START_ADDRESS;
+    n_data_words = cursor.DC;
+    if (is_out_of_memory) {
+        report_error(DIAG_MEMORY, 0, "Failed to allocate memory for the pipelined first pass");
+    }
+}
+
+/* Completes the first pass of the pipelined mode: enters the symbols into the table (in the order of the lines),
+ * encodes the lines from the first constant on (if any) like first_pass, and shifts the data addresses */
+void finish_pipelined_pass() {
+    int i_line;
+    ParsedLine* parsed_line;
+
+    n_errors = 0;
+    append_symbols(&symbols);
+    for (i_line = first_deferred; is_deferred && i_line < n_lines; i_line++) {
+        parsed_line = parsed_lines[i_line];
+        if (!reserve_images(get_IC() - MEM_START_ADDRESS + get_num_code_words(parsed_line),
+                            get_DC() + get_num_data_words(parsed_line)) ||
+            !reserve_symbol_refs(i_symbol_ref + get_num_symbol_refs(parsed_line))) {
+            report_error(DIAG_MEMORY, parsed_line->line_num, "Failed to allocate memory for the pipelined first pass");
+            break;
+        }
+        first_pass_line(parsed_line);
+    }
+    n_symbol_refs = i_symbol_ref;
+    n_code_words = get_IC() - MEM_START_ADDRESS;
+    n_data_words = get_DC();
+    shift_data_addresses();
+}
+
+/* Frees what the pipelined mode held back (when the file had syntax errors) */
+void discard_pipelined_pass() {
+    free_symbol_list(&symbols);
+}
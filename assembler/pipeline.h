@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+#include "assembler.h"
+
+/* Number of parsed lines the ring between the reader and the encoder holds (a power of 2) */
+#define PIPELINE_RING_SIZE 4096
+
+/* Number of words the images start with (they grow as the lines arrive) */
+#define PIPELINE_INITIAL_WORDS 1024
+
+/*
+ * LineRing:
+ * A lock-free single-producer/single-consumer ring of parsed lines. Only the reader moves 'head' and only
+ * the encoder moves 'tail', so each of them only needs to see the other's latest value (atomic loads/stores).
+ * A NULL line marks the end of the file
+ */
+typedef struct LineRing {
+    ParsedLine* lines[PIPELINE_RING_SIZE];
+    unsigned long head; /* the number of lines pushed */
+    unsigned long tail; /* the number of lines popped */
+} LineRing;
+
+/*
+ * Pipelined mode (--pipeline): reads and parses the input file while a second thread runs the first pass
+ * over the lines as they arrive (growing the images as needed). Only the lines needed by the second pass, or
+ * whose labels the symbols point to, are kept; the rest are freed once encoded.
+ * The symbols are held back until finish_pipelined_pass (so that syntax errors are still reported first)
+ */
+void encode_pipelined(FILE* fp, char* input_path);
+
+/* Completes the first pass of the pipelined mode: enters the symbols into the table (in the order of the lines),
+ * encodes the lines from the first constant on (if any) like first_pass, and shifts the data addresses */
+void finish_pipelined_pass();
+
+/* Frees what the pipelined mode held back (when the file had syntax errors) */
+void discard_pipelined_pass();
+
+#endif
@@ -124,6 +124,35 @@ char* str_replace(char* str, char* replacement, int start_idx, int end_idx) {
     return strcat(strcat(get_substr(str, 0, start_idx), replacement), get_substr(str, end_idx, strlen(str)));
 }
 
+/* Hash of a str (djb2), e.g. for hash tables keyed by labels */
+unsigned int hash_str(char* str) {
+    unsigned int hash = 5381;
+    while (*str) {
+        hash = hash * 33 + (unsigned char)*str++;
+    }
+    return hash;
+}
+
+/* Like strtok, but keeps where it stopped in *rest instead of a static (so it's reentrant) */
+char* str_tok(char* str, char* delims, char** rest) {
+    char* end;
+
+    if (str == NULL) {
+        str = *rest;
+    }
+    str += strspn(str, delims);
+    if (*str == '\0') {
+        *rest = str;
+        return NULL;
+    }
+    end = str + strcspn(str, delims);
+    if (*end != '\0') {
+        *end++ = '\0';
+    }
+    *rest = end;
+    return str;
+}
+
 /* Copy a str. (should free when done) */
 char* str_cpy(char* str) {
     char* dest;
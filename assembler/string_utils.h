@@ -25,6 +25,13 @@ int is_printable(char* str);
 /* Replace a section of a string with the specified replacement */
 char* str_replace(char* str, char* replacement, int start_idx, int end_idx);
 
+/* Hash of a str (djb2), e.g. for hash tables keyed by labels */
+unsigned int hash_str(char* str);
+
+/* Like strtok, but keeps where it stopped in *rest instead of a static (so it's reentrant):
+ * pass the str to start splitting it, and NULL to continue after the last token */
+char* str_tok(char* str, char* delims, char** rest);
+
 /* Copy a str. (remember to free when done) */
 char* str_cpy(char* str);
 
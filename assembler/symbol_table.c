@@ -5,10 +5,25 @@
 #include "machine_coder.h"
 #include "file_utils.h"
 #include "symbol_table.h"
+#include "diagnostics.h"
+#include "string_utils.h"
+#include "parallel.h"
+
+/* Initial number of buckets in the hash index of the symbol table (doubled whenever it gets too full) */
+#define SYMBOL_INITIAL_BUCKETS 256
 
 /* Symbols will be stored as a dynamic linked list */
-struct Symbol* symbol_table = NULL;
-struct Symbol* tail = NULL; /* to insert at the end without traversal */
+THREAD_LOCAL struct Symbol* symbol_table = NULL;
+THREAD_LOCAL struct Symbol* tail = NULL; /* to insert at the end without traversal */
+static THREAD_LOCAL int n_symbols_in_table = 0;
+
+/* Hash index of the symbol table (by label), so that adding and looking up symbols doesn't traverse the list */
+static THREAD_LOCAL Symbol** buckets = NULL;
+static THREAD_LOCAL unsigned int n_buckets = 0;
+
+/* The entry symbols, gathered when the .ent file is written in parallel */
+static THREAD_LOCAL Symbol** entry_symbols = NULL;
+static THREAD_LOCAL int n_entry_symbols = 0;
 
 /* enum to_string converter */
 char* sym_type_str(SymType sym_type) {
@@ -16,6 +31,8 @@ char* sym_type_str(SymType sym_type) {
         case TYPE_UNK: return "N/A";
         case TYPE_CODE:   return "CODE";
         case TYPE_DATA: return "DATA";
+        case TYPE_CONST: return "CONST";
+        case TYPE_SPACE: return "SPACE";
         default: return "Unknown SymType";
     }
 }
@@ -33,7 +50,14 @@ char* sym_loc_str(SymLoc sym_loc) {
 /* Internal function used by lookup_symbol and add_symbol */
 Symbol* _get_symbol(char* label) {
     Symbol* symbol;
-    symbol = symbol_table;
+    if (n_buckets > 0) {
+        symbol = buckets[hash_str(label) % n_buckets];
+        while (symbol != NULL && strcmp(symbol->label, label) != 0) {
+            symbol = symbol->hash_next;
+        }
+        return symbol;
+    }
+    symbol = symbol_table; /* no index (failed to allocate it) */
     while (symbol != NULL) {
         if (strcmp(symbol->label, label) == 0) {
             return symbol;
@@ -43,14 +67,58 @@ Symbol* _get_symbol(char* label) {
     return NULL;
 }
 
+/* Re-creates the hash index of the symbol table with enough buckets for its current size */
+void _rebuild_index() {
+    Symbol* symbol;
+    unsigned int new_n_buckets;
+    unsigned int i_bucket;
+
+    new_n_buckets = SYMBOL_INITIAL_BUCKETS;
+    while (new_n_buckets < n_symbols_in_table) {
+        new_n_buckets *= 2;
+    }
+    free(buckets);
+    buckets = (Symbol**)calloc(new_n_buckets, sizeof(Symbol*));
+    n_buckets = buckets != NULL ? new_n_buckets : 0;
+    for (symbol = symbol_table; n_buckets > 0 && symbol != NULL; symbol = symbol->next) {
+        i_bucket = hash_str(symbol->label) % n_buckets;
+        symbol->hash_next = buckets[i_bucket];
+        buckets[i_bucket] = symbol;
+    }
+}
+
+/* Links a new symbol at the tail of the list, and into the hash index */
+void _link_symbol(Symbol* new_symbol) {
+    unsigned int i_bucket;
+
+    new_symbol->next = NULL;
+    if (symbol_table == NULL) {
+        symbol_table = new_symbol;
+        tail = new_symbol;
+    }
+    else {
+        tail->next = new_symbol;
+        tail = new_symbol;
+    }
+    n_symbols_in_table++;
+
+    if (n_symbols_in_table > 2 * n_buckets) {
+        _rebuild_index(); /* (this indexes the new symbol too) */
+    }
+    else {
+        i_bucket = hash_str(new_symbol->label) % n_buckets;
+        new_symbol->hash_next = buckets[i_bucket];
+        buckets[i_bucket] = new_symbol;
+    }
+}
+
 /* Adds a new symbol to the tail of the list */
 int add_symbol(char* label, SymType type, SymLoc loc) {
     struct Symbol* new_symbol;
 
     /* First check this symbol doesn't already exist */
     if (_get_symbol(label) != NULL) {
-        n_errors++;
-        printf("Error in line %i: Symbol \'%s\' already exists\n", line_num, label);
+        report_error(DIAG_DUPLICATE_SYMBOL, line_num, "Symbol \'%s\' already exists", label);
         return 0;
     }
 
@@ -62,22 +130,27 @@ int add_symbol(char* label, SymType type, SymLoc loc) {
     else if (type == TYPE_CODE) {
         new_symbol->address = get_IC();
     }
+    else if (type == TYPE_SPACE) {
+        new_symbol->address = get_SC();
+    }
     else { /* data */
         new_symbol->address = get_DC();
     }
 
     new_symbol->type = type;
     new_symbol->loc = loc;
-    new_symbol->next = NULL;
+    new_symbol->line_num = line_num;
+    new_symbol->source = line_source;
+    _link_symbol(new_symbol);
+    return 1;
+}
 
-    if (symbol_table == NULL) {
-        symbol_table = new_symbol;
-        tail = new_symbol;
-    }
-    else {
-        tail->next = new_symbol;
-        tail = new_symbol;
+/* Adds a constant (.equ) to the tail of the list, with its value as its address */
+int add_constant(char* label, int value) {
+    if (!add_symbol(label, TYPE_CONST, LOC_UNK)) {
+        return 0;
     }
+    tail->address = value;
     return 1;
 }
 
@@ -87,14 +160,19 @@ Symbol* lookup_symbol(char* label) {
     Symbol* symbol;
     symbol = _get_symbol(label);
     if (symbol == NULL) {
-        printf("Error in line %i: Unrecognized symbol \'%s\'\n", line_num, label);
-        n_errors++;
+        report_error(DIAG_UNDEFINED_SYMBOL, line_num, "Unrecognized symbol \'%s\'", label);
     }
     return symbol;
 }
 
+/* Lookup a symbol in the table (without reporting it if it's not found) */
+Symbol* find_symbol(char* label) {
+    return _get_symbol(label);
+}
+
 /* shifts the addresses of data symbols by the number of words in the code section (=IC)
- * so that the data section will come immediately after the code section */
+ * so that the data section will come immediately after the code section
+ * (and those of .space symbols by the data section too, so that the zero region comes after it) */
 void shift_data_addresses() {
     Symbol* symbol;
     symbol = symbol_table;
@@ -102,40 +180,250 @@ void shift_data_addresses() {
         if (symbol->type == (int)DATA) {
             symbol->address += get_IC();
         }
+        else if (symbol->type == TYPE_SPACE) {
+            symbol->address += get_IC() + get_DC();
+        }
         symbol = symbol->next;
     }
 }
 
+/* Moves the symbols back after code words were removed: a code symbol by the number of words removed before it
+ * ('removed_before' has an entry per code word, and one for the end of the code), and a data (or .space) symbol by
+ * all of them */
+void remove_code_addresses(int* removed_before, int n_code_words) {
+    Symbol* symbol;
+    for (symbol = symbol_table; symbol != NULL; symbol = symbol->next) {
+        if (symbol->type == TYPE_CODE) {
+            symbol->address -= removed_before[symbol->address - MEM_START_ADDRESS];
+        }
+        else if (symbol->type == TYPE_DATA || symbol->type == TYPE_SPACE) {
+            symbol->address -= removed_before[n_code_words];
+        }
+    }
+}
+
+/* Moves the .space symbols back after 'n_removed' data words were removed (the zero region follows the data) */
+void remove_data_addresses(int n_removed) {
+    Symbol* symbol;
+    for (symbol = symbol_table; symbol != NULL; symbol = symbol->next) {
+        if (symbol->type == TYPE_SPACE) {
+            symbol->address -= n_removed;
+        }
+    }
+}
+
 /* Updates the 'entry' attribute of symbols in the table which were declared by
  * an '.entry' directive in the source code */
 void update_entry_symbol(char* label) {
     Symbol *symbol;
     symbol = lookup_symbol(label);
-    if (symbol != NULL) {
+    if (symbol != NULL && symbol->type == TYPE_CONST) {
+        report_error(DIAG_CONSTANT, line_num, "Constant \'%s\' can't be exported by .entry (it has no address)", label);
+    }
+    else if (symbol != NULL) {
         symbol->loc = LOC_ENTRY;
     }
 }
 
+/* Write the entry symbols (in .ent format) to a stream */
+void write_entry_symbols(FILE* fp) {
+    Symbol* symbol;
+    for (symbol = symbol_table; symbol != NULL; symbol = symbol->next) {
+        if (symbol->loc == LOC_ENTRY) {
+            fprintf(fp, "%s ", symbol->label);
+            write_address(fp, symbol->address);
+            fprintf(fp, "\n");
+        }
+    }
+}
+
+/* Formats a gathered entry symbol, the same as write_entry_symbols (a RecordFormatter) */
+int _format_entry_record(int i_item, char* out) {
+    return sprintf(out, "%s %07d \n", entry_symbols[i_item]->label, entry_symbols[i_item]->address);
+}
+
 /* Write Symbol table to .ent file */
 void export_entry_symbols(char* file_path) {
     FILE *fp;
     Symbol* symbol;
-    symbol = symbol_table;
-    fp = fopen(file_path, "w");
-    if (fp) {
-        while (symbol != NULL) {
+    int n_jobs;
+    int is_written;
+
+    n_jobs = get_n_jobs(n_symbols_in_table);
+    if (n_jobs > 1) { /* (the list can't be split between threads, so the entry symbols are gathered first) */
+        entry_symbols = (Symbol**)malloc(sizeof(Symbol*) * n_symbols_in_table);
+        n_entry_symbols = 0;
+        for (symbol = symbol_table; entry_symbols != NULL && symbol != NULL; symbol = symbol->next) {
             if (symbol->loc == LOC_ENTRY) {
-                fprintf(fp, "%s ", symbol->label);
-                write_address(fp, symbol->address);
-                fprintf(fp, "\n");
+                entry_symbols[n_entry_symbols++] = symbol;
+            }
+        }
+        n_jobs = get_n_jobs(n_entry_symbols);
+        is_written = entry_symbols != NULL && n_jobs > 1 &&
+                     write_parallel(file_path, n_entry_symbols, _format_entry_record, n_jobs);
+        free(entry_symbols);
+        entry_symbols = NULL;
+        if (is_written) {
+            return;
+        }
+    }
+    fp = open_output_file(file_path);
+    if (fp) {
+        write_entry_symbols(fp);
+        close_output_file(fp);
+    }
+    else {
+        report_error(DIAG_IO, 0, "Unable to create '%s'", file_path);
+    }
+}
+
+/* Number of symbols in the table */
+int get_n_symbols() {
+    return n_symbols_in_table;
+}
+
+/* The first symbol of the table (the rest follow it by 'next', in the order they were added) */
+Symbol* get_first_symbol() {
+    return symbol_table;
+}
+
+/* Hands over the symbol table to 'list' (so it is not freed with the rest of the file) */
+void detach_symbol_table(SymbolList* list) {
+    list->head = symbol_table;
+    list->tail = tail;
+    list->n_symbols = n_symbols_in_table;
+    symbol_table = NULL;
+    tail = NULL;
+    n_symbols_in_table = 0;
+    free(buckets);
+    buckets = NULL;
+    n_buckets = 0;
+}
+
+/* Resumes from a symbol table detached in a previous run:
+ * the first 'n_prefix' symbols become the table, the next 'n_removed' are dropped,
+ * and the rest are handed over to 'rest' (to be appended once the symbols which replace the dropped ones were added).
+ * The addresses of the data symbols are shifted back by 'data_shift' (the IC they were shifted by),
+ * and the 'entry' attribute is cleared (it is set again in the second pass) */
+void resume_symbol_table(SymbolList* list, int n_prefix, int n_removed, int data_shift, SymbolList* rest) {
+    Symbol* symbol;
+    Symbol* next;
+    int i;
+
+    free_symbol_table();
+    for (symbol = list->head; symbol != NULL; symbol = symbol->next) {
+        if (symbol->type == TYPE_DATA) {
+            symbol->address -= data_shift;
+        }
+        if (symbol->loc == LOC_ENTRY) {
+            symbol->loc = LOC_UNK;
+        }
+    }
+
+    rest->head = NULL;
+    rest->tail = NULL;
+    rest->n_symbols = 0;
+    for (i = 0, symbol = list->head; symbol != NULL; i++, symbol = next) {
+        next = symbol->next;
+        if (i < n_prefix) {
+            symbol->next = NULL;
+            if (symbol_table == NULL) {
+                symbol_table = symbol;
+            }
+            else {
+                tail->next = symbol;
             }
-            symbol = symbol->next;
+            tail = symbol;
+            n_symbols_in_table++;
         }
-        fclose(fp);
+        else if (i < n_prefix + n_removed) {
+            free(symbol);
+        }
+        else {
+            if (rest->head == NULL) {
+                rest->head = symbol;
+            }
+            rest->tail = symbol;
+            rest->n_symbols++;
+        }
+    }
+    _rebuild_index();
+    list->head = NULL;
+    list->tail = NULL;
+    list->n_symbols = 0;
+}
+
+/* Moves the symbols of a detached list by the given number of code words, data words and source lines */
+void offset_symbols(SymbolList* list, int code_delta, int data_delta, int line_delta) {
+    Symbol* symbol;
+    for (symbol = list->head; symbol != NULL; symbol = symbol->next) {
+        if (symbol->loc != LOC_EXTERNAL && symbol->type != TYPE_CONST) {
+            symbol->address += symbol->type == TYPE_CODE ? code_delta : data_delta;
+        }
+        symbol->line_num += line_delta;
+    }
+}
+
+/* Adds a symbol at the tail of a detached list, without checking that it doesn't already exist
+ * (that's checked once the list is appended to the table) */
+void list_symbol(SymbolList* list, char* label, SymType type, SymLoc loc, int address, int line_num, char* source) {
+    Symbol* new_symbol;
+
+    new_symbol = (Symbol*)malloc(sizeof(Symbol));
+    if (new_symbol == NULL) {
+        return;
+    }
+    new_symbol->label = label;
+    new_symbol->address = address;
+    new_symbol->type = type;
+    new_symbol->loc = loc;
+    new_symbol->line_num = line_num;
+    new_symbol->source = source;
+    new_symbol->next = NULL;
+    new_symbol->hash_next = NULL;
+    if (list->head == NULL) {
+        list->head = new_symbol;
     }
     else {
-        n_errors++;
+        list->tail->next = new_symbol;
+    }
+    list->tail = new_symbol;
+    list->n_symbols++;
+}
+
+/* Appends the symbols of a detached list to the table (reporting those which already exist) */
+void append_symbols(SymbolList* list) {
+    Symbol* symbol;
+    Symbol* next;
+    char* saved_source;
+    for (symbol = list->head; symbol != NULL; symbol = next) {
+        next = symbol->next;
+        if (_get_symbol(symbol->label) != NULL) {
+            saved_source = line_source; /* (reported at the line it was declared in) */
+            line_source = symbol->source;
+            report_error(DIAG_DUPLICATE_SYMBOL, symbol->line_num, "Symbol \'%s\' already exists", symbol->label);
+            line_source = saved_source;
+            free(symbol);
+        }
+        else {
+            _link_symbol(symbol);
+        }
+    }
+    list->head = NULL;
+    list->tail = NULL;
+    list->n_symbols = 0;
+}
+
+/* Free memory of a detached symbol table */
+void free_symbol_list(SymbolList* list) {
+    Symbol* tmp;
+    while (list->head != NULL) {
+        tmp = list->head;
+        list->head = list->head->next;
+        free(tmp);
     }
+    list->tail = NULL;
+    list->n_symbols = 0;
 }
 
 /* Free symbol table memory */
@@ -146,4 +434,9 @@ void free_symbol_table() {
         symbol_table = symbol_table->next;
         free(tmp);
     }
+    tail = NULL;
+    n_symbols_in_table = 0;
+    free(buckets);
+    buckets = NULL;
+    n_buckets = 0;
 }
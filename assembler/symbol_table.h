@@ -1,6 +1,8 @@
 #ifndef SYMBOL_TABLE_H
 #define SYMBOL_TABLE_H
 
+#include <stdio.h>
+
 /*!
  * SymType:
  *  Whether a symbol refers to a line of code (instruction) or data
@@ -8,7 +10,9 @@
 typedef enum SymType {
     TYPE_UNK = 0,   /* .entry or .extern */
     TYPE_CODE = 1,  /* .data */
-    TYPE_DATA = 2   /* .string */
+    TYPE_DATA = 2,  /* .string */
+    TYPE_CONST = 3, /* .equ (its 'address' is its value) */
+    TYPE_SPACE = 4  /* .space (its address is in the zero region, after the data section) */
 } SymType;
 char* sym_type_str(SymType sym_type); /* convert to str */
 
@@ -32,38 +36,125 @@ typedef struct Symbol {
     int address;
     SymType type;
     SymLoc loc;
+    int line_num; /* where it was declared */
+    char* source; /* the included file it was declared in (NULL if in the input file itself) */
     struct Symbol* next;
+    struct Symbol* hash_next; /* next symbol in the same bucket of the hash index */
 } Symbol;
 
+/*!
+ * SymbolList:
+ * A symbol table kept between assembler runs (e.g. in watch mode)
+ */
+typedef struct SymbolList {
+    Symbol* head;
+    Symbol* tail;
+    int n_symbols;
+} SymbolList;
+
 /*!
  * Adds a new error to the tail of the list
  * Returns 1 if success, 0 if error (if the symbol already exists)
  */
 int add_symbol(char* label, SymType type, SymLoc loc);
 
+/*!
+ * Adds a constant (.equ) to the tail of the list, with its value as its address
+ * Returns 1 if success, 0 if error (if the symbol already exists)
+ */
+int add_constant(char* label, int value);
+
 /*!
  * Lookup a symbol in the table
  * Returns NULL if not found
  */
 Symbol* lookup_symbol(char* label);
 
+/*!
+ * Lookup a symbol in the table (without reporting it if it's not found)
+ */
+Symbol* find_symbol(char* label);
+
 /*!
  * shifts the addresses of data symbols by the number of words in the code section (IC)
  * so that the data section will come immediately after the code section
+ * (and those of .space symbols by both sections, so that the zero region comes after the data section)
  */
 void shift_data_addresses();
 
+/*!
+ * Moves the symbols back after code words were removed: a code symbol by the number of words removed before it
+ * ('removed_before' has an entry per code word, and one for the end of the code), and a data (or .space) symbol
+ * by all of them
+ */
+void remove_code_addresses(int* removed_before, int n_code_words);
+
+/*!
+ * Moves the .space symbols back after 'n_removed' data words were removed (the zero region follows the data)
+ */
+void remove_data_addresses(int n_removed);
+
 /*!
  * Updates the 'entry' attribute of symbols in the talble which were declared by
  * an '.entry' directive in the source code
  */
 void update_entry_symbol(char* label);
 
+/*!
+ * Write entry symbols (in .ent format) to a stream:
+ */
+void write_entry_symbols(FILE* fp);
+
 /*!
  * Write entry symbols to file:
  */
 void export_entry_symbols(char* file_path);
 
+/*!
+ * Number of symbols in the table
+ */
+int get_n_symbols();
+
+/*!
+ * The first symbol of the table (the rest follow it by 'next', in the order they were added)
+ */
+Symbol* get_first_symbol();
+
+/*!
+ * Hands over the symbol table to 'list' (so it is not freed with the rest of the file)
+ */
+void detach_symbol_table(SymbolList* list);
+
+/*!
+ * Resumes from a symbol table detached in a previous run:
+ * the first 'n_prefix' symbols become the table, the next 'n_removed' are dropped,
+ * and the rest are handed over to 'rest' (to be appended once the symbols which replace the dropped ones were added).
+ * The addresses of the data symbols are shifted back by 'data_shift' (the IC they were shifted by),
+ * and the 'entry' attribute is cleared (it is set again in the second pass)
+ */
+void resume_symbol_table(SymbolList* list, int n_prefix, int n_removed, int data_shift, SymbolList* rest);
+
+/*!
+ * Moves the symbols of a detached list by the given number of code words, data words and source lines
+ */
+void offset_symbols(SymbolList* list, int code_delta, int data_delta, int line_delta);
+
+/*!
+ * Adds a symbol at the tail of a detached list, without checking that it doesn't already exist
+ * (that's checked once the list is appended to the table)
+ */
+void list_symbol(SymbolList* list, char* label, SymType type, SymLoc loc, int address, int line_num, char* source);
+
+/*!
+ * Appends the symbols of a detached list to the table (reporting those which already exist)
+ */
+void append_symbols(SymbolList* list);
+
+/*!
+ * Free memory of a detached symbol table
+ */
+void free_symbol_list(SymbolList* list);
+
 /*!
  * Free memory of symbol table
  */
@@ -0,0 +1,125 @@
+#!/bin/sh
+# Complexity scaling test (make test-complexity):
+# assembles generated files of doubling sizes along separate axes (lines, labels, label references, string length
+# and externs), fits the growth of the time along each axis (the slope of log time over log size), and fails
+# if any axis grows worse than n log n.
+# Usage: test_complexity.sh [smallest size (default: 20000)] [number of sizes (default: 5)]
+
+ASSEMBLER=${ASSEMBLER:-./assembler}
+BASE=${1:-20000}
+N_SIZES=${2:-5}
+RUNS=3
+# Slack over the n log n slope, for the noise of the timings (a quadratic axis has a slope of about 2)
+TOLERANCE=0.25
+# Larger sizes of an axis aren't run once a run takes longer than this (in seconds)
+MAX_SECONDS=20
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Writes the input of size $2 along axis $1 to $DIR/test.as
+generate() {
+    awk -v axis="$1" -v n="$2" -v n_lines="$((BASE * 4))" 'BEGIN {
+        print "MAIN: mov r1, r2"
+        if (axis == "lines") {           # n lines without labels or references
+            for (i = 0; i < n; i++) {
+                if (i % 4 == 3) printf " .data %d, -%d\n", i % 1000, i % 100
+                else printf " add #%d, r%d\n", i % 500, i % 8
+            }
+        }
+        else if (axis == "labels") {     # n lines, each defining a label
+            for (i = 0; i < n; i++) {
+                if (i % 4 == 3) printf "D%d: .data %d\n", i, i % 1000
+                else printf "L%d: inc r%d\n", i, i % 8
+            }
+        }
+        else if (axis == "refs") {       # n lines, each with 2 references to one of 64 labels
+            for (i = 0; i < 64; i++) printf "K%d: .data %d\n", i, i
+            for (i = 0; i < n; i++) {
+                if (i % 2 == 0) printf " cmp K%d, K%d\n", i % 64, (i * 7) % 64
+                else printf " jmp &MAIN\n sub K%d, r%d\n", (i * 3) % 64, i % 8
+            }
+        }
+        else if (axis == "strings") {    # a fixed number of lines, each with a string of length n
+            s = ""
+            for (i = 0; i < n; i++) s = s sprintf("%c", 97 + i % 26)
+            for (i = 0; i < n_lines; i++) printf " .string \"%s\"\n", s
+        }
+        else if (axis == "externs") {    # n externs, each referenced once
+            for (i = 0; i < n; i++) printf " .extern X%d\n", i
+            for (i = 0; i < n; i++) printf " lea X%d, r%d\n", i, i % 8
+        }
+        print "stop"
+    }' > "$DIR/test.as"
+}
+
+# Prints the wall time (in seconds) of the fastest of $RUNS runs
+best_time() {
+    best=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        start=$(date +%s.%N)
+        "$ASSEMBLER" "$DIR/test" > "$DIR/log" || return 1
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) printf "%.4f", t; else print $3 }')
+        run=$((run + 1))
+    done
+    echo "$best"
+}
+
+# The sizes of an axis (the string lengths double up to the longest string that fits in a line)
+sizes() {
+    if [ "$1" = strings ]; then
+        echo 4 8 16 32 64
+    else
+        awk -v base="$BASE" -v n="$N_SIZES" 'BEGIN { for (i = 0; i < n; i++) printf "%d ", base * 2 ^ i }'
+    fi
+}
+
+failed=0
+printf "%-8s %10s %10s\n" axis size seconds
+for axis in lines labels refs strings externs; do
+    : > "$DIR/times"
+    for size in $(sizes $axis); do
+        generate $axis "$size"
+        if ! t=$(best_time) || [ ! -f "$DIR/test.ob" ] || grep -q "rror" "$DIR/log"; then
+            echo "Failed to assemble the $axis input of size $size:" >&2
+            cat "$DIR/log" >&2
+            exit 1
+        fi
+        rm -f "$DIR/test.ob" "$DIR/test.ext" "$DIR/test.ent"
+        printf "%-8s %10d %10s\n" $axis "$size" "$t"
+        echo "$size $t" >> "$DIR/times"
+        if awk -v t="$t" -v max="$MAX_SECONDS" 'BEGIN { exit !(t > max) }'; then
+            break
+        fi
+    done
+
+    # Least squares slope of log(time) over log(size), against the slope of n log n over the same sizes
+    if ! awk -v axis="$axis" -v tolerance="$TOLERANCE" '
+        { x[NR] = log($1); y[NR] = log($2); sx += x[NR]; sy += y[NR] }
+        END {
+            if (NR < 2) {
+                printf "%-8s only %d size ran within the time limit\n", axis, NR
+                exit 1
+            }
+            for (i = 1; i <= NR; i++) {
+                sxx += (x[i] - sx / NR) ^ 2
+                sxy += (x[i] - sx / NR) * (y[i] - sy / NR)
+            }
+            slope = sxy / sxx
+            limit = log(exp(x[NR]) * x[NR] / (exp(x[1]) * x[1])) / (x[NR] - x[1])
+            printf "%-8s slope %.2f (limit %.2f + %.2f)", axis, slope, limit, tolerance
+            if (slope > limit + tolerance) {
+                printf ": worse than n log n\n"
+                exit 1
+            }
+            printf "\n"
+        }' "$DIR/times"; then
+        failed=1
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Some axes grow worse than n log n" >&2
+    exit 1
+fi
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Regression test of the optimizations between the passes (make test-optimize):
+# assembles each tests/NAME.as with the options in tests/NAME.flags, and compares the output files with the
+# expected tests/NAME.ob/.ext/.ent (the expected outputs were checked to run the same as those without the options).
+# A case with a tests/NAME.errors must fail instead, with each line of it among the diagnostics, as many times as
+# it's in the .errors (the paths of included files relative to the directory of the case).
+# A tests/NAME.inc, and a directory tests/NAME, are copied along, for the case to include.
+# Usage: test_optimize.sh [case names (default: the cases of tests/*.as that have a .flags)]
+
+ASSEMBLER=$(cd "$(dirname "${ASSEMBLER:-./assembler}")" && pwd)/$(basename "${ASSEMBLER:-./assembler}")
+TESTS=$(cd "$(dirname "$0")/tests" && pwd)
+DIR=$(cd "$(mktemp -d)" && pwd -P)
+trap 'rm -rf "$DIR"' EXIT
+
+if [ $# -eq 0 ]; then
+    set -- $(cd "$TESTS" && ls *.flags | sed 's/\.flags$//')
+fi
+
+failed=0
+for name in "$@"; do
+    rm -rf "$DIR"/*
+    cp "$TESTS/$name.as" "$DIR/"
+    if [ -f "$TESTS/$name.inc" ]; then
+        cp "$TESTS/$name.inc" "$DIR/"
+    fi
+    if [ -d "$TESTS/$name" ]; then
+        cp -R "$TESTS/$name" "$DIR/"
+    fi
+    flags=$(cat "$TESTS/$name.flags" 2>/dev/null)
+    (cd "$DIR" && "$ASSEMBLER" $flags "$name" > out 2>&1)
+    rc=$?
+    sed "s|$DIR/||g" "$DIR/out" > "$DIR/log"
+    result=ok
+    if [ -f "$TESTS/$name.errors" ]; then
+        if [ $rc -eq 0 ] || [ -f "$DIR/$name.ob" ]; then
+            result="assembled, but errors were expected"
+        fi
+        while IFS= read -r line; do
+            n_expected=$(grep -cxF "$line" "$TESTS/$name.errors")
+            if [ "$(grep -cxF "$line" "$DIR/log")" -ne "$n_expected" ]; then
+                result="expected $n_expected of the diagnostic: $line"
+            fi
+        done < "$TESTS/$name.errors"
+    elif [ $rc -ne 0 ]; then
+        result="failed to assemble"
+    else
+        for ext in ob ext ent; do
+            if [ -f "$TESTS/$name.$ext" ] || [ -f "$DIR/$name.$ext" ]; then
+                if [ "$result" = ok ] && ! cmp -s "$TESTS/$name.$ext" "$DIR/$name.$ext"; then
+                    result="$name.$ext differs from the expected one"
+                fi
+            fi
+        done
+    fi
+    printf "%-20s %-32s %s\n" "$name" "$flags" "$result"
+    if [ "$result" != ok ]; then
+        failed=1
+        sed 's/^/    /' "$DIR/log"
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Some cases failed" >&2
+    exit 1
+fi
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Regression test of the pipelined mode (make test-pipeline):
+# assembles each tests/NAME.as (with the options in tests/NAME.flags, if any), and a generated file with many lines
+# before its first constant, once serially and once with --pipeline, and checks that the diagnostics and
+# the output files are the same.
+# Usage: test_pipeline.sh [case names (default: all of tests/*.as, and the generated file)]
+
+ASSEMBLER=$(cd "$(dirname "${ASSEMBLER:-./assembler}")" && pwd)/$(basename "${ASSEMBLER:-./assembler}")
+TESTS=$(cd "$(dirname "$0")/tests" && pwd)
+DIR=$(cd "$(mktemp -d)" && pwd -P)
+trap 'rm -rf "$DIR"' EXIT
+
+# More lines than the ring holds before the first constant, then constants, expressions and duplicate symbols
+awk 'BEGIN {
+    print "W: .extern EXT"
+    print "MAIN: mov r1, r2"
+    for (i = 0; i < 10000; i++) {
+        if (i % 4 == 0) printf "L%d: add #%d, r%d\n", i, i % 500, i % 8
+        else if (i % 4 == 1) printf " jmp L%d\n", i - 1
+        else if (i % 4 == 2) printf " cmp EXT, D%d\n", i - 2
+        else printf "D%d: .data %d\n", i - 3, i
+    }
+    print ".equ N, 10"
+    print ".equ N, 11"
+    print " prn #N*2"
+    print "L4: stop"
+    print "E: .data N/0, UNKNOWN"
+}' > "$DIR/generated.as"
+
+if [ $# -eq 0 ]; then
+    set -- $(cd "$TESTS" && ls *.as | sed 's/\.as$//') generated
+fi
+
+failed=0
+for name in "$@"; do
+    flags=$(cat "$TESTS/$name.flags" 2>/dev/null)
+    for mode in serial pipeline; do
+        rm -rf "$DIR/$mode"
+        mkdir "$DIR/$mode"
+        if [ "$name" = generated ]; then
+            cp "$DIR/generated.as" "$DIR/$mode/"
+        else
+            cp "$TESTS/$name.as" "$DIR/$mode/"
+            if [ -f "$TESTS/$name.inc" ]; then
+                cp "$TESTS/$name.inc" "$DIR/$mode/"
+            fi
+            if [ -d "$TESTS/$name" ]; then
+                cp -R "$TESTS/$name" "$DIR/$mode/"
+            fi
+        fi
+        if [ $mode = pipeline ]; then
+            (cd "$DIR/$mode" && "$ASSEMBLER" --pipeline $flags "$name" > "$DIR/out" 2>&1)
+        else
+            (cd "$DIR/$mode" && "$ASSEMBLER" $flags "$name" > "$DIR/out" 2>&1)
+        fi
+        sed "s|$DIR/$mode/||g" "$DIR/out" > "$DIR/$mode/log" # (the paths of included files)
+    done
+    if diff -r "$DIR/serial" "$DIR/pipeline" > "$DIR/diff"; then
+        printf "%-20s ok\n" "$name"
+    else
+        printf "%-20s the pipelined mode differs from the serial mode:\n" "$name"
+        sed 's/^/    /' "$DIR/diff"
+        failed=1
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Some cases failed" >&2
+    exit 1
+fi
@@ -0,0 +1,21 @@
+; -O, --gc-code and --relax-branches together
+.entry MAIN
+.extern EXT
+MAIN: mov #4, r1
+ add #0, r1
+LOOP: prn r1
+ dec r1
+ cmp #0, r1
+ bne HOP
+ jmp DONE
+HOP: jmp LOOP
+ prn #100
+DONE: jsr PRINT
+ stop
+UNUSED: mov r2, r2
+ jsr EXT
+ stop
+PRINT: prn LIST
+ cmp EXT, #1
+ rts
+LIST: .data 8, -8
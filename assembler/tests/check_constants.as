@@ -0,0 +1,8 @@
+; --check-only reports the constants used as addresses as the second pass does
+MAIN: stop
+.equ K, 5
+ jmp K
+ prn K
+ lea K, r1
+.equ K2, 2
+.entry K2
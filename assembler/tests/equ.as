@@ -0,0 +1,15 @@
+; constants of .equ, folded into immediates and .data
+.equ A, 3
+.equ SIZE, A*4+1
+.equ NEG, -(A+1)*2
+.equ D, -A--2
+MAIN: mov #SIZE, r1
+ add #A*4+1, r1
+ sub #(SIZE-1)/A, r2
+ prn #-A--2
+ prn #NEG
+ lea TABLE, r3
+ cmp #D, r2
+ stop
+TABLE: .data SIZE, -A, (A+1)*(A-1), 7
+.entry MAIN
@@ -0,0 +1,7 @@
+; constants have no address
+.equ A, 3
+.entry A
+MAIN: jmp A
+ prn A
+ lea A, r1
+ stop
@@ -0,0 +1,6 @@
+; errors of the constants found by the first pass
+.equ A, 3
+.equ BIG, 2147483647+1
+.equ A, 4
+MAIN: prn #A
+ stop
@@ -0,0 +1,5 @@
+; constant expressions are written without spaces
+.equ A, 3
+.equ C, -A - -2
+MAIN: prn #A * 4
+ stop
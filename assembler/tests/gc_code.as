@@ -0,0 +1,20 @@
+; --gc-code: blocks after a stop, an rts or a jmp that nothing branches to are removed
+.entry MAIN
+.entry KEPT
+.extern EXT
+MAIN: mov #2, r1
+ jsr SUB
+ jmp END
+DEAD1: prn #1
+ prn #2
+ jmp DEAD1
+SUB: prn r1
+ rts
+DEAD2: inc r5
+ jsr EXT
+END: lea KEPT, r2
+ stop
+KEPT: prn #3
+ stop
+DEAD3: clr r1
+ stop
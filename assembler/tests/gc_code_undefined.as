@@ -0,0 +1,5 @@
+; --gc-code: the unreachable blocks that reference undefined symbols are still reported
+MAIN: stop
+ jmp NOSUCH
+DEAD: prn MISSING
+ rts
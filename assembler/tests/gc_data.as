@@ -0,0 +1,20 @@
+; --gc-data: the data blocks whose labels are neither used by an instruction nor .entry's are dropped
+.entry EXPORTED
+MAIN: prn USED
+ prn USED2
+ lea ADDRESSED, r1
+ prn BUF
+ prn AFTER
+ stop
+ .data 7, 8
+USED: .data 1
+ .data 2, 3
+DROPPED: .data 4
+ .data 5, 6
+USED2: .string "ok"
+UNUSED: .string "unused"
+EXPORTED: .data 9
+ADDRESSED: .data 10
+GONE: .data 11, 12
+BUF: .space 3
+AFTER: .space 1
@@ -0,0 +1,12 @@
+; .incbin: the bytes of a binary file as data words (little endian), by offset, length and width
+MAIN: prn ALL
+ prn BYTES
+ prn PAIRS
+ prn TRIPLES
+ prn PART
+ stop
+ALL: .incbin "incbin/data.bin"
+BYTES: .incbin "incbin/data.bin", 2, 3
+PAIRS: .incbin "incbin/data.bin", 0, 4, 2
+TRIPLES: .incbin "incbin/data.bin", 3, 6, 3
+.include "incbin/part.inc"
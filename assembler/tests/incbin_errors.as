@@ -0,0 +1,8 @@
+; .incbin errors: a missing file, an offset or a length past the end, a width of 4, and a length that isn't
+; a multiple of the width
+MAIN: stop
+ .incbin "incbin_errors/missing.bin"
+ .incbin "incbin_errors/data.bin", 13
+ .incbin "incbin_errors/data.bin", 4, 9
+ .incbin "incbin_errors/data.bin", 0, 12, 4
+ .incbin "incbin_errors/data.bin", 0, 5, 2
@@ -0,0 +1,4 @@
+; the errors of an included file are reported each time it is included (the second time from the cache)
+MAIN: stop
+.include "include_cached.inc"
+.include "include_cached.inc"
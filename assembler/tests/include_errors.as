@@ -0,0 +1,5 @@
+; a duplicate symbol in an included file is reported with the path of the included file
+MAIN: mov r1, r2
+.include "include_errors.inc"
+ jmp LIB
+ stop
@@ -0,0 +1,26 @@
+; -O: no-op instructions, jumps to the next kept instruction, and chains of jumps
+.entry MAIN
+.extern OUT
+MAIN: mov r1, r1
+ add #0, r2
+ mov #5, r3
+ jmp NEXT
+ sub #0, COUNT
+NEXT: prn r3
+ jmp HOP1
+ prn #99
+HOP1: jmp HOP2
+HOP2: jmp LOOP
+LOOP: dec r3
+ add #0, COUNT
+ prn r3
+ cmp r3, #0
+ bne HOP3
+ jsr DONE
+ stop
+HOP3: jmp LOOP
+DONE: inc COUNT
+ prn COUNT
+ lea OUT, r4
+ rts
+COUNT: .data 7
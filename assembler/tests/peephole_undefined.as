@@ -0,0 +1,5 @@
+; -O: the no-ops that reference undefined symbols are still reported
+MAIN: add #0, NOSUCH
+ sub #0, r1
+ sub #0, ALSOMISSING
+ stop
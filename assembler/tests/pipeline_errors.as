@@ -0,0 +1,10 @@
+; first pass errors in a file with constants: the same in the serial and the pipelined mode
+.equ N, 4
+MAIN: mov #N, r1
+.equ N, 5
+ add #UNKNOWN, r2
+X: .data N/0
+MAIN: stop
+R: .entry MAIN
+.equ MAIN, 1
+ prn #X
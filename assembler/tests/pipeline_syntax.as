@@ -0,0 +1,7 @@
+; syntax errors come first (and alone) in a file with constants, in the serial and the pipelined mode
+.equ N, 4
+MAIN: mov #N, r1
+ add #N/0, r2
+ bogus r1
+X: .data 1,,2
+MAIN: stop
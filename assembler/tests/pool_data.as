@@ -0,0 +1,30 @@
+; --pool-data: identical data, and data that ends other data, is shared between the labels that are only read
+.entry KEEP
+MAIN: prn HELLO
+ prn LLO
+ prn TABLE
+ prn SAME
+ prn TAIL
+ prn KEEP
+ lea LEAD, r1
+ prn LEAD
+ mov #7, COUNT
+ inc TALLY
+ prn COUNT
+ prn TALLY
+ prn ZERO
+ prn BUF
+ prn REST
+ stop
+HELLO: .string "hello"
+LLO: .string "llo"
+TABLE: .data 1, 2, 3
+SAME: .data 1, 2, 3
+TAIL: .data 2, 3
+KEEP: .data 1, 2, 3
+LEAD: .data 1, 2, 3
+COUNT: .data 0
+TALLY: .data 0
+ZERO: .data 0
+BUF: .space 4
+REST: .space 2
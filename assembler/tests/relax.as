@@ -0,0 +1,19 @@
+; --relax-branches: branches to labels of the file become relative, others keep their relocation
+.entry START
+.extern EXT
+START: mov #3, r1
+LOOP: prn r1
+ dec r1
+ cmp r1, #0
+ bne LOOP
+ jsr SUB
+ jmp END
+ jmp EXT
+SUB: inc VALUE
+ prn VALUE
+ jmp &BACK
+BACK: rts
+END: lea VALUE, r2
+ prn r2
+ stop
+VALUE: .data 41
@@ -0,0 +1,20 @@
+; .space: the reserved words are in the zero region after the data (the third number of the .ob header)
+.entry BUF
+.entry EMPTY
+.equ N, 3
+MAIN: mov #5, BUF
+ add #0, r1
+ jmp NEXT
+NEXT: prn BUF
+ prn EMPTY
+ prn AFTER
+ prn TABLE
+ prn WIDE
+ stop
+UNREACHED: inc BUF
+ stop
+TABLE: .data 1, 2
+BUF: .space 4
+EMPTY: .space 0
+AFTER: .space 1
+WIDE: .space N*2
@@ -0,0 +1,3 @@
+; .space errors: a negative size
+MAIN: stop
+A: .space -1
@@ -0,0 +1,20 @@
+; .space labels after -O and --gc-code removed code words (the zero region still follows the data)
+.entry BUF
+.entry EMPTY
+.equ N, 3
+MAIN: mov #5, BUF
+ add #0, r1
+ jmp NEXT
+NEXT: prn BUF
+ prn EMPTY
+ prn AFTER
+ prn TABLE
+ prn WIDE
+ stop
+UNREACHED: inc BUF
+ stop
+TABLE: .data 1, 2
+BUF: .space 4
+EMPTY: .space 0
+AFTER: .space 1
+WIDE: .space N*2
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200112L /* for clock_gettime(), poll() and friends */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "string_utils.h"
+#include "file_utils.h"
+#include "include_cache.h"
+#include "incbin.h"
+
+/* Enough room for a batch of inotify events (each one is followed by the file name) */
+#define EVENTS_BUF_LEN 4096
+
+static WatchedFile* watched_files = NULL;
+
+/* Set when the watch is interrupted (Ctrl-C) */
+static volatile sig_atomic_t is_interrupted = 0;
+
+void _on_interrupt(int sig) {
+    is_interrupted = 1;
+}
+
+/* Current time in milliseconds */
+double _now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Returns whether the file name has the .as extension */
+int _is_source_file(char* name) {
+    size_t len = strlen(name);
+    return len > 3 && strcmp(name + len - 3, ".as") == 0;
+}
+
+/* Finds the watched file with the given input_arg, adding it if it's new */
+WatchedFile* _get_watched_file(char* input_arg) {
+    WatchedFile* file;
+    for (file = watched_files; file != NULL; file = file->next) {
+        if (strcmp(file->input_arg, input_arg) == 0) {
+            return file;
+        }
+    }
+    file = (WatchedFile*)calloc(1, sizeof(WatchedFile));
+    if (file == NULL) {
+        return NULL;
+    }
+    file->input_arg = str_cpy(input_arg);
+    file->next = watched_files;
+    watched_files = file;
+    return file;
+}
+
+/* Marks a file of the watched directory as changed */
+void _mark_pending(char* dir_path, char* name) {
+    char* input_arg;
+    WatchedFile* file;
+
+    input_arg = (char*)malloc(strlen(dir_path) + 1 + strlen(name) + 1);
+    if (input_arg == NULL) {
+        return;
+    }
+    sprintf(input_arg, "%s/%.*s", dir_path, (int)strlen(name) - 3, name);
+    file = _get_watched_file(input_arg);
+    if (file != NULL) {
+        file->is_pending = 1;
+    }
+    free(input_arg);
+}
+
+/* Reads the source lines of a file. Returns NULL if it can't be read */
+char** _read_texts(char* input_path, int* n_texts) {
+    FILE* fp;
+    char buf[LINE_LEN];
+    char** texts = NULL;
+    char** tmp;
+    int capacity = 0;
+
+    *n_texts = 0;
+    fp = fopen(input_path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        if (*n_texts == capacity) {
+            tmp = (char**)realloc(texts, sizeof(char*) * (capacity + INPUT_BATCH_SIZE));
+            if (tmp == NULL) {
+                break;
+            }
+            texts = tmp;
+            capacity += INPUT_BATCH_SIZE;
+        }
+        texts[(*n_texts)++] = str_cpy(buf);
+    }
+    fclose(fp);
+    if (texts == NULL) { /* an empty file */
+        texts = (char**)malloc(sizeof(char*));
+    }
+    return texts;
+}
+
+/*
+ * Reassembles a watched file, re-parsing and re-encoding only the lines that changed since its last run
+ * (files including other files are assembled from scratch).
+ * Returns the number of errors found
+ */
+int _reassemble(WatchedFile* file) {
+    char* input_path;
+    char** texts;
+    int n_texts;
+    int rc;
+    double start;
+
+    start = _now_ms();
+    input_path = create_file_name(file->input_arg, ".as");
+    texts = _read_texts(input_path, &n_texts);
+    if (texts == NULL) {
+        fprintf(stderr, "Error: Unable to open '%s'\n", input_path);
+        free_incremental(&file->state);
+        free(input_path);
+        return 0;
+    }
+
+    rc = reassemble_incremental(&file->state, file->input_arg, input_path, texts, n_texts);
+    file->has_include = rc < 0;
+    if (file->has_include) {
+        rc = assemble_file(file->input_arg);
+        if (!rc) {
+            fprintf(status_stream(), "  - Reassembled in %.3f ms\n", _now_ms() - start);
+        }
+    }
+    else if (!rc) {
+        fprintf(status_stream(), "  - Reassembled in %.3f ms (%i of %i lines re-parsed, %i fixups resolved, %i .ob lines written)\n",
+                _now_ms() - start, file->state.stats.n_reparsed, n_texts,
+                file->state.stats.n_fixups, file->state.stats.n_ob_lines);
+    }
+    free(input_path);
+    return rc;
+}
+
+/* Reassembles the files that changed (and those that include other files, which may have changed) */
+void _reassemble_pending() {
+    WatchedFile* file;
+    int any_pending = 0;
+    for (file = watched_files; file != NULL; file = file->next) {
+        any_pending |= file->is_pending;
+    }
+    for (file = watched_files; file != NULL; file = file->next) {
+        if (file->is_pending || (any_pending && file->has_include)) {
+            file->is_pending = 0;
+            _reassemble(file);
+        }
+    }
+    prune_include_cache();
+    prune_incbin_cache();
+    fflush(stdout);
+}
+
+/* Reads a batch of inotify events, marking the changed .as files as pending */
+void _read_events(int fd, char* dir_path) {
+    union {
+        struct inotify_event event; /* for alignment */
+        char buf[EVENTS_BUF_LEN];
+    } events;
+    struct inotify_event* event;
+    ssize_t len;
+    char* ptr;
+
+    len = read(fd, events.buf, sizeof(events.buf));
+    for (ptr = events.buf; len > 0 && ptr < events.buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (struct inotify_event*)ptr;
+        if (event->len > 0 && _is_source_file(event->name)) {
+            _mark_pending(dir_path, event->name);
+        }
+    }
+}
+
+/*
+ * Watch mode (--watch <dir>): assembles the .as files in the directory, and then keeps reassembling
+ * the ones that change (until interrupted), printing how long each reassembly took.
+ * Returns 0 if the watch ended normally, 1 if the directory can't be watched
+ */
+int watch_directory(char* dir_path) {
+    int fd;
+    DIR* dir;
+    struct dirent* entry;
+    struct pollfd pfd;
+    WatchedFile* file;
+
+    fd = inotify_init();
+    if (fd < 0 || inotify_add_watch(fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Error: Unable to watch '%s'\n", dir_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    /* Start with all the files currently in the directory */
+    dir = opendir(dir_path);
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (_is_source_file(entry->d_name)) {
+                _mark_pending(dir_path, entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    _reassemble_pending();
+    fprintf(status_stream(), "\nWatching '%s' for changes (Ctrl-C to stop) ...\n", dir_path);
+    fflush(status_stream());
+
+    signal(SIGINT, _on_interrupt);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!is_interrupted) {
+        if (poll(&pfd, 1, -1) <= 0) {
+            continue; /* interrupted */
+        }
+        _read_events(fd, dir_path);
+
+        /* Debounce: wait for the burst of events to end */
+        while (!is_interrupted && poll(&pfd, 1, DEBOUNCE_MS) > 0) {
+            _read_events(fd, dir_path);
+        }
+        if (!is_interrupted) {
+            _reassemble_pending();
+        }
+    }
+    close(fd);
+
+    while (watched_files != NULL) {
+        file = watched_files;
+        watched_files = file->next;
+        free_incremental(&file->state);
+        free(file->input_arg);
+        free(file);
+    }
+    return 0;
+}
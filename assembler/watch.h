@@ -0,0 +1,33 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "assembler.h"
+#include "incremental.h"
+
+/* After a change, wait until no more changes arrive for this long before reassembling
+ * (editors often write a file in several steps) */
+#define DEBOUNCE_MS 50
+
+/*
+ * WatchedFile:
+ * A .as file in the watched directory. The state of its last successful run is kept,
+ * so that after an edit only the lines that changed are re-parsed and re-encoded.
+ * Watched files are stored as a linked list
+ */
+typedef struct WatchedFile {
+    char* input_arg;  /* path without the .as extension */
+    int is_pending;   /* changed since it was last assembled */
+    int has_include;  /* it includes files (.include/.incbin, which may change too), defines constants or reserves space,
+                       * so it is always assembled from scratch */
+    IncrementalFile state;
+    struct WatchedFile* next;
+} WatchedFile;
+
+/*
+ * Watch mode (--watch <dir>): assembles the .as files in the directory, and then keeps reassembling
+ * the ones that change (until interrupted), printing how long each reassembly took.
+ * Returns 0 if the watch ended normally, 1 if the directory can't be watched
+ */
+int watch_directory(char* dir_path);
+
+#endif